@@ -0,0 +1,35 @@
+#ifndef __ASSET_CACHE_H__
+#define __ASSET_CACHE_H__
+
+#include <cstdio>
+#include <cstdint>
+#include <string>
+#include "tiny_obj_loader.h"
+#include "textures.h"
+
+namespace konstructs {
+
+    /** An AssetCache keeps decoded images and parsed models on disk, so
+     *  that later starts do not need to decode them again. An entry
+     *  records the size and modification time of the file it was made
+     *  from and is ignored once they no longer match. Entries are
+     *  written to a temporary file first, a failed write only means
+     *  that the asset is decoded again on the next start.
+     */
+    class AssetCache {
+    public:
+        AssetCache();
+        bool get(const char *source, TextureImage &image) const;
+        void put(const char *source, const TextureImage &image) const;
+        bool get(const char *source, tinyobj::shape_t &shape) const;
+        void put(const char *source, const tinyobj::shape_t &shape) const;
+    private:
+        std::string path(const char *source) const;
+        FILE *open(const char *source, const uint32_t kind) const;
+        FILE *create(const char *source, const uint32_t kind) const;
+        void commit(const char *source, FILE *file) const;
+        std::string directory;
+    };
+};
+
+#endif
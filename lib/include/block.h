@@ -29,6 +29,15 @@
 #define STATE_GAS 2
 #define STATE_PLASMA 3
 
+/* Properties of a block type, kept in the flags of its BlockType
+ * together with its state */
+#define BLOCK_FLAG_PLANT 0x01
+#define BLOCK_FLAG_OBSTACLE 0x02
+#define BLOCK_FLAG_TRANSPARENT 0x04
+#define BLOCK_FLAG_ORIENTABLE 0x08
+#define BLOCK_STATE_SHIFT 4
+#define BLOCK_STATE_MASK 0x30
+
 namespace konstructs {
 
     extern const std::string direction_to_string[6];
@@ -37,13 +46,47 @@ namespace konstructs {
 
     using namespace Eigen;
 
+    /* Everything known about a block type, packed so that all
+     * properties of a type are read with a single load */
+    struct BlockType {
+        /* Texture tile of each side: left, right, top, bottom, front and back */
+        uint16_t textures[6];
+        uint8_t flags;
+    };
+
+    inline int block_state(const uint8_t flags) {
+        return (flags & BLOCK_STATE_MASK) >> BLOCK_STATE_SHIFT;
+    }
+
+    inline uint8_t block_flags(const bool plant, const bool obstacle, const bool transparent,
+                               const bool orientable, const int state) {
+        return (plant ? BLOCK_FLAG_PLANT : 0) |
+            (obstacle ? BLOCK_FLAG_OBSTACLE : 0) |
+            (transparent ? BLOCK_FLAG_TRANSPARENT : 0) |
+            (orientable ? BLOCK_FLAG_ORIENTABLE : 0) |
+            (state << BLOCK_STATE_SHIFT);
+    }
+
+    /* The table has room for all types, so that it never moves while
+     * models are built from it. Only the records of types that are in
+     * use are ever loaded into the cache. */
     struct BlockTypeInfo {
-        int blocks[BLOCK_TYPES][6];
-        char is_plant[BLOCK_TYPES];
-        char is_obstacle[BLOCK_TYPES];
-        char is_transparent[BLOCK_TYPES];
-        char is_orientable[BLOCK_TYPES];
-        char state[BLOCK_TYPES];
+        BlockType types[BLOCK_TYPES];
+        bool is_plant(const uint16_t type) const {
+            return types[type].flags & BLOCK_FLAG_PLANT;
+        }
+        bool is_obstacle(const uint16_t type) const {
+            return types[type].flags & BLOCK_FLAG_OBSTACLE;
+        }
+        bool is_transparent(const uint16_t type) const {
+            return types[type].flags & BLOCK_FLAG_TRANSPARENT;
+        }
+        bool is_orientable(const uint16_t type) const {
+            return types[type].flags & BLOCK_FLAG_ORIENTABLE;
+        }
+        int state(const uint16_t type) const {
+            return block_state(types[type].flags);
+        }
     };
 
     struct BlockData {
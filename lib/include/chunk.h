@@ -4,13 +4,16 @@
 #include <unordered_map>
 #include <memory>
 #include <utility>
+#include <vector>
 #include <Eigen/Geometry>
 #include "optional.hpp"
 #include "shader.h" //TODO: remove
 #include "block.h"
+#include "compress.h"
 
 #define BLOCK_SIZE 7
 #define CHUNK_SIZE 32
+#define CHUNK_BLOCKS (CHUNK_SIZE*CHUNK_SIZE*CHUNK_SIZE)
 #define BLOCK_BUFFER_SIZE (CHUNK_SIZE*CHUNK_SIZE*CHUNK_SIZE*BLOCK_SIZE)
 #define BLOCKS_HEADER_SIZE 6
 
@@ -27,21 +30,59 @@ namespace konstructs {
 
     Vector3i chunked_vec(const Vector3f position);
 
+    /* World position of the block with the given index in a chunk */
+    Vector3i block_position(const Vector3i &chunk, const int index);
+
+    /* Unpack a single block in the network format */
+    BlockData read_block(const uint8_t *data);
+
+    /* Pack a single block in the network format */
+    void write_block(const BlockData &block, uint8_t *data);
+
+    /* Unpack count blocks and check if they are all of the chunk
+     * type (uniform) and also fully lit by ambient light only (cached).
+     * The SSSE3 version gives the same result, and must only be used
+     * where has_ssse3() is true. */
+    void unpack_blocks_scalar(const uint8_t *data, const int count, BlockData *blocks, uint16_t *types,
+                              const uint16_t chunk_type, bool &uniform, bool &cached);
+    void unpack_blocks_ssse3(const uint8_t *data, const int count, BlockData *blocks, uint16_t *types,
+                             const uint16_t chunk_type, bool &uniform, bool &cached);
+    bool has_ssse3();
+
+    /* Allocate the blocks of a chunk, followed by room for a dense
+     * plane of their types. Blocks passed to ChunkData must be
+     * allocated with this. */
+    BlockData *allocate_chunk_blocks();
+
+    /* Changed blocks of a chunk, by index in the chunk */
+    typedef std::vector<std::pair<int, BlockData>> BlockChanges;
+
     class ChunkData {
     public:
-        ChunkData(const Vector3i _position, char *compressed, const int size, uint8_t *buffer,
-                  std::unordered_map<uint16_t, std::shared_ptr<BlockData>> &cached_data);
+        ChunkData(const Vector3i _position, char *compressed, const int size,
+                  std::unordered_map<uint16_t, std::shared_ptr<BlockData>> &cached_data,
+                  const int codec = CODEC_ZLIB);
         ChunkData(const Vector3i position, const uint32_t revision, BlockData *blocks);
         ChunkData(const uint16_t type);
         BlockData get(const Vector3i &pos) const;
+        uint16_t get_type(const Vector3i &pos) const;
+        /* The type of every block, for code that only needs the types */
+        const uint16_t *types() const;
         ChunkData set(const Vector3i &pos, const BlockData &data) const;
-        optional<pair<Block, Block>> get(const Vector3f &camera_position,
-                                         const Vector3f &camera_direction,
-                                         const float max_distance,
-                                         const BlockTypeInfo &blocks) const;
+        ChunkData apply(const uint32_t new_revision, const BlockChanges &changes) const;
+        /* Header and blocks compressed with zlib, as sent by the server */
+        std::vector<char> encode() const;
         Vector3i position;
         uint32_t revision;
         std::shared_ptr<BlockData> blocks;
+        /* All blocks of the chunk are of the same type */
+        bool uniform;
+        /* The blocks are shared with other chunks that are the same,
+         * they are not freed with the chunk */
+        bool shared;
+        /* Every block was decoded, a chunk that is not complete was
+         * short or damaged and the blocks that are missing are air */
+        bool complete;
     };
 
     extern ChunkData SOLID_CHUNK;
@@ -49,9 +90,11 @@ namespace konstructs {
 
 };
 
-#define CHUNK_FOR_EACH(blocks, ex, ey, ez, eb) \
+/* The loops that go through the height of a chunk visit the blocks
+ * with ey from y0 up to, but not including, y1 */
+#define CHUNK_FOR_EACH(blocks, y0, y1, ex, ey, ez, eb) \
   for(int ex = 0; ex < CHUNK_SIZE; ex++) { \
-    for(int ey = 0; ey < CHUNK_SIZE; ey++) { \
+    for(int ey = y0; ey < y1; ey++) { \
       for(int ez = 0; ez < CHUNK_SIZE; ez++) { \
         BlockData eb = blocks[ex+ey*CHUNK_SIZE+ez*CHUNK_SIZE*CHUNK_SIZE];
 
@@ -60,15 +103,15 @@ namespace konstructs {
      } \
    }
 
-#define CHUNK_FOR_EACH_YZ(blocks, x, ex, ey, ez, eb)     \
-  for(int ey = 0; ey < CHUNK_SIZE; ey++) { \
+#define CHUNK_FOR_EACH_YZ(blocks, x, y0, y1, ex, ey, ez, eb) \
+  for(int ey = y0; ey < y1; ey++) { \
     for(int ez = 0; ez < CHUNK_SIZE; ez++) { \
       int ex = x; \
       BlockData eb = blocks[ex+ey*CHUNK_SIZE+ez*CHUNK_SIZE*CHUNK_SIZE];
 
-#define CHUNK_FOR_EACH_XY(blocks, z, ex, ey, ez, eb)     \
+#define CHUNK_FOR_EACH_XY(blocks, z, y0, y1, ex, ey, ez, eb) \
   for(int ex = 0; ex < CHUNK_SIZE; ex++) { \
-    for(int ey = 0; ey < CHUNK_SIZE; ey++) { \
+    for(int ey = y0; ey < y1; ey++) { \
       int ez = z; \
       BlockData eb = blocks[ex+ey*CHUNK_SIZE+ez*CHUNK_SIZE*CHUNK_SIZE];
 
@@ -88,8 +131,8 @@ namespace konstructs {
     int ez = z; \
     BlockData eb = blocks[ex+ey*CHUNK_SIZE+ez*CHUNK_SIZE*CHUNK_SIZE];
 
-#define CHUNK_FOR_EACH_Y(blocks, x, z, ex, ey, ez, eb)   \
-  for(int ey = 0; ey < CHUNK_SIZE; ey++) { \
+#define CHUNK_FOR_EACH_Y(blocks, x, z, y0, y1, ex, ey, ez, eb) \
+  for(int ey = y0; ey < y1; ey++) { \
     int ez = z; \
     int ex = x; \
     BlockData eb = blocks[ex+ey*CHUNK_SIZE+ez*CHUNK_SIZE*CHUNK_SIZE];
@@ -2,14 +2,28 @@
 #define __CHUNK_FACTORY_H__
 
 #include <memory>
-#include <unordered_map>
-#include <unordered_set>
 #include <mutex>
+#include <chrono>
 #include <condition_variable>
 
 #include "chunk.h"
 #include "world.h"
 #include "matrix.h"
+#include "chunk_map.h"
+#include "model_cache.h"
+
+/* Distance (in chunks) a chunk must move past a level of detail
+ * threshold before its mesh is swapped */
+#define LOD_HYSTERESIS 1.0f
+
+/* Chunk models are split into horizontal slabs of CHUNK_SECTION_HEIGHT
+ * blocks, each section can be rebuilt without rebuilding the others */
+#define CHUNK_SECTION_HEIGHT 8
+#define CHUNK_SECTIONS (CHUNK_SIZE / CHUNK_SECTION_HEIGHT)
+#define ALL_SECTIONS ((1 << CHUNK_SECTIONS) - 1)
+
+/* Milliseconds a model waits for its face neighbours before it is built anyway */
+#define MODEL_DEFER_TIMEOUT 500
 
 namespace konstructs {
     using std::shared_ptr;
@@ -36,14 +50,34 @@ namespace konstructs {
         const ChunkData self;
     };
 
+    /* A model waiting to be built */
+    struct ChunkModelJob {
+        ChunkModelJob(const ChunkModelData &data, const int sections, const int lod);
+        const ChunkModelData data;
+        /* Sections to build */
+        int sections;
+        /* Level of detail of the model the chunk has, -1 if it has none */
+        int lod;
+        /* All face neighbours were loaded when the job was queued */
+        bool complete;
+        std::chrono::steady_clock::time_point queued;
+    };
+
     class ChunkModelResult {
     public:
         ChunkModelResult(const Vector3i _position, const int components,
-                         const int _faces);
+                         const int _faces, const int _lod, const int _sections);
         ~ChunkModelResult();
         const Vector3i position;
         const int size;
         const int faces;
+        /* Level of detail, each voxel in the mesh covers 2^lod blocks */
+        const int lod;
+        /* Bit mask of the sections contained in this result, the data
+         * of the sections is stored in order */
+        const int sections;
+        /* Number of faces of each section */
+        int section_faces[CHUNK_SECTIONS];
         GLuint *data();
     private:
         GLuint *mData;
@@ -51,27 +85,54 @@ namespace konstructs {
 
     class ChunkModelFactory {
     public:
-        ChunkModelFactory(const BlockTypeInfo &_block_data);
+        ChunkModelFactory(const BlockTypeInfo &_block_data,
+                          const int _lod_half_distance,
+                          const int _lod_quarter_distance);
         int waiting();
         int total();
         int total_empty();
         int total_created();
+        int total_trivial();
+        int total_cancelled();
+        int total_coalesced();
+        int total_cached();
+        void clear_cache();
         void update_player_chunk(const Vector3i &chunk);
         void create_models(const std::vector<Vector3i> &positions,
                            const World &world);
+        void refresh_models(const std::vector<Vector3i> &positions,
+                            const World &world);
+        void update_block(const Vector3i &block, const World &world);
+        void update_blocks(const Vector3i &position, const BlockChanges &changes,
+                           const World &world);
+        int level_of_detail(const float distance, const int current) const;
         std::vector<std::shared_ptr<ChunkModelResult>> fetch_models();
     private:
+        const BlockTypeInfo &block_data;
+        const int lod_half_distance;
+        const int lod_quarter_distance;
+        ModelCache cache;
         int processed;
         int empty;
         int created;
+        int trivial;
+        int cancelled;
+        int coalesced;
         void worker();
+        void queue_model(const Vector3i &position, const int sections,
+                         const World &world);
+        void queue_job(const ChunkModelData &data, const int sections);
+        void queue_sections(const ChunkMap<int> &sections, const World &world);
+        int model_lod(const Vector3i &position) const;
         std::mutex mutex;
         std::condition_variable chunks_condition;
         Vector3i player_chunk;
-        std::unordered_set<Vector3i, matrix_hash<Vector3i>> chunks;
-        std::unordered_map<Vector3i, ChunkModelData, matrix_hash<Vector3i>> model_data;
+        ChunkMap<ChunkModelJob> jobs;
+        ChunkMap<ChunkModelJob> computing;
+        /* Level of detail of the fetched model of each chunk, chunks
+         * without a model (or too far away to keep a level) are missing */
+        ChunkMap<int> model_lods;
         std::vector<std::shared_ptr<ChunkModelResult>> models;
-        const BlockTypeInfo &block_data;
     };
 
     std::vector<ChunkModelData> adjacent(const Vector3i position, const World &world);
@@ -79,7 +140,13 @@ namespace konstructs {
                               const World &world);
     const ChunkModelData create_model_data(const Vector3i &position,
                                            const World &world);
+    bool same_model_data(const ChunkModelData &a, const ChunkModelData &b);
+    bool model_key(const ChunkModelData &data, const int lod, ModelKey &key);
 
-    shared_ptr<ChunkModelResult> compute_chunk(const ChunkModelData &data, const BlockTypeInfo &block_data);
+    bool chunk_hidden(const ChunkModelData &data, const BlockTypeInfo &block_data);
+    shared_ptr<ChunkModelResult> compute_chunk(const ChunkModelData &data, const BlockTypeInfo &block_data,
+            const int sections);
+    shared_ptr<ChunkModelResult> compute_chunk_lod(const ChunkModelData &data, const BlockTypeInfo &block_data,
+            const int lod);
 };
 #endif
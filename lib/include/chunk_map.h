@@ -0,0 +1,386 @@
+#ifndef __CHUNK_MAP_H__
+#define __CHUNK_MAP_H__
+
+#include <algorithm>
+#include <cstdint>
+#include <cstddef>
+#include <iterator>
+#include <new>
+#include <stdexcept>
+#include <type_traits>
+#include <utility>
+#include <vector>
+#include "matrix.h"
+
+/* Slots that hold no entry, packed positions never have the top bit set */
+#define CHUNK_MAP_EMPTY (~(uint64_t)0)
+#define CHUNK_MAP_DELETED (~(uint64_t)0 - 1)
+#define CHUNK_MAP_MIN_CAPACITY 16
+
+namespace konstructs {
+
+    /* Pack a chunk position into 63 bits, 21 bits per axis */
+    inline uint64_t pack_chunk_position(const Vector3i &pos) {
+        const uint64_t mask = (1 << 21) - 1;
+        return ((uint64_t)pos[0] & mask) |
+            (((uint64_t)pos[1] & mask) << 21) |
+            (((uint64_t)pos[2] & mask) << 42);
+    }
+
+    /* Spread the bits of a packed position over the whole hash,
+     * neighbouring chunks only differ in the lowest bits of each axis */
+    inline uint64_t mix_chunk_position(uint64_t key) {
+        key ^= key >> 30;
+        key *= 0xbf58476d1ce4e5b9ULL;
+        key ^= key >> 27;
+        key *= 0x94d049bb133111ebULL;
+        key ^= key >> 31;
+        return key;
+    }
+
+    /* The key of an entry in a ChunkMap or a ChunkSet */
+    inline const Vector3i &chunk_entry_key(const Vector3i &entry) {
+        return entry;
+    }
+
+    template<class V>
+    inline const Vector3i &chunk_entry_key(const std::pair<const Vector3i, V> &entry) {
+        return entry.first;
+    }
+
+    /** A ChunkTable is an open addressing hash table of entries that
+     *  are keyed by chunk position. The packed position of every slot
+     *  is kept apart from the entries, so that probing only touches a
+     *  dense array of integers. Erased entries leave a marker behind
+     *  that is reused by later inserts, iterators to other entries stay
+     *  valid when erasing. Inserts may move all entries.
+     */
+    template<class Entry>
+    class ChunkTable {
+    public:
+        template<class T, class Table>
+        class basic_iterator {
+        public:
+            typedef std::forward_iterator_tag iterator_category;
+            typedef T value_type;
+            typedef std::ptrdiff_t difference_type;
+            typedef T *pointer;
+            typedef T &reference;
+
+            basic_iterator() : table(nullptr), slot(0) {}
+            basic_iterator(Table *table, size_t slot) : table(table), slot(slot) {}
+            template<class U, class UTable>
+            basic_iterator(const basic_iterator<U, UTable> &other) :
+                table(other.table), slot(other.slot) {}
+
+            T &operator*() const {
+                return table->entry(slot);
+            }
+            T *operator->() const {
+                return &table->entry(slot);
+            }
+            basic_iterator &operator++() {
+                slot = table->next(slot + 1);
+                return *this;
+            }
+            basic_iterator operator++(int) {
+                basic_iterator old = *this;
+                ++(*this);
+                return old;
+            }
+            template<class U, class UTable>
+            bool operator==(const basic_iterator<U, UTable> &other) const {
+                return slot == other.slot;
+            }
+            template<class U, class UTable>
+            bool operator!=(const basic_iterator<U, UTable> &other) const {
+                return slot != other.slot;
+            }
+
+            Table *table;
+            size_t slot;
+        };
+
+        typedef Entry value_type;
+        typedef basic_iterator<Entry, ChunkTable> iterator;
+        typedef basic_iterator<const Entry, const ChunkTable> const_iterator;
+
+        ChunkTable() : entries(nullptr), used(0), deleted(0) {}
+
+        ChunkTable(const ChunkTable &other) : entries(nullptr), used(0), deleted(0) {
+            *this = other;
+        }
+
+        ChunkTable(ChunkTable &&other) : entries(nullptr), used(0), deleted(0) {
+            *this = std::move(other);
+        }
+
+        ~ChunkTable() {
+            destroy();
+        }
+
+        ChunkTable &operator=(const ChunkTable &other) {
+            if(this != &other) {
+                destroy();
+                if(other.used > 0) {
+                    /* Entries are placed again, the erased slots they
+                     * were probed past are not copied */
+                    allocate(other.keys.size());
+                    const size_t mask = keys.size() - 1;
+                    for(size_t i = 0; i < other.keys.size(); i++) {
+                        if(other.full(i)) {
+                            size_t slot = mix_chunk_position(other.keys[i]) & mask;
+                            while(keys[slot] != CHUNK_MAP_EMPTY) {
+                                slot = (slot + 1) & mask;
+                            }
+                            keys[slot] = other.keys[i];
+                            new (&entry(slot)) Entry(other.entry(i));
+                        }
+                    }
+                    used = other.used;
+                }
+            }
+            return *this;
+        }
+
+        ChunkTable &operator=(ChunkTable &&other) {
+            if(this != &other) {
+                destroy();
+                keys.swap(other.keys);
+                std::swap(entries, other.entries);
+                std::swap(used, other.used);
+                std::swap(deleted, other.deleted);
+            }
+            return *this;
+        }
+
+        iterator begin() {
+            return iterator(this, next(0));
+        }
+        iterator end() {
+            return iterator(this, keys.size());
+        }
+        const_iterator begin() const {
+            return const_iterator(this, next(0));
+        }
+        const_iterator end() const {
+            return const_iterator(this, keys.size());
+        }
+
+        size_t size() const {
+            return used;
+        }
+        bool empty() const {
+            return used == 0;
+        }
+
+        iterator find(const Vector3i &pos) {
+            return iterator(this, lookup(pos));
+        }
+        const_iterator find(const Vector3i &pos) const {
+            return const_iterator(this, lookup(pos));
+        }
+        size_t count(const Vector3i &pos) const {
+            return lookup(pos) != keys.size() ? 1 : 0;
+        }
+
+        iterator erase(const_iterator it) {
+            remove(it.slot);
+            return iterator(this, next(it.slot + 1));
+        }
+        size_t erase(const Vector3i &pos) {
+            size_t slot = lookup(pos);
+            if(slot == keys.size()) {
+                return 0;
+            }
+            remove(slot);
+            return 1;
+        }
+
+        void clear() {
+            destroy();
+        }
+
+        /* Make room for count entries without moving them again */
+        void reserve(size_t count) {
+            size_t capacity = CHUNK_MAP_MIN_CAPACITY;
+            while(capacity * 3 < count * 4) {
+                capacity *= 2;
+            }
+            if(capacity > keys.size()) {
+                rehash(capacity);
+            }
+        }
+
+        std::pair<iterator, bool> insert(const Entry &value) {
+            return emplace(value);
+        }
+
+        template<class... Args>
+        std::pair<iterator, bool> emplace(Args&&... args) {
+            /* Keys are only known after the entry is constructed */
+            Entry value(std::forward<Args>(args)...);
+            const Vector3i &pos = chunk_entry_key(value);
+            size_t slot = lookup(pos);
+            if(slot != keys.size()) {
+                return {iterator(this, slot), false};
+            }
+            slot = claim(pos);
+            new (&entry(slot)) Entry(std::move(value));
+            return {iterator(this, slot), true};
+        }
+
+    protected:
+        typedef typename std::aligned_storage<sizeof(Entry), alignof(Entry)>::type Storage;
+
+        Entry &entry(size_t slot) {
+            return *reinterpret_cast<Entry*>(&entries[slot]);
+        }
+        const Entry &entry(size_t slot) const {
+            return *reinterpret_cast<const Entry*>(&entries[slot]);
+        }
+
+        bool full(size_t slot) const {
+            return keys[slot] < CHUNK_MAP_DELETED;
+        }
+
+        /* The first slot from slot that holds an entry */
+        size_t next(size_t slot) const {
+            while(slot < keys.size() && !full(slot)) {
+                slot++;
+            }
+            return slot;
+        }
+
+        /* The slot of a position, or the capacity if it is not present */
+        size_t lookup(const Vector3i &pos) const {
+            if(used == 0) {
+                return keys.size();
+            }
+            const uint64_t key = pack_chunk_position(pos);
+            const size_t mask = keys.size() - 1;
+            size_t slot = mix_chunk_position(key) & mask;
+            while(keys[slot] != CHUNK_MAP_EMPTY) {
+                if(keys[slot] == key) {
+                    return slot;
+                }
+                slot = (slot + 1) & mask;
+            }
+            return keys.size();
+        }
+
+        /* Find a free slot for a position that is not present */
+        size_t claim(const Vector3i &pos) {
+            if((used + deleted + 1) * 4 > keys.size() * 3) {
+                /* Only grow if erased slots are not enough */
+                size_t capacity = std::max(keys.size(), (size_t)CHUNK_MAP_MIN_CAPACITY);
+                if((used + 1) * 2 > capacity) {
+                    capacity *= 2;
+                }
+                rehash(capacity);
+            }
+            const uint64_t key = pack_chunk_position(pos);
+            const size_t mask = keys.size() - 1;
+            size_t slot = mix_chunk_position(key) & mask;
+            while(full(slot)) {
+                slot = (slot + 1) & mask;
+            }
+            if(keys[slot] == CHUNK_MAP_DELETED) {
+                deleted--;
+            }
+            keys[slot] = key;
+            used++;
+            return slot;
+        }
+
+        void remove(size_t slot) {
+            entry(slot).~Entry();
+            keys[slot] = CHUNK_MAP_DELETED;
+            used--;
+            deleted++;
+        }
+
+        void allocate(size_t capacity) {
+            keys.assign(capacity, CHUNK_MAP_EMPTY);
+            entries = new Storage[capacity];
+        }
+
+        void rehash(size_t capacity) {
+            std::vector<uint64_t> old_keys;
+            old_keys.swap(keys);
+            Storage *old_entries = entries;
+            allocate(capacity);
+            used = 0;
+            deleted = 0;
+            const size_t mask = capacity - 1;
+            for(size_t i = 0; i < old_keys.size(); i++) {
+                if(old_keys[i] < CHUNK_MAP_DELETED) {
+                    Entry &old = *reinterpret_cast<Entry*>(&old_entries[i]);
+                    size_t slot = mix_chunk_position(old_keys[i]) & mask;
+                    while(keys[slot] != CHUNK_MAP_EMPTY) {
+                        slot = (slot + 1) & mask;
+                    }
+                    keys[slot] = old_keys[i];
+                    new (&entry(slot)) Entry(std::move(old));
+                    old.~Entry();
+                    used++;
+                }
+            }
+            delete[] old_entries;
+        }
+
+        void destroy() {
+            for(size_t i = 0; i < keys.size(); i++) {
+                if(full(i)) {
+                    entry(i).~Entry();
+                }
+            }
+            delete[] entries;
+            entries = nullptr;
+            keys.clear();
+            used = 0;
+            deleted = 0;
+        }
+
+        std::vector<uint64_t> keys;
+        Storage *entries;
+        size_t used;
+        size_t deleted;
+    };
+
+    /** A map from chunk positions, see ChunkTable */
+    template<class V>
+    class ChunkMap : public ChunkTable<std::pair<const Vector3i, V>> {
+        typedef ChunkTable<std::pair<const Vector3i, V>> Table;
+    public:
+        typedef V mapped_type;
+
+        V &at(const Vector3i &pos) {
+            auto it = this->find(pos);
+            if(it == this->end()) {
+                throw std::out_of_range("No chunk at position");
+            }
+            return it->second;
+        }
+        const V &at(const Vector3i &pos) const {
+            auto it = this->find(pos);
+            if(it == this->end()) {
+                throw std::out_of_range("No chunk at position");
+            }
+            return it->second;
+        }
+
+        V &operator[](const Vector3i &pos) {
+            auto it = this->find(pos);
+            if(it == this->end()) {
+                it = this->emplace(pos, V()).first;
+            }
+            return it->second;
+        }
+    };
+
+    /** A set of chunk positions, see ChunkTable */
+    class ChunkSet : public ChunkTable<Vector3i> {};
+};
+
+#endif
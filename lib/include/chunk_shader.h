@@ -2,12 +2,12 @@
 #define __CHUNK_SHADER_H__
 
 #include <memory>
-#include <unordered_map>
 #include "shader.h"
 #include "player.h"
 #include "chunk.h"
 #include "chunk_factory.h"
 #include "matrix.h"
+#include "chunk_map.h"
 
 namespace konstructs {
     using std::shared_ptr;
@@ -16,13 +16,23 @@ namespace konstructs {
     public:
         ChunkModel(const shared_ptr<ChunkModelResult> &data,
                    GLuint data_attr);
+        bool update(const shared_ptr<ChunkModelResult> &data);
         virtual void bind();
         virtual int vertices();
         const Vector3i position;
-        const int faces;
+        int faces;
+        /* Level of detail the model was built at */
+        const int lod;
+        /* A model at another level of detail has been requested */
+        bool lod_requested;
         Matrix4f translation;
     private:
         const GLuint data_attr;
+        /* Position (in faces) of each section in the buffer */
+        int section_first[CHUNK_SECTIONS];
+        /* Faces of each section and the faces reserved for it */
+        int section_faces[CHUNK_SECTIONS];
+        int section_capacity[CHUNK_SECTIONS];
     };
 
     class ChunkShader : public ShaderProgram {
@@ -31,13 +41,16 @@ namespace konstructs {
                     const GLuint sky_texture, const float near_distance, const string &vert_str,
                     const string &frag_str);
         int size() const;
-        void add(const shared_ptr<ChunkModelResult> &data);
+        bool add(const shared_ptr<ChunkModelResult> &data);
+        std::vector<Vector3i> lod_updates(const ChunkModelFactory &factory,
+                                          const Vector3i &player_chunk);
         int render(const Player &p, const int width, const int height,
                    const float current_daylight, const float current_timer,
                    const int radius, const float view_distance, const Vector3i &player_chunk);
         const GLuint data_attr;
         const GLuint matrix;
         const GLuint translation;
+        const GLuint scale;
         const GLuint sampler;
         const GLuint sky_sampler;
         const GLuint damage_sampler;
@@ -51,7 +64,7 @@ namespace konstructs {
         const GLuint damage_texture;
         const float near_distance;
     private:
-        std::unordered_map<Vector3i, ChunkModel *, matrix_hash<Vector3i>> models;
+        ChunkMap<ChunkModel *> models;
         const float fov;
     };
 
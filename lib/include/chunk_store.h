@@ -0,0 +1,94 @@
+#ifndef __CHUNK_STORE_H__
+#define __CHUNK_STORE_H__
+
+#include <condition_variable>
+#include <cstdio>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <thread>
+#include <vector>
+#include "matrix.h"
+#include "chunk.h"
+#include "chunk_map.h"
+
+namespace konstructs {
+
+    /* Location of a chunk in the store */
+    struct ChunkStoreEntry {
+        long offset;
+        uint32_t size;
+        uint32_t revision;
+        int codec;
+    };
+
+    /* A chunk that is waiting to be written, either compressed data
+     * as received from the server or a chunk that must be encoded. A
+     * chunk with neither is waiting to be removed. */
+    struct PendingChunk {
+        uint64_t sequence;
+        uint32_t revision;
+        int codec;
+        std::shared_ptr<const std::vector<char>> data;
+        std::shared_ptr<const ChunkData> chunk;
+    };
+
+    /** A ChunkStore keeps the chunks received from a server on disk, so
+     *  that they can be shown before the server has sent them again.
+     *  Chunks are appended to a single file together with their position
+     *  and revision, the latest record of a position replaces any
+     *  earlier ones. Chunks are written by a thread of the store, so
+     *  that storing a chunk never waits for the disk. The file is
+     *  compacted when it is opened, and by the writer once it has
+     *  grown large, if most of it is replaced records.
+     */
+    class ChunkStore {
+    public:
+        ChunkStore();
+        ~ChunkStore();
+        /** Open the store of a server, closing any store that was open */
+        bool open(const std::string &hostname);
+        void close();
+        /** Store the compressed data of a chunk, as received from the server */
+        void put(const Vector3i &position, const uint32_t revision, const int codec,
+                 const char *data, const uint32_t size);
+        /** Store a chunk that was changed by the client, such as when a
+         *  delta was applied to it */
+        void put(const ChunkData &chunk);
+        /** Remove a chunk from the store, such as one that can not be decoded */
+        void discard(const Vector3i &position);
+        /** Check if a chunk is in the store */
+        bool contains(const Vector3i &position);
+        /** Read the compressed data of a chunk and the codec it is
+         *  compressed with, returns false if the chunk is not in the store */
+        bool get(const Vector3i &position, std::vector<char> &data, int &codec);
+    private:
+        void queue(const Vector3i &position, PendingChunk chunk);
+        void writer();
+        void write(const Vector3i &position, const uint32_t revision, const int codec,
+                   const char *data, const uint32_t size);
+        void erase(const Vector3i &position);
+        bool read(const ChunkStoreEntry &entry, char *data);
+        bool open_file();
+        void compact();
+        void map_file();
+        void unmap_file();
+        std::mutex mutex;
+        std::string path;
+        FILE *file;
+        long file_size;
+        /* Size of the latest records, the rest of the file is replaced records */
+        long live;
+        char *mapped;
+        long mapped_size;
+        ChunkMap<ChunkStoreEntry> index;
+        std::mutex queue_mutex;
+        std::condition_variable queue_condition;
+        ChunkMap<PendingChunk> pending;
+        uint64_t sequence;
+        bool stopping;
+        std::thread writer_thread;
+    };
+};
+
+#endif
@@ -6,16 +6,19 @@
 #include <string>
 #include <memory>
 #include <queue>
-#include <unordered_set>
 #include <unordered_map>
 #include <thread>
 #include <Eigen/Geometry>
 #include "matrix.h"
 #include "optional.hpp"
 #include "chunk.h"
+#include "chunk_store.h"
+#include "chunk_map.h"
 
 #define KEEP_EXTRA_CHUNKS 2
 #define DEFAULT_PORT 4080
+/* Chunks loaded from the chunk store every time the chunk worker runs */
+#define STORE_LOADS 16
 
 namespace konstructs {
     using namespace std;
@@ -44,6 +47,14 @@ namespace konstructs {
         char *mBuffer;
     };
 
+    /* Changed blocks of a chunk, based on a revision the client may hold */
+    struct ChunkDelta {
+        Vector3i position;
+        uint32_t base;
+        uint32_t revision;
+        BlockChanges changes;
+    };
+
     struct ChunkToFetch {
         int score;
         Vector3i chunk;
@@ -63,7 +74,7 @@ namespace konstructs {
         void version(const int version, const string &nick, const string &hash);
         void position(const Vector3f position,
                       const float rx, const float ry);
-        void chunk(const Vector3i position);
+        void chunk(const Vector3i position, const uint32_t revision = 0);
         void konstruct();
         void click_inventory(const int item, const int button);
         void close_inventory();
@@ -79,6 +90,10 @@ namespace konstructs {
         vector<shared_ptr<Packet>> receive(const int max);
         optional<ChunkData> receive_prio_chunk(const Vector3i pos);
         vector<ChunkData> receive_chunks(const int max);
+        vector<ChunkDelta> receive_deltas();
+        void delta_applied(const ChunkData &chunk);
+        void refetch_chunk(const Vector3i &pos);
+        void forget(const vector<Vector3i> &positions);
         void set_player_chunk(const Vector3i &chunk);
         void set_radius(int r);
         void set_loaded_radius(int r);
@@ -90,15 +105,23 @@ namespace konstructs {
         void process_error(Packet *packet);
         void process_chunk(Packet *packet);
         void process_chunk_updated(Packet *packet);
+        void process_chunk_not_modified(Packet *packet);
+        void process_chunk_delta(Packet *packet);
+        void process_codec(Packet *packet);
+        void offer_codecs();
         void recv_worker();
         void send_worker();
         bool is_empty_chunk(Vector3i pos);
         bool is_updated_chunk(Vector3i pos);
         bool is_requested_chunk(Vector3i pos);
+        void request_chunk(const Vector3i &pos);
         void request_chunk_and_sleep(Vector3i pos, int msec);
+        void load_stored_chunks(priority_queue<ChunkToFetch, vector<ChunkToFetch>, LessThanByScore> &to_load,
+                                const Vector3i &p_chunk, const int r);
         void chunk_worker();
         void force_close();
-        void received_chunk(const Vector3i &pos);
+        void received_chunk(const Vector3i &pos, const uint32_t revision);
+        void chunk_not_modified(const Vector3i &pos);
         void chunk_updated(const Vector3i &pos);
         int bytes_sent;
         int sock;
@@ -113,22 +136,33 @@ namespace konstructs {
         std::thread *chunk_thread;
         std::queue<shared_ptr<Packet>> packets;
         std::deque<ChunkData> chunks;
+        std::vector<ChunkDelta> deltas;
         bool connected;
         bool debug_mode;
         bool logged_in;
         std::string error_message;
-        char *inflation_buffer;
+        /* Codec of the chunks sent by the server */
+        int codec;
         std::unordered_map<uint16_t, std::shared_ptr<BlockData>> cached_data;
+        ChunkStore store;
 
         /* Chunk worker */
         Vector3i player_chunk;
         int radius;
         int loaded_radius;
-        std::unordered_set<Vector3i, matrix_hash<Vector3i>> updated;
-        std::unordered_set<Vector3i, matrix_hash<Vector3i>> requested;
-        std::unordered_set<Vector3i, matrix_hash<Vector3i>> received;
-        std::vector<Vector3i> received_queue;
+        ChunkSet updated;
+        ChunkSet requested;
+        ChunkSet received;
+        ChunkSet stored;
+        /* Revisions of the chunks that have been received or loaded */
+        ChunkMap<uint32_t> held;
+        std::vector<char> store_buffer;
+        std::unordered_map<uint16_t, std::shared_ptr<BlockData>> store_cached_data;
+        std::vector<std::pair<Vector3i, uint32_t>> received_queue;
+        std::vector<Vector3i> not_modified_queue;
+        std::vector<std::pair<Vector3i, uint32_t>> held_queue;
         std::vector<Vector3i> updated_queue;
+        std::vector<Vector3i> forget_queue;
         std::mutex mutex_chunk;
     };
 };
@@ -1,6 +1,28 @@
 #ifndef __COMPRESS_H__
     #define __COMPRESS_H__
 
+    #include <functional>
+    #include <string>
+    #include <vector>
+
+    /* Compression of chunk payloads, zlib is used until the server
+     * agrees on another codec */
+    #define CODEC_ZLIB 0
+    #define CODEC_LZ4 1
+    #define CODEC_ZSTD 2
+
     int inflate_data(char *in, int in_size, char *out, int out_size);
+    /* Compress with zlib and append to out, returns the compressed size */
+    int deflate_data(const char *in, int in_size, std::vector<char> &out);
+    int decompress_data(const int codec, char *in, int in_size, char *out, int out_size);
+    /* Decompress a little at a time, consume is called with every part
+     * as soon as it has been decompressed. Returns the total size. */
+    int decompress_stream(const int codec, char *in, int in_size,
+                          const std::function<void(const char *data, int size)> &consume);
+    const char *codec_name(const int codec);
+    /* Returns -1 if the codec is unknown or not built in */
+    int codec_by_name(const std::string &name);
+    /* Codecs built in, in order of preference */
+    std::vector<int> supported_codecs();
 
 #endif
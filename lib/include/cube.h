@@ -16,20 +16,20 @@ void make_cube_faces(
 void make_cube(
     float *data, char ao[6][4],
     int left, int right, int top, int bottom, int front, int back,
-    float x, float y, float z, float n, int w, const int blocks[256][6]);
+    float x, float y, float z, float n, int w, const BlockType *types);
 
 void make_cube2(
     GLuint *data, char ao[6][4], uint8_t faces[6], RGBAmbient corner_data[8],
-    int x, int y, int z, const BlockData block, int damage, const int blocks[256][6]);
+    int x, int y, int z, const BlockData block, int damage, const BlockType *types);
 
 void make_rotated_cube(float *data, char ao[6][4],
                        int left, int right, int top, int bottom, int front, int back,
                        float x, float y, float z, float n, float rx, float ry, float rz,
-                       int w, const int blocks[256][6]);
+                       int w, const BlockType *types);
 
 void make_plant(
     GLuint *data, char ao,
-    int x, int y, int z, const BlockData block, const int blocks[256][6]);
+    int x, int y, int z, const BlockData block, const BlockType *types);
 
 void make_sphere(float *data, float r, int detail);
 
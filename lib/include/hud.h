@@ -2,7 +2,6 @@
 #define __HUD_H__
 
 #include <vector>
-#include <unordered_map>
 #include "optional.hpp"
 #include "matrix.h"
 #include "item.h"
@@ -28,18 +27,32 @@ namespace konstructs {
         int get_selection() const;
         void set_interactive(bool i);
         bool get_interactive() const;
-        std::unordered_map<Vector2i, int, matrix_hash<Vector2i>> backgrounds() const;
-        std::unordered_map<Vector2i, ItemStack, matrix_hash<Vector2i>> stacks() const;
+        void invalidate();
+        /* What is shown at a position of the grid, with the belt laid
+         * over the bottom row when the HUD is not interactive. A
+         * background below zero means that the position is empty. */
+        int background(const Vector2i &pos) const;
+        optional<ItemStack> stack(const Vector2i &pos) const;
+        /* Counters that change whenever background() or stack() would
+         * return something else, models only need to be rebuilt then */
+        uint32_t backgrounds_version() const;
+        uint32_t stacks_version() const;
         const int rows;
         const int columns;
     private:
-        std::unordered_map<Vector2i, int, matrix_hash<Vector2i>> bg;
-        std::unordered_map<Vector2i, ItemStack, matrix_hash<Vector2i>> item_stacks;
+        bool inside(const Vector2i &pos) const;
+        int index(const Vector2i &pos) const;
+        int belt_index(const Vector2i &pos) const;
+        /* Both are columns * rows large and stored row by row */
+        std::vector<int> bg;
+        std::vector<optional<ItemStack>> item_stacks;
         optional<ItemStack> held_stack;
         std::vector<optional<ItemStack>> belt;
         int belt_size;
         int selection;
         bool interactive;
+        uint32_t bg_version;
+        uint32_t stack_version;
     };
 
 };
@@ -1,6 +1,6 @@
 #ifndef __HUDSHADER_H__
 #define __HUDSHADER_H__
-#include <unordered_map>
+#include <vector>
 #include <Eigen/Geometry>
 #include "optional.hpp"
 #include "shader.h"
@@ -12,6 +12,10 @@ namespace konstructs {
     using nonstd::optional;
     using nonstd::nullopt;
 
+    /** The models of the HUD are kept by the HudShader and updated
+     *  when what they show changes. Their buffer is reused, it only
+     *  grows when an update has more vertices than it can hold.
+     */
     class BaseModel : public BufferModel {
     public:
         BaseModel(const GLuint position_attr, const GLuint normal_attr,
@@ -19,49 +23,52 @@ namespace konstructs {
         virtual void bind();
         virtual int vertices();
     protected:
+        float *reserve(const int vertices);
+        void upload(const float *data, const int vertices);
         int verts;
     private:
+        std::vector<float> scratch;
         const GLuint position_attr;
         const GLuint normal_attr;
         const GLuint uv_attr;
+        size_t capacity;
     };
 
     class ItemStackModel : public BaseModel {
     public:
         ItemStackModel(const GLuint position_attr, const GLuint normal_attr,
-                       const GLuint uv_attr,
-                       const std::unordered_map<Vector2i, ItemStack, matrix_hash<Vector2i>> &stacks,
-                       const BlockTypeInfo &blocks);
+                       const GLuint uv_attr);
+        void update(const Hud &hud, const BlockTypeInfo &blocks);
     };
 
     class HealthBarModel : public BaseModel {
     public:
-        HealthBarModel(const std::unordered_map<Vector2i, ItemStack, matrix_hash<Vector2i>> &stacks,
-                       const GLuint position_attr, const GLuint normal_attr,
+        HealthBarModel(const GLuint position_attr, const GLuint normal_attr,
                        const GLuint uv_attr);
+        void update(const Hud &hud);
     };
 
     class AmountModel : public BaseModel {
     public:
         AmountModel(const GLuint position_attr, const GLuint normal_attr,
-                    const GLuint uv_attr,
-                    const std::unordered_map<Vector2i, ItemStack, matrix_hash<Vector2i>> &stacks);
+                    const GLuint uv_attr);
+        void update(const Hud &hud);
     };
 
     class HudModel : public BaseModel {
     public:
-        HudModel(const std::unordered_map<Vector2i, int, matrix_hash<Vector2i>> &background,
-                 const GLuint position_attr, const GLuint normal_attr,
+        HudModel(const GLuint position_attr, const GLuint normal_attr,
                  const GLuint uv_attr);
+        void update(const Hud &hud);
     };
 
+    /* A single block centered on the origin */
     class BlockModel : public BaseModel {
     public:
         BlockModel(const GLuint position_attr, const GLuint normal_attr,
-                   const GLuint uv_attr,
-                   const int type, const float x, const float y,
-                   const float size,
-                   const BlockTypeInfo &blocks);
+                   const GLuint uv_attr);
+        void update(const int type, const float size,
+                    const BlockTypeInfo &blocks);
     };
 
     class HudShader: private ShaderProgram {
@@ -90,6 +97,16 @@ namespace konstructs {
         const int columns;
         const int rows;
         const float screen_area;
+        HudModel background_model;
+        ItemStackModel stack_model;
+        HealthBarModel health_bar_model;
+        AmountModel amount_model;
+        BlockModel held_model;
+        /* Versions of the HUD the models were last updated from */
+        uint32_t backgrounds_version;
+        uint32_t stacks_version;
+        int held_type;
+        float held_size;
     };
 };
 #endif
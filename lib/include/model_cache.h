@@ -0,0 +1,55 @@
+#ifndef __MODEL_CACHE_H__
+#define __MODEL_CACHE_H__
+
+#include <list>
+#include <memory>
+#include <mutex>
+#include <unordered_map>
+#include "matrix.h"
+
+/* Number of chunks a model is built from, the chunk itself and its neighbours */
+#define MODEL_INPUT_CHUNKS 19
+
+namespace konstructs {
+    using std::shared_ptr;
+
+    class ChunkModelResult;
+
+    /* Identifies a model by the revisions of the chunks it is built from */
+    struct ModelKey {
+        Vector3i position;
+        int lod;
+        /* Bit mask of the input chunks that were not loaded */
+        uint32_t missing;
+        uint32_t revisions[MODEL_INPUT_CHUNKS];
+        bool operator==(const ModelKey &other) const;
+    };
+
+    struct model_key_hash {
+        std::size_t operator()(const ModelKey &key) const;
+    };
+
+    /* Keeps the most recently built models, up to a total size in
+     * bytes, so that chunks that are received again without any
+     * changes do not need to be built again.
+     */
+    class ModelCache {
+    public:
+        ModelCache(const size_t max_size);
+        shared_ptr<ChunkModelResult> get(const ModelKey &key);
+        void put(const ModelKey &key, const shared_ptr<ChunkModelResult> &model);
+        void clear();
+        int hits();
+    private:
+        typedef std::list<std::pair<ModelKey, shared_ptr<ChunkModelResult>>> Entries;
+        std::mutex mutex;
+        /* Most recently used first */
+        Entries entries;
+        std::unordered_map<ModelKey, Entries::iterator, model_key_hash> index;
+        const size_t max_size;
+        size_t size;
+        int hit_count;
+    };
+};
+
+#endif
@@ -36,12 +36,26 @@ namespace konstructs {
         float ry();
         Vector3f position;
     private:
-        int collide(const World &world, const BlockTypeInfo &blocks,
-                    const float near_distance, const bool sneaking);
+        void tick(int sz, int sx, WorldCursor &cursor, const BlockTypeInfo &blocks,
+                  const float near_distance, const bool jump, const bool sneaking);
+        int collide(WorldCursor &cursor, const BlockTypeInfo &blocks,
+                    const Vector3f &delta, const float near_distance,
+                    const bool sneaking);
+        bool sweep(WorldCursor &cursor, const BlockTypeInfo &blocks,
+                   const Vector3f &low, const Vector3f &high,
+                   const int axis, const float distance);
+        bool supported(WorldCursor &cursor, const BlockTypeInfo &blocks,
+                       const Vector3f &low, const Vector3f &high);
         float mrx;
         float mry;
         bool flying;
         float dy;
+        /* Position after the latest physics tick, position is
+         * interpolated between it and the tick before */
+        Vector3f simulated;
+        Vector3f last_simulated;
+        /* Time not yet simulated */
+        float accumulator;
     };
 
 };
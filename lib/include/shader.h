@@ -152,7 +152,8 @@ namespace konstructs {
     class ShaderProgram {
     public:
         /** Creates a ShaderProgram instance.
-         *  @param shader_name Name of the shader
+         *  @param shader_name Name of the shader, must be unique as
+         *         the cached binary of the program is stored by name
          *  @param vertex_shader Code for the vertex shader
          *  @param fragment_shader Code for the fragment shader
          *  @param draw_mode The drawing mode used (see glDrawArrays),
@@ -180,10 +181,15 @@ namespace konstructs {
          *  of attributes provided in the vertex shader code.
          */
         GLuint attributeId(const std::string &aName);
+        /** Returns true if the program was loaded from a cached
+         *  binary instead of being compiled and linked.
+         */
+        bool loaded_from_cache() const;
     private:
         const std::string &name;
-        const GLuint vertex;
-        const GLuint fragment;
+        /* Zero when the program was loaded from a cached binary */
+        GLuint vertex;
+        GLuint fragment;
         const GLuint program;
         const GLenum draw_mode;
         GLuint vao;
@@ -1,9 +1,85 @@
 #ifndef __TEXTURES_H__
 #define __TEXTURES_H__
 
+#include <chrono>
+#include <deque>
+#include <future>
+#include <string>
+#include <utility>
+#include <vector>
 #include "tiny_obj_loader.h"
+#include "optional.hpp"
+
+/* Number of textures in each row and column of the block texture atlas */
+#define BLOCK_TEXTURE_TILES 16
 
 namespace konstructs {
+    using nonstd::optional;
+
+    /** A decoded RGBA image with its rows bottom up, as OpenGL expects
+     *  them. Each level after the first is half as large as the one
+     *  before it, down to a single pixel.
+     */
+    struct TextureImage {
+        unsigned int width;
+        unsigned int height;
+        std::vector<std::vector<unsigned char>> levels;
+        /* Levels that still show each tile of an atlas on its own */
+        int tile_levels;
+    };
+
+    /** Decodes the block texture atlas on a worker thread, so that the
+     *  main thread only has to upload it once it is ready. A texture
+     *  received while another is decoded does not wait for it, the
+     *  latest texture that is ready replaces those before it.
+     */
+    class BlockTextureDecoder {
+    public:
+        void decode(const char *in, const size_t size);
+        optional<TextureImage> fetch();
+    private:
+        /* Oldest first */
+        std::deque<std::future<TextureImage>> pending;
+    };
+
+    /* An asset and how it was loaded, for the startup report */
+    template<class T>
+    struct LoadedAsset {
+        T asset;
+        double seconds;
+        bool cached;
+    };
+
+    /** Loads the textures and the player model that are needed at
+     *  startup. Each is read from the asset cache, or decoded and then
+     *  cached, on a worker thread from the moment the loader is
+     *  created. The main thread only waits for them when it uploads
+     *  them, and in debug mode reports how long each phase took.
+     */
+    class AssetLoader {
+    public:
+        AssetLoader(const bool debug_mode);
+        void load_textures();
+        tinyobj::shape_t load_player();
+    private:
+        struct PendingTexture {
+            PendingTexture(const std::string &name, const int unit, const int filter,
+                           const bool clamp, std::future<LoadedAsset<TextureImage>> image) :
+                name(name), unit(unit), filter(filter), clamp(clamp), image(std::move(image)) {}
+            std::string name;
+            int unit;
+            int filter;
+            bool clamp;
+            std::future<LoadedAsset<TextureImage>> image;
+        };
+        void report(const char *name, const double seconds, const bool cached) const;
+        std::vector<PendingTexture> textures;
+        std::future<LoadedAsset<tinyobj::shape_t>> player;
+        std::chrono::steady_clock::time_point started;
+        bool debug_mode;
+        bool textures_loaded;
+    };
+
 #define BLOCK_TEXTURES 5
 #define SKY_TEXTURE 2
 #define FONT_TEXTURE 3
@@ -11,8 +87,8 @@ namespace konstructs {
 #define PLAYER_TEXTURE 6
 #define DAMAGE_TEXTURE 7
 #define HEALTH_BAR_TEXTURE 8
-    void load_textures();
-    tinyobj::shape_t load_player();
+    TextureImage decode_block_texture(const std::vector<char> &png);
+    void load_block_texture(const TextureImage &image);
     std::string load_chunk_vertex_shader();
     std::string load_chunk_fragment_shader();
 };
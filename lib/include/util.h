@@ -1,5 +1,6 @@
 #ifndef _util_h_
 #define _util_h_
+#include <string>
 #include<gl_includes.h>
 
 #define PI 3.14159265359
@@ -27,11 +28,15 @@ void update_fps(FPS *fps);
 
 GLuint gen_buffer(GLsizei size, GLfloat *data);
 GLuint gen_faces(int components, int faces, GLfloat *data);
-void load_png_texture(const char *file_name);
-void load_png_texture_from_buffer(const char *in, int size);
+void flip_image_vertical(unsigned char *data, unsigned int width, unsigned int height);
 int file_exist(const char *filename);
 
 namespace konstructs {
+    /* Directory for files kept between runs, empty if there is none */
+    std::string data_directory();
+    /* Only keep characters that are safe in a file name */
+    std::string safe_file_name(const std::string &name);
+
     template< typename T >
     struct array_deleter {
         void operator ()( T const * p) {
@@ -1,29 +1,78 @@
 #ifndef __WORLD_H__
 #define __WORLD_H__
 
-#include <unordered_map>
+#include <list>
 #include <memory>
+#include <vector>
 #include "matrix.h"
+#include "chunk_map.h"
 #include "client.h"
 #include "chunk.h"
 
+/* Memory used for chunks if nothing else is configured */
+#define DEFAULT_WORLD_BUDGET (1024 * 1024 * 1024)
+/* Least recently inserted chunks looked at by every call to evict */
+#define EVICTION_SCAN 32
+/* Chunks this close to the player are never evicted for the budget */
+#define EVICTION_MIN_DISTANCE 2
+
 namespace konstructs {
     using nonstd::optional;
 
+    /* Bookkeeping of a chunk in the world */
+    struct Residency {
+        std::list<Vector3i>::iterator lru;
+        size_t bytes;
+    };
+
     class World {
     public:
+        World(const size_t budget = DEFAULT_WORLD_BUDGET);
         int size() const;
+        size_t bytes() const;
+        size_t budget_bytes() const;
         void delete_unused_chunks(const Vector3i player_chunk, const int radi);
+        std::vector<Vector3i> evict(const Vector3i &player_chunk, const int radi,
+                                    const int max_evictions, int &budget_distance);
         void insert(const ChunkData data);
         const optional<BlockData> get_block(const Vector3i &block_pos) const;
+        const optional<uint16_t> get_type(const Vector3i &block_pos) const;
         const optional<ChunkData> chunk_by_block(const Vector3f &block_pos) const;
         const optional<ChunkData> chunk_by_block(const Vector3i &block_pos) const;
         const optional<ChunkData> chunk(const Vector3i &chunk_pos) const;
-        const std::vector<ChunkData> atAndAround(const Vector3i &pos) const;
-        std::unordered_map<Vector3i, ChunkData, matrix_hash<Vector3i>>::const_iterator find(const Vector3i &pos) const;
-        std::unordered_map<Vector3i, ChunkData, matrix_hash<Vector3i>>::const_iterator end() const;
+        ChunkMap<ChunkData>::const_iterator find(const Vector3i &pos) const;
+        ChunkMap<ChunkData>::const_iterator end() const;
+    private:
+        void erase(const Vector3i &pos);
+        ChunkMap<ChunkData> chunks;
+        ChunkMap<Residency> residency;
+        /* Most recently inserted first */
+        std::list<Vector3i> lru;
+        size_t budget;
+        size_t resident;
+    };
+
+    /** A WorldCursor reads blocks of a World for queries that stay in
+     *  a small area, like collisions and ray casts. It remembers the
+     *  chunks around the chunk it last read from, so that most reads
+     *  are resolved by indexing into the blocks of a chunk instead of
+     *  looking the chunk up in the world. A cursor must not be used
+     *  after chunks have been inserted into or removed from the world.
+     */
+    class WorldCursor {
+    public:
+        WorldCursor(const World &world);
+        const optional<uint16_t> get_type(const Vector3i &block_pos);
+        const optional<BlockData> get_block(const Vector3i &block_pos);
     private:
-        std::unordered_map<Vector3i, ChunkData, matrix_hash<Vector3i>> chunks;
+        const ChunkData *seek(const Vector3i &block_pos, int &index);
+        const World &world;
+        /* First block of the chunks the cursor remembers */
+        Vector3i origin;
+        /* The 3x3x3 chunks around the center chunk, null if not loaded */
+        const ChunkData *chunks[27];
+        /* Chunks that have been looked up in the world */
+        uint32_t known;
     };
 };
 
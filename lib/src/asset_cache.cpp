@@ -0,0 +1,178 @@
+#include <cstdio>
+#include <cstdint>
+#include <cstring>
+#include <sys/stat.h>
+#include "asset_cache.h"
+#include "util.h"
+
+/* Every entry starts with this, followed by the version and kind of the
+ * entry and the size and modification time of its source */
+#define CACHE_MAGIC "KAC1"
+#define CACHE_MAGIC_SIZE 4
+/* Change whenever the layout of an entry changes */
+#define CACHE_VERSION 1
+#define CACHE_KIND_IMAGE 1
+#define CACHE_KIND_SHAPE 2
+/* Larger arrays are taken as a sign of a damaged entry */
+#define CACHE_MAX_ARRAY_SIZE (256 * 1024 * 1024)
+
+namespace konstructs {
+
+    struct CacheHeader {
+        char magic[CACHE_MAGIC_SIZE];
+        uint32_t version;
+        uint32_t kind;
+        int64_t source_size;
+        int64_t source_time;
+    };
+
+    static bool make_header(const char *source, const uint32_t kind, CacheHeader &header) {
+        struct stat st;
+        if(stat(source, &st) != 0) {
+            return false;
+        }
+        memset(&header, 0, sizeof(header));
+        memcpy(header.magic, CACHE_MAGIC, CACHE_MAGIC_SIZE);
+        header.version = CACHE_VERSION;
+        header.kind = kind;
+        header.source_size = st.st_size;
+        header.source_time = st.st_mtime;
+        return true;
+    }
+
+    template<class T>
+    static void write_vector(FILE *file, const std::vector<T> &v) {
+        uint32_t size = v.size();
+        fwrite(&size, sizeof(size), 1, file);
+        if(size > 0) {
+            fwrite(v.data(), sizeof(T), size, file);
+        }
+    }
+
+    template<class T>
+    static bool read_vector(FILE *file, std::vector<T> &v) {
+        uint32_t size;
+        if(fread(&size, sizeof(size), 1, file) != 1 ||
+           size > CACHE_MAX_ARRAY_SIZE / sizeof(T)) {
+            return false;
+        }
+        v.resize(size);
+        return size == 0 || fread(v.data(), sizeof(T), size, file) == size;
+    }
+
+    AssetCache::AssetCache() : directory(data_directory()) {}
+
+    std::string AssetCache::path(const char *source) const {
+        return directory + "/" + safe_file_name(source) + ".cache";
+    }
+
+    /* Open the entry of a source, positioned after its header, if it
+     * is still up to date */
+    FILE *AssetCache::open(const char *source, const uint32_t kind) const {
+        CacheHeader expected;
+        if(directory.empty() || !make_header(source, kind, expected)) {
+            return nullptr;
+        }
+        FILE *file = fopen(path(source).c_str(), "rb");
+        if(!file) {
+            return nullptr;
+        }
+        CacheHeader header;
+        if(fread(&header, sizeof(header), 1, file) != 1 ||
+           memcmp(&header, &expected, sizeof(header)) != 0) {
+            fclose(file);
+            return nullptr;
+        }
+        return file;
+    }
+
+    /* Start writing a new entry of a source */
+    FILE *AssetCache::create(const char *source, const uint32_t kind) const {
+        CacheHeader header;
+        if(directory.empty() || !make_header(source, kind, header)) {
+            return nullptr;
+        }
+        FILE *file = fopen((path(source) + ".tmp").c_str(), "wb");
+        if(!file) {
+            return nullptr;
+        }
+        fwrite(&header, sizeof(header), 1, file);
+        return file;
+    }
+
+    /* Replace the entry of a source with the one that was written */
+    void AssetCache::commit(const char *source, FILE *file) const {
+        std::string entry_path = path(source);
+        std::string tmp_path = entry_path + ".tmp";
+        bool failed = ferror(file) != 0;
+        if(fclose(file) != 0 || failed) {
+            remove(tmp_path.c_str());
+            return;
+        }
+        /* Renaming onto an existing file fails on Windows */
+        remove(entry_path.c_str());
+        if(rename(tmp_path.c_str(), entry_path.c_str()) != 0) {
+            remove(tmp_path.c_str());
+        }
+    }
+
+    bool AssetCache::get(const char *source, TextureImage &image) const {
+        FILE *file = open(source, CACHE_KIND_IMAGE);
+        if(!file) {
+            return false;
+        }
+        uint32_t header[4];
+        bool ok = fread(header, sizeof(uint32_t), 4, file) == 4;
+        if(ok) {
+            image.width = header[0];
+            image.height = header[1];
+            image.tile_levels = header[2];
+            image.levels.resize(header[3] < 32 ? header[3] : 0);
+            ok = header[3] < 32;
+        }
+        for(size_t i = 0; ok && i < image.levels.size(); i++) {
+            ok = read_vector(file, image.levels[i]);
+        }
+        fclose(file);
+        return ok;
+    }
+
+    void AssetCache::put(const char *source, const TextureImage &image) const {
+        FILE *file = create(source, CACHE_KIND_IMAGE);
+        if(!file) {
+            return;
+        }
+        uint32_t header[4] = {image.width, image.height, (uint32_t)image.tile_levels,
+                              (uint32_t)image.levels.size()};
+        fwrite(header, sizeof(uint32_t), 4, file);
+        for(const auto &level : image.levels) {
+            write_vector(file, level);
+        }
+        commit(source, file);
+    }
+
+    bool AssetCache::get(const char *source, tinyobj::shape_t &shape) const {
+        FILE *file = open(source, CACHE_KIND_SHAPE);
+        if(!file) {
+            return false;
+        }
+        bool ok = read_vector(file, shape.mesh.positions) &&
+            read_vector(file, shape.mesh.normals) &&
+            read_vector(file, shape.mesh.texcoords) &&
+            read_vector(file, shape.mesh.indices);
+        fclose(file);
+        return ok;
+    }
+
+    void AssetCache::put(const char *source, const tinyobj::shape_t &shape) const {
+        FILE *file = create(source, CACHE_KIND_SHAPE);
+        if(!file) {
+            return;
+        }
+        write_vector(file, shape.mesh.positions);
+        write_vector(file, shape.mesh.normals);
+        write_vector(file, shape.mesh.texcoords);
+        write_vector(file, shape.mesh.indices);
+        commit(source, file);
+    }
+};
@@ -1,6 +1,18 @@
 #include <iostream>
+#include <algorithm>
 #include <memory>
+#include <cstddef>
 #include <string.h>
+#if defined(__GNUC__) && (defined(__x86_64__) || defined(__i386__))
+#include <tmmintrin.h>
+#define USE_SSSE3
+#define SSSE3_TARGET __attribute__((target("ssse3")))
+#elif defined(_MSC_VER) && defined(_M_X64)
+#include <intrin.h>
+#include <tmmintrin.h>
+#define USE_SSSE3
+#define SSSE3_TARGET
+#endif
 #include "block.h"
 #include "compress.h"
 #include "chunk.h"
@@ -13,38 +25,397 @@ namespace konstructs {
     ChunkData VACUUM_CHUNK(VACUUM_TYPE);
 
 
-    std::shared_ptr<BlockData> read_chunk_data(uint8_t *buffer,
-            std::unordered_map<uint16_t, std::shared_ptr<BlockData>> &cached_data) {
-        BlockData *blocks = new BlockData[CHUNK_SIZE*CHUNK_SIZE*CHUNK_SIZE];
-        uint16_t chunk_type = buffer[0] + (buffer[1] << 8);
-        bool use_cached = true;
-        for(int i = 0; i < CHUNK_SIZE*CHUNK_SIZE*CHUNK_SIZE; i++) {
-            blocks[i].type = buffer[i * BLOCK_SIZE] + (buffer[i * BLOCK_SIZE + 1] << 8);
-            blocks[i].health = buffer[i * BLOCK_SIZE + 2] + ((buffer[i * BLOCK_SIZE + 3] & 0x07) << 8);
-            blocks[i].direction = (buffer[i * BLOCK_SIZE + 3] & 0xE0) >> 5;
-            blocks[i].rotation = (buffer[i * BLOCK_SIZE + 3] & 0x18) >> 3;
-            blocks[i].ambient = (buffer[i * BLOCK_SIZE + 4] & 0xF);
-            blocks[i].r = (buffer[i * BLOCK_SIZE + 4] & 0xF0) >> 4;
-            blocks[i].g = (buffer[i * BLOCK_SIZE + 5] & 0xF);
-            blocks[i].b = (buffer[i * BLOCK_SIZE + 5] & 0xF0) >> 4;
-            blocks[i].light = (buffer[i * BLOCK_SIZE + 6] & 0xF);
+    BlockData read_block(const uint8_t *data) {
+        BlockData block;
+        block.type = data[0] + (data[1] << 8);
+        block.health = data[2] + ((data[3] & 0x07) << 8);
+        block.direction = (data[3] & 0xE0) >> 5;
+        block.rotation = (data[3] & 0x18) >> 3;
+        block.ambient = (data[4] & 0xF);
+        block.r = (data[4] & 0xF0) >> 4;
+        block.g = (data[5] & 0xF);
+        block.b = (data[5] & 0xF0) >> 4;
+        block.light = (data[6] & 0xF);
+        return block;
+    }
+
+    void write_block(const BlockData &block, uint8_t *data) {
+        data[0] = block.type & 0xFF;
+        data[1] = block.type >> 8;
+        data[2] = block.health & 0xFF;
+        data[3] = ((block.health >> 8) & 0x07) | ((block.rotation & 0x03) << 3) |
+            ((block.direction & 0x07) << 5);
+        data[4] = (block.ambient & 0xF) | ((block.r & 0xF) << 4);
+        data[5] = (block.g & 0xF) | ((block.b & 0xF) << 4);
+        data[6] = block.light & 0xF;
+    }
+
+    void unpack_blocks_scalar(const uint8_t *data, const int count, BlockData *blocks, uint16_t *types,
+                              const uint16_t chunk_type, bool &uniform, bool &cached) {
+        for(int i = 0; i < count; i++) {
+            blocks[i] = read_block(data + i * BLOCK_SIZE);
+            types[i] = blocks[i].type;
+            if(blocks[i].type != chunk_type) {
+                uniform = false;
+            }
             if(blocks[i].type != chunk_type || blocks[i].light > 0 || blocks[i].ambient < AMBIENT_LIGHT_FULL) {
-                use_cached = false;
+                cached = false;
             }
         }
+    }
+
+#if defined(USE_SSSE3)
+    /* Four blocks are unpacked at a time, from 28 bytes into three
+     * vectors, 48 bytes, of BlockData. Every output byte is a byte of
+     * the input that is masked, or shifted and masked. */
+#define UNPACK_BLOCKS 4
+#define UNPACK_VECTORS 3
+#define UNPACKED_BLOCK_SIZE 12
+
+    struct UnpackTables {
+        /* Input byte of every output byte, from the first and second 16 bytes */
+        uint8_t shuffle_lo[UNPACK_VECTORS][16];
+        uint8_t shuffle_hi[UNPACK_VECTORS][16];
+        /* Masks of the output bytes that are not shifted, shifted 3, 4 and 5 bits */
+        uint8_t mask0[UNPACK_VECTORS][16];
+        uint8_t mask3[UNPACK_VECTORS][16];
+        uint8_t mask4[UNPACK_VECTORS][16];
+        uint8_t mask5[UNPACK_VECTORS][16];
+        /* Output bytes of the type, ambient and light */
+        uint8_t type[UNPACK_VECTORS][16];
+        uint8_t cached[UNPACK_VECTORS][16];
+        /* Selects the low or the high byte of the type */
+        uint8_t type_high[UNPACK_VECTORS][16];
+        uint8_t ambient[UNPACK_VECTORS][16];
+        /* Input bytes of the four types, from the first and second 16 bytes */
+        uint8_t shuffle_types_lo[16];
+        uint8_t shuffle_types_hi[16];
+    };
+
+    static UnpackTables make_unpack_tables() {
+        static_assert(sizeof(BlockData) == UNPACKED_BLOCK_SIZE, "BlockData layout changed");
+        static_assert(offsetof(BlockData, health) == 2 && offsetof(BlockData, direction) == 4 &&
+                      offsetof(BlockData, light) == 10, "BlockData layout changed");
+        /* Input byte, shift and mask of every byte in BlockData */
+        const int source[UNPACKED_BLOCK_SIZE] = {0, 1, 2, 3, 3, 3, 4, 4, 5, 5, 6, -1};
+        const int shift[UNPACKED_BLOCK_SIZE] = {0, 0, 0, 0, 5, 3, 0, 4, 0, 4, 0, 0};
+        const int mask[UNPACKED_BLOCK_SIZE] = {0xFF, 0xFF, 0xFF, 0x07, 0x07, 0x03, 0x0F, 0x0F, 0x0F, 0x0F, 0x0F, 0};
+        UnpackTables t;
+        memset(&t, 0, sizeof(t));
+        for(int v = 0; v < UNPACK_VECTORS; v++) {
+            for(int j = 0; j < 16; j++) {
+                int o = v * 16 + j;
+                int field = o % UNPACKED_BLOCK_SIZE;
+                int in = source[field] < 0 ? -1 : (o / UNPACKED_BLOCK_SIZE) * BLOCK_SIZE + source[field];
+                t.shuffle_lo[v][j] = in >= 0 && in < 16 ? in : 0x80;
+                t.shuffle_hi[v][j] = in >= 16 ? in - 16 : 0x80;
+                uint8_t *masks[] = {t.mask0[v], nullptr, nullptr, t.mask3[v], t.mask4[v], t.mask5[v]};
+                masks[shift[field]][j] = mask[field];
+                if(field == 0 || field == 1) {
+                    t.type[v][j] = 0xFF;
+                    t.cached[v][j] = 0xFF;
+                    t.type_high[v][j] = field;
+                }
+                if(field == 6 || field == 10) {
+                    t.cached[v][j] = 0xFF;
+                }
+                if(field == 6) {
+                    t.ambient[v][j] = AMBIENT_LIGHT_FULL;
+                }
+            }
+        }
+        for(int j = 0; j < 16; j++) {
+            int in = j < 2 * UNPACK_BLOCKS ? (j / 2) * BLOCK_SIZE + j % 2 : -1;
+            t.shuffle_types_lo[j] = in >= 0 && in < 16 ? in : 0x80;
+            t.shuffle_types_hi[j] = in >= 16 ? in - 16 : 0x80;
+        }
+        return t;
+    }
+
+    SSSE3_TARGET
+    void unpack_blocks_ssse3(const uint8_t *data, const int count, BlockData *blocks, uint16_t *types,
+                             const uint16_t chunk_type, bool &uniform, bool &cached) {
+        static const UnpackTables t = make_unpack_tables();
+        __m128i shuffle_lo[UNPACK_VECTORS], shuffle_hi[UNPACK_VECTORS];
+        __m128i mask0[UNPACK_VECTORS], mask3[UNPACK_VECTORS], mask4[UNPACK_VECTORS], mask5[UNPACK_VECTORS];
+        __m128i type_mask[UNPACK_VECTORS], type_pattern[UNPACK_VECTORS];
+        __m128i cached_mask[UNPACK_VECTORS], cached_pattern[UNPACK_VECTORS];
+        const __m128i type_lo = _mm_set1_epi8((char)(chunk_type & 0xFF));
+        const __m128i type_hi = _mm_set1_epi8((char)(chunk_type >> 8));
+        const __m128i shuffle_types_lo = _mm_loadu_si128((const __m128i*)t.shuffle_types_lo);
+        const __m128i shuffle_types_hi = _mm_loadu_si128((const __m128i*)t.shuffle_types_hi);
+        for(int v = 0; v < UNPACK_VECTORS; v++) {
+            shuffle_lo[v] = _mm_loadu_si128((const __m128i*)t.shuffle_lo[v]);
+            shuffle_hi[v] = _mm_loadu_si128((const __m128i*)t.shuffle_hi[v]);
+            mask0[v] = _mm_loadu_si128((const __m128i*)t.mask0[v]);
+            mask3[v] = _mm_loadu_si128((const __m128i*)t.mask3[v]);
+            mask4[v] = _mm_loadu_si128((const __m128i*)t.mask4[v]);
+            mask5[v] = _mm_loadu_si128((const __m128i*)t.mask5[v]);
+            type_mask[v] = _mm_loadu_si128((const __m128i*)t.type[v]);
+            cached_mask[v] = _mm_loadu_si128((const __m128i*)t.cached[v]);
+            /* The type bytes of the chunk type, and full ambient light */
+            __m128i high = _mm_cmpeq_epi8(_mm_loadu_si128((const __m128i*)t.type_high[v]), _mm_set1_epi8(1));
+            __m128i type = _mm_or_si128(_mm_andnot_si128(high, type_lo), _mm_and_si128(high, type_hi));
+            type_pattern[v] = _mm_and_si128(type, type_mask[v]);
+            cached_pattern[v] = _mm_or_si128(type_pattern[v],
+                                             _mm_loadu_si128((const __m128i*)t.ambient[v]));
+        }
+
+        __m128i not_uniform = _mm_setzero_si128();
+        __m128i not_cached = _mm_setzero_si128();
+        int i = 0;
+        /* The second load reads 4 bytes past the blocks, stop while there
+         * is at least one more block */
+        for(; i + UNPACK_BLOCKS < count; i += UNPACK_BLOCKS) {
+            const uint8_t *in = data + i * BLOCK_SIZE;
+            __m128i lo = _mm_loadu_si128((const __m128i*)in);
+            __m128i hi = _mm_loadu_si128((const __m128i*)(in + 16));
+            __m128i *out = (__m128i*)(blocks + i);
+            _mm_storel_epi64((__m128i*)(types + i), _mm_or_si128(_mm_shuffle_epi8(lo, shuffle_types_lo),
+                                                                 _mm_shuffle_epi8(hi, shuffle_types_hi)));
+            for(int v = 0; v < UNPACK_VECTORS; v++) {
+                __m128i s = _mm_or_si128(_mm_shuffle_epi8(lo, shuffle_lo[v]),
+                                         _mm_shuffle_epi8(hi, shuffle_hi[v]));
+                __m128i r = _mm_and_si128(s, mask0[v]);
+                r = _mm_or_si128(r, _mm_and_si128(_mm_srli_epi16(s, 3), mask3[v]));
+                r = _mm_or_si128(r, _mm_and_si128(_mm_srli_epi16(s, 4), mask4[v]));
+                r = _mm_or_si128(r, _mm_and_si128(_mm_srli_epi16(s, 5), mask5[v]));
+                _mm_storeu_si128(out + v, r);
+                not_uniform = _mm_or_si128(not_uniform,
+                                           _mm_xor_si128(_mm_and_si128(r, type_mask[v]), type_pattern[v]));
+                not_cached = _mm_or_si128(not_cached,
+                                          _mm_xor_si128(_mm_and_si128(r, cached_mask[v]), cached_pattern[v]));
+            }
+        }
+        const __m128i zero = _mm_setzero_si128();
+        if(_mm_movemask_epi8(_mm_cmpeq_epi8(not_uniform, zero)) != 0xFFFF) {
+            uniform = false;
+        }
+        if(_mm_movemask_epi8(_mm_cmpeq_epi8(not_cached, zero)) != 0xFFFF) {
+            cached = false;
+        }
+        unpack_blocks_scalar(data + i * BLOCK_SIZE, count - i, blocks + i, types + i, chunk_type, uniform, cached);
+    }
+
+    bool has_ssse3() {
+#if defined(_MSC_VER)
+        int info[4];
+        __cpuid(info, 1);
+        return (info[2] & (1 << 9)) != 0;
+#else
+        return __builtin_cpu_supports("ssse3");
+#endif
+    }
+#else
+    void unpack_blocks_ssse3(const uint8_t *data, const int count, BlockData *blocks, uint16_t *types,
+                             const uint16_t chunk_type, bool &uniform, bool &cached) {
+        unpack_blocks_scalar(data, count, blocks, types, chunk_type, uniform, cached);
+    }
+
+    bool has_ssse3() {
+        return false;
+    }
+#endif
+
+    static void unpack_blocks(const uint8_t *data, const int count, BlockData *blocks, uint16_t *types,
+                              const uint16_t chunk_type, bool &uniform, bool &cached) {
+#if defined(USE_SSSE3)
+        static const bool ssse3 = has_ssse3();
+        if(ssse3) {
+            unpack_blocks_ssse3(data, count, blocks, types, chunk_type, uniform, cached);
+            return;
+        }
+#endif
+        unpack_blocks_scalar(data, count, blocks, types, chunk_type, uniform, cached);
+    }
+
+    /* The plane of types that follows the blocks */
+    static uint16_t *types_of(BlockData *blocks) {
+        return (uint16_t*)(blocks + CHUNK_BLOCKS);
+    }
+
+    static void free_chunk_blocks(BlockData *blocks) {
+        delete[] (char*)blocks;
+    }
+
+    static std::shared_ptr<BlockData> share_chunk_blocks(BlockData *blocks) {
+        return std::shared_ptr<BlockData>(blocks, free_chunk_blocks);
+    }
+
+    BlockData *allocate_chunk_blocks() {
+        return (BlockData*)new char[CHUNK_BLOCKS * (sizeof(BlockData) + sizeof(uint16_t))];
+    }
+
+    /* A block that may be replaced by the cached blocks of its type */
+    static bool cacheable_block(const uint8_t *block) {
+        return (block[6] & 0xF) == 0 && (block[4] & 0xF) == AMBIENT_LIGHT_FULL;
+    }
+
+    /* Blocks of a chunk where every block is the same, shared is set if
+     * they are the cached blocks of the type */
+    static std::shared_ptr<BlockData> same_chunk_data(const uint8_t *block,
+            std::unordered_map<uint16_t, std::shared_ptr<BlockData>> &cached_data,
+            bool &shared) {
+        const uint16_t type = block[0] + (block[1] << 8);
+        const bool cacheable = cacheable_block(block);
+        shared = cacheable;
+        if(cacheable) {
+            auto it = cached_data.find(type);
+            if(it != cached_data.end()) {
+                return it->second;
+            }
+        }
+        BlockData *blocks = allocate_chunk_blocks();
+        std::fill(blocks, blocks + CHUNK_BLOCKS, read_block(block));
+        std::fill(types_of(blocks), types_of(blocks) + CHUNK_BLOCKS, type);
+        auto r = share_chunk_blocks(blocks);
+        if(cacheable) {
+            cached_data.insert({type, r});
+        }
+        return r;
+    }
+
+    /* The first block repeated, so that a part can be compared with it
+     * whatever offset into a block the part starts at */
+#define PATTERN_BLOCKS 16
+
+    static bool same_blocks(const uint8_t *pattern, const int offset, const uint8_t *data, const int size) {
+        const int step = (PATTERN_BLOCKS - 1) * BLOCK_SIZE;
+        for(int i = 0; i < size; i += step) {
+            if(memcmp(data + i, pattern + offset, std::min(step, size - i)) != 0) {
+                return false;
+            }
+        }
+        return true;
+    }
+
+    /* Decompress and unpack the blocks of a chunk, a part at a time
+     * straight into the blocks of the chunk. As long as every block is
+     * the same as the first, which is the case for most chunks of sky
+     * or stone, the blocks are only compared and nothing is allocated
+     * until a different block is found. A payload of a single block in
+     * the network format is a chunk where every block is that block.
+     * Blocks that are cached for their type are shared. Blocks missing
+     * from data that is short or damaged are zero and complete is
+     * cleared. */
+    static std::shared_ptr<BlockData> read_chunk_data(const int codec, char *compressed, const int size,
+            std::unordered_map<uint16_t, std::shared_ptr<BlockData>> &cached_data,
+            bool &uniform, bool &shared, bool &complete) {
+        const int total = CHUNK_BLOCKS;
+        shared = false;
+        complete = true;
+        if(size == BLOCK_SIZE) {
+            uniform = true;
+            return same_chunk_data((uint8_t*)compressed, cached_data, shared);
+        }
+        BlockData *blocks = nullptr;
+        uint16_t *types = nullptr;
+        uint16_t chunk_type = 0;
+        bool use_cached = true;
+        bool first_block = true;
+        uniform = true;
+        int count = 0;
+        /* A block that is split between two parts */
+        uint8_t partial[BLOCK_SIZE];
+        int partial_size = 0;
+        /* Bytes that are all the same block */
+        uint8_t pattern[PATTERN_BLOCKS * BLOCK_SIZE];
+        bool scanning = true;
+        long scanned = 0;
+
+        /* Unpack the blocks that were all the same */
+        auto start_unpack = [&]() {
+            scanning = false;
+            blocks = allocate_chunk_blocks();
+            types = types_of(blocks);
+            if(scanned > 0) {
+                count = std::min(scanned / BLOCK_SIZE, (long)total);
+                chunk_type = pattern[0] + (pattern[1] << 8);
+                std::fill(blocks, blocks + count, read_block(pattern));
+                std::fill(types, types + count, chunk_type);
+                first_block = false;
+                partial_size = count < total ? scanned % BLOCK_SIZE : 0;
+                memcpy(partial, pattern, partial_size);
+            }
+        };
+
+        decompress_stream(codec, compressed, size, [&](const char *part, int part_size) {
+            const uint8_t *data = (const uint8_t*)part;
+            if(scanning && scanned == 0 && (part_size < BLOCK_SIZE || !cacheable_block(data))) {
+                // Only chunks that can be cached are worth scanning
+                start_unpack();
+            }
+            if(scanning) {
+                if(scanned == 0) {
+                    for(int i = 0; i < PATTERN_BLOCKS; i++) {
+                        memcpy(pattern + i * BLOCK_SIZE, data, BLOCK_SIZE);
+                    }
+                }
+                if(same_blocks(pattern, scanned % BLOCK_SIZE, data, part_size)) {
+                    scanned += part_size;
+                    return;
+                }
+                start_unpack();
+            }
+            if(partial_size > 0) {
+                int n = std::min(BLOCK_SIZE - partial_size, part_size);
+                memcpy(partial + partial_size, data, n);
+                partial_size += n;
+                data += n;
+                part_size -= n;
+                if(partial_size < BLOCK_SIZE) {
+                    return;
+                }
+                if(count < total) {
+                    if(first_block) {
+                        chunk_type = partial[0] + (partial[1] << 8);
+                        first_block = false;
+                    }
+                    unpack_blocks(partial, 1, blocks + count, types + count, chunk_type, uniform, use_cached);
+                    count++;
+                }
+                partial_size = 0;
+            }
+            int n = std::min(part_size / BLOCK_SIZE, total - count);
+            if(n > 0 && first_block) {
+                chunk_type = data[0] + (data[1] << 8);
+                first_block = false;
+            }
+            unpack_blocks(data, n, blocks + count, types + count, chunk_type, uniform, use_cached);
+            count += n;
+            if(count < total) {
+                partial_size = part_size - n * BLOCK_SIZE;
+                memcpy(partial, data + n * BLOCK_SIZE, partial_size);
+            }
+        });
+
+        if(scanning) {
+            if(scanned >= total * BLOCK_SIZE) {
+                return same_chunk_data(pattern, cached_data, shared);
+            }
+            start_unpack();
+        }
+        if(count < total) {
+            std::cout << "Chunk data too short: " << count << " blocks" << std::endl;
+            memset(blocks + count, 0, (total - count) * sizeof(BlockData));
+            memset(types + count, 0, (total - count) * sizeof(uint16_t));
+            uniform = false;
+            use_cached = false;
+            complete = false;
+        }
         if(use_cached) {
+            shared = true;
             try {
                 auto r = cached_data.at(chunk_type);
-                delete[] blocks;
+                free_chunk_blocks(blocks);
                 return r;
             } catch(std::out_of_range e)  {
-                std::shared_ptr<BlockData> r(blocks, std::default_delete<BlockData[]>());
+                auto r = share_chunk_blocks(blocks);
                 cached_data.insert({chunk_type, r});
                 return r;
             }
         } else {
-            std::shared_ptr<BlockData> r(blocks, std::default_delete<BlockData[]>());
-            return r;
+            return share_chunk_blocks(blocks);
         }
     }
 
@@ -68,23 +439,34 @@ namespace konstructs {
         return chunked_vec_int(position.cast<int>());
     }
 
-    ChunkData::ChunkData(const Vector3i position, char *compressed, const int size, uint8_t *buffer,
-                         std::unordered_map<uint16_t, std::shared_ptr<BlockData>> &cached_data):
+    Vector3i block_position(const Vector3i &chunk, const int index) {
+        int lx = index % CHUNK_SIZE;
+        int ly = (index / CHUNK_SIZE) % CHUNK_SIZE;
+        int lz = index / (CHUNK_SIZE * CHUNK_SIZE);
+        return Vector3i(chunk[0] * CHUNK_SIZE + lx, chunk[2] * CHUNK_SIZE + ly, chunk[1] * CHUNK_SIZE + lz);
+    }
+
+    ChunkData::ChunkData(const Vector3i position, char *compressed, const int size,
+                         std::unordered_map<uint16_t, std::shared_ptr<BlockData>> &cached_data,
+                         const int codec):
         position(position) {
-        int out_size = inflate_data(compressed + BLOCKS_HEADER_SIZE,
-                                    size - BLOCKS_HEADER_SIZE,
-                                    (char*)buffer, BLOCK_BUFFER_SIZE);
+        /* The revision is little endian, bytes must not be sign extended */
+        const uint8_t *header = (const uint8_t *)compressed;
         revision =
-            compressed[2] +
-            (compressed[2 + 1] << 8) +
-            (compressed[2 + 2] << 16) +
-            (compressed[2 + 3] << 24);
-        blocks = read_chunk_data(buffer, cached_data);
+            (uint32_t)header[2] |
+            ((uint32_t)header[2 + 1] << 8) |
+            ((uint32_t)header[2 + 2] << 16) |
+            ((uint32_t)header[2 + 3] << 24);
+        blocks = read_chunk_data(codec, compressed + BLOCKS_HEADER_SIZE,
+                                 size - BLOCKS_HEADER_SIZE, cached_data, uniform, shared, complete);
     }
 
-    ChunkData::ChunkData(const uint16_t type) : revision(0) {
-        BlockData *b = new BlockData[CHUNK_SIZE*CHUNK_SIZE*CHUNK_SIZE];
-        for(int i = 0; i < CHUNK_SIZE*CHUNK_SIZE*CHUNK_SIZE; i++) {
+    ChunkData::ChunkData(const uint16_t type) :
+        revision(0), uniform(true), shared(true), complete(true) {
+        BlockData *b = allocate_chunk_blocks();
+        uint16_t *types = types_of(b);
+        for(int i = 0; i < CHUNK_BLOCKS; i++) {
+            types[i] = type;
             b[i].type = type;
             b[i].health = MAX_HEALTH;
             b[i].direction = DIRECTION_UP;
@@ -95,12 +477,36 @@ namespace konstructs {
             b[i].b = 0;
             b[i].light = 0;
         }
-        blocks = std::shared_ptr<BlockData>(b, std::default_delete<BlockData[]>());
+        blocks = share_chunk_blocks(b);
     }
 
     ChunkData::ChunkData(const Vector3i position, const uint32_t revision, BlockData *b) :
-        position(position), revision(revision) {
-        blocks = std::shared_ptr<BlockData>(b, std::default_delete<BlockData[]>());
+        position(position), revision(revision), uniform(true), shared(false), complete(true) {
+        uint16_t *types = types_of(b);
+        for(int i = 0; i < CHUNK_BLOCKS; i++) {
+            types[i] = b[i].type;
+            if(types[i] != types[0]) {
+                uniform = false;
+            }
+        }
+        blocks = share_chunk_blocks(b);
+    }
+
+    const uint16_t *ChunkData::types() const {
+        return types_of(blocks.get());
+    }
+
+    uint16_t ChunkData::get_type(const Vector3i &pos) const {
+        int lx = pos[0] - position[0] * CHUNK_SIZE;
+        int ly = pos[1] - position[2] * CHUNK_SIZE;
+        int lz = pos[2] - position[1] * CHUNK_SIZE;
+
+        if(lx < CHUNK_SIZE && ly < CHUNK_SIZE && lz < CHUNK_SIZE &&
+                lx >= 0 && ly >= 0 && lz >= 0) {
+            return types()[lx+ly*CHUNK_SIZE+lz*CHUNK_SIZE*CHUNK_SIZE];
+        } else {
+            return 0;
+        }
     }
 
     BlockData ChunkData::get(const Vector3i &pos) const {
@@ -123,9 +529,9 @@ namespace konstructs {
         int ly = pos[1] - position[2] * CHUNK_SIZE;
         int lz = pos[2] - position[1] * CHUNK_SIZE;
 
-        BlockData *new_blocks = new BlockData[CHUNK_SIZE*CHUNK_SIZE*CHUNK_SIZE];
+        BlockData *new_blocks = allocate_chunk_blocks();
         BlockData *b = blocks.get();
-        memcpy(new_blocks, b, CHUNK_SIZE*CHUNK_SIZE*CHUNK_SIZE*sizeof(BlockData));
+        memcpy(new_blocks, b, CHUNK_BLOCKS*sizeof(BlockData));
 
         new_blocks[lx+ly*CHUNK_SIZE+lz*CHUNK_SIZE*CHUNK_SIZE] = data;
 
@@ -134,30 +540,31 @@ namespace konstructs {
         return ChunkData(position, 0, new_blocks);
     }
 
-    /**
-     * Using a camera position and a camera direction, find the
-     * closest within max_distance that intersect the directional
-     * vector.
-     */
-    optional<pair<Block, Block>> ChunkData::get(const Vector3f &camera_position,
-                              const Vector3f &camera_direction,
-                              const float max_distance,
-    const BlockTypeInfo &blocks) const {
-        int m = 4;
-        Vector3f pos = camera_position;
-        Vector3i blockPos(roundf(pos[0]), roundf(pos[1]), roundf(pos[2]));
-        for (int i = 0; i < max_distance * m; i++) {
-            const Vector3i nBlockPos(roundf(pos[0]), roundf(pos[1]), roundf(pos[2]));
-            if (nBlockPos != blockPos) {
-                BlockData data = get(nBlockPos);
-                if (blocks.is_obstacle[data.type] || blocks.is_plant[data.type]) {
-                    return optional<pair<Block, Block>>(pair<Block, Block>(Block(blockPos, data),
-                                                        Block(nBlockPos, data)));
-                }
-                blockPos = nBlockPos;
-            }
-            pos += (camera_direction / m);
+    ChunkData ChunkData::apply(const uint32_t new_revision, const BlockChanges &changes) const {
+        BlockData *new_blocks = allocate_chunk_blocks();
+        BlockData *b = blocks.get();
+        memcpy(new_blocks, b, CHUNK_BLOCKS*sizeof(BlockData));
+
+        for(const auto &change : changes) {
+            new_blocks[change.first] = change.second;
+        }
+
+        // Unlike set, the changes come from the server so the result is valid
+        return ChunkData(position, new_revision, new_blocks);
+    }
+
+    std::vector<char> ChunkData::encode() const {
+        std::vector<uint8_t> packed(BLOCK_BUFFER_SIZE);
+        const BlockData *b = blocks.get();
+        for(int i = 0; i < CHUNK_BLOCKS; i++) {
+            write_block(b[i], packed.data() + i * BLOCK_SIZE);
+        }
+        /* Only the revision of the header is read by the client */
+        std::vector<char> data(BLOCKS_HEADER_SIZE, 0);
+        for(int i = 0; i < 4; i++) {
+            data[2 + i] = (char)((revision >> (8 * i)) & 0xFF);
         }
-        return nullopt;
+        deflate_data((const char*)packed.data(), BLOCK_BUFFER_SIZE, data);
+        return data;
     }
 };
@@ -1,9 +1,17 @@
 #include <thread>
+#if defined(__SSE2__) || defined(_M_X64)
+#include <emmintrin.h>
+#define USE_SSE2
+#endif
+#ifdef _MSC_VER
+#include <intrin.h>
+#endif
 #include "chunk_factory.h"
 #include "util.h"
 #include "cube.h"
 
 #define WORKERS 2
+#define MODEL_CACHE_SIZE (64 * 1024 * 1024)
 
 namespace konstructs {
     static Vector3i BELOW(0, 0, -1);
@@ -25,9 +33,41 @@ namespace konstructs {
     static Vector3i LEFT_BACK(-1, 1, 0);
     static Vector3i RIGHT_BACK(1, 1, 0);
 
+    /* The chunks a model is built from, the first six are the face neighbours */
+    static const ChunkData ChunkModelData::* const MODEL_INPUTS[MODEL_INPUT_CHUNKS] = {
+        &ChunkModelData::below, &ChunkModelData::above,
+        &ChunkModelData::left, &ChunkModelData::right,
+        &ChunkModelData::front, &ChunkModelData::back,
+        &ChunkModelData::above_left, &ChunkModelData::above_right,
+        &ChunkModelData::above_front, &ChunkModelData::above_back,
+        &ChunkModelData::above_left_front, &ChunkModelData::above_right_front,
+        &ChunkModelData::above_left_back, &ChunkModelData::above_right_back,
+        &ChunkModelData::left_front, &ChunkModelData::left_back,
+        &ChunkModelData::right_front, &ChunkModelData::right_back,
+        &ChunkModelData::self
+    };
+
+    ChunkModelJob::ChunkModelJob(const ChunkModelData &data, const int sections, const int lod) :
+        data(data),
+        sections(sections),
+        lod(lod),
+        complete(true),
+        queued(std::chrono::steady_clock::now()) {
+        /* Missing chunks are replaced by SOLID_CHUNK */
+        for(int i = 0; i < 6; i++) {
+            if((data.*MODEL_INPUTS[i]).blocks == SOLID_CHUNK.blocks) {
+                complete = false;
+            }
+        }
+    }
+
     ChunkModelResult::ChunkModelResult(const Vector3i _position, const int components,
-                                       const int _faces):
-        position(_position), size(6 * components * _faces), faces(_faces) {
+                                       const int _faces, const int _lod, const int _sections):
+        position(_position), size(6 * components * _faces), faces(_faces), lod(_lod),
+        sections(_sections) {
+        for(int i = 0; i < CHUNK_SECTIONS; i++) {
+            section_faces[i] = 0;
+        }
         mData = new GLuint[size];
     }
 
@@ -39,11 +79,19 @@ namespace konstructs {
         return mData;
     }
 
-    ChunkModelFactory::ChunkModelFactory(const BlockTypeInfo &block_data) :
+    ChunkModelFactory::ChunkModelFactory(const BlockTypeInfo &block_data,
+                                         const int lod_half_distance,
+                                         const int lod_quarter_distance) :
         block_data(block_data),
+        lod_half_distance(lod_half_distance),
+        lod_quarter_distance(lod_quarter_distance),
+        cache(MODEL_CACHE_SIZE),
         processed(0),
         empty(0),
         created(0),
+        trivial(0),
+        cancelled(0),
+        coalesced(0),
         player_chunk(0, 0, 0) {
         for(int i = 0; i < WORKERS; i++) {
             new std::thread(&ChunkModelFactory::worker, this);
@@ -52,7 +100,7 @@ namespace konstructs {
 
     int ChunkModelFactory::waiting() {
         std::lock_guard<std::mutex> lock(mutex);
-        return chunks.size();
+        return jobs.size();
     }
 
     int ChunkModelFactory::total() {
@@ -70,9 +118,46 @@ namespace konstructs {
         return created;
     }
 
+    int ChunkModelFactory::total_trivial() {
+        std::lock_guard<std::mutex> lock(mutex);
+        return trivial;
+    }
+
+    int ChunkModelFactory::total_cancelled() {
+        std::lock_guard<std::mutex> lock(mutex);
+        return cancelled;
+    }
+
+    int ChunkModelFactory::total_coalesced() {
+        std::lock_guard<std::mutex> lock(mutex);
+        return coalesced;
+    }
+
+    int ChunkModelFactory::total_cached() {
+        return cache.hits();
+    }
+
+    /* Forget all cached models, they are only valid for one server */
+    void ChunkModelFactory::clear_cache() {
+        cache.clear();
+    }
+
     void ChunkModelFactory::update_player_chunk(const Vector3i &chunk) {
         std::lock_guard<std::mutex> lock(mutex);
+        if(chunk == player_chunk) {
+            return;
+        }
         player_chunk = chunk;
+        /* Past the last threshold the level of detail no longer
+         * depends on the level of the model the chunk has */
+        const float keep = lod_quarter_distance + LOD_HYSTERESIS;
+        for(auto it = model_lods.begin(); it != model_lods.end();) {
+            if((it->first - player_chunk).cast<float>().norm() > keep) {
+                it = model_lods.erase(it);
+            } else {
+                ++it;
+            }
+        }
     }
 
     void ChunkModelFactory::create_models(const std::vector<Vector3i> &positions,
@@ -81,15 +166,165 @@ namespace konstructs {
             std::lock_guard<std::mutex> lock(mutex);
             for(auto position: positions) {
                 for(auto m : adjacent(position, world)) {
-                    chunks.insert(m.position);
-                    model_data.erase(m.position);
-                    model_data.insert({m.position, m});
+                    queue_job(m, ALL_SECTIONS);
+                }
+            }
+        }
+        chunks_condition.notify_all();
+    }
+
+    /* Rebuild the models of the given chunks, but not their neighbours */
+    void ChunkModelFactory::refresh_models(const std::vector<Vector3i> &positions,
+                                           const World &world) {
+        if(positions.empty()) {
+            return;
+        }
+        {
+            std::lock_guard<std::mutex> lock(mutex);
+            for(auto position: positions) {
+                if(world.find(position) == world.end()) {
+                    continue;
+                }
+                queue_model(position, ALL_SECTIONS, world);
+            }
+        }
+        chunks_condition.notify_all();
+    }
+
+    /* Add the sections of the models that are affected by a changed
+     * block to the sections of their chunks. A block is used for the
+     * faces, light and ambient occlusion of the blocks next to it and
+     * for the shading of up to 8 blocks below it, so neighbouring
+     * chunks are only affected if the block is on their border.
+     */
+    void block_sections(const Vector3i &block, ChunkMap<int> &sections) {
+        const Vector3i chunk = chunked_vec_int(block);
+        const int bx = block[0] - chunk[0] * CHUNK_SIZE;
+        const int by = block[1] - chunk[2] * CHUNK_SIZE;
+        const int bz = block[2] - chunk[1] * CHUNK_SIZE;
+        for(int dx = -1; dx <= 1; dx++) {
+            if((dx == -1 && bx != 0) || (dx == 1 && bx != CHUNK_SIZE - 1)) {
+                continue;
+            }
+            for(int dz = -1; dz <= 1; dz++) {
+                if((dz == -1 && bz != 0) || (dz == 1 && bz != CHUNK_SIZE - 1)) {
+                    continue;
+                }
+                for(int dy = -1; dy <= 1; dy++) {
+                    /* Affected block heights in the chunk */
+                    int low = std::max(by - 8 - dy * CHUNK_SIZE, 0);
+                    int high = std::min(by + 1 - dy * CHUNK_SIZE, CHUNK_SIZE - 1);
+                    if(low > high) {
+                        continue;
+                    }
+                    int &chunk_sections = sections[chunk + Vector3i(dx, dz, dy)];
+                    for(int i = low / CHUNK_SECTION_HEIGHT; i <= high / CHUNK_SECTION_HEIGHT; i++) {
+                        chunk_sections |= 1 << i;
+                    }
+                }
+            }
+        }
+    }
+
+    /* Rebuild the sections of the models that are affected by a
+     * changed block */
+    void ChunkModelFactory::update_block(const Vector3i &block, const World &world) {
+        ChunkMap<int> sections;
+        block_sections(block, sections);
+        queue_sections(sections, world);
+    }
+
+    /* Rebuild the sections of the models that are affected by the
+     * changed blocks of a chunk, every model is queued once for all
+     * of the changes */
+    void ChunkModelFactory::update_blocks(const Vector3i &position, const BlockChanges &changes,
+                                          const World &world) {
+        ChunkMap<int> sections;
+        for(const auto &change : changes) {
+            block_sections(block_position(position, change.first), sections);
+        }
+        queue_sections(sections, world);
+    }
+
+    /* Queue the sections of the models of the chunks that are loaded */
+    void ChunkModelFactory::queue_sections(const ChunkMap<int> &sections, const World &world) {
+        if(sections.empty()) {
+            return;
+        }
+        {
+            std::lock_guard<std::mutex> lock(mutex);
+            for(const auto &chunk : sections) {
+                if(world.find(chunk.first) != world.end()) {
+                    queue_model(chunk.first, chunk.second, world);
                 }
             }
         }
         chunks_condition.notify_all();
     }
 
+    /* Queue a model to be built, mutex must be held by the caller */
+    void ChunkModelFactory::queue_model(const Vector3i &position, const int sections,
+                                        const World &world) {
+        queue_job(create_model_data(position, world), sections);
+    }
+
+    /* Queue a model to be built from data, replacing any model of the
+     * same chunk that is already queued. Mutex must be held by the
+     * caller.
+     */
+    void ChunkModelFactory::queue_job(const ChunkModelData &data, const int sections) {
+        ChunkModelJob job(data, sections, model_lod(data.position));
+        auto queued = jobs.find(data.position);
+        if(queued != jobs.end()) {
+            /* Sections already queued must still be built and the job
+             * keeps its place when waiting for neighbours */
+            job.sections |= queued->second.sections;
+            job.queued = queued->second.queued;
+            jobs.erase(queued);
+            coalesced++;
+        } else {
+            auto current = computing.find(data.position);
+            if(current != computing.end() &&
+                    (sections & ~current->second.sections) == 0 &&
+                    same_model_data(current->second.data, data)) {
+                /* The same model is already being built */
+                coalesced++;
+                return;
+            }
+        }
+        jobs.insert({data.position, job});
+    }
+
+    /* Level of detail of the model a chunk has, mutex must be held by
+     * the caller */
+    int ChunkModelFactory::model_lod(const Vector3i &position) const {
+        auto it = model_lods.find(position);
+        return it != model_lods.end() ? it->second : -1;
+    }
+
+    /* Select the level of detail for a chunk at the given distance (in
+     * chunks) from the player. If the chunk already has a model at level
+     * current, it is kept until the distance is LOD_HYSTERESIS past the
+     * threshold, so that models do not flicker between levels when the
+     * player moves along a threshold.
+     */
+    int ChunkModelFactory::level_of_detail(const float distance, const int current) const {
+        auto level = [&](const float d) {
+            if(d > lod_quarter_distance) {
+                return 2;
+            } else if(d > lod_half_distance) {
+                return 1;
+            } else {
+                return 0;
+            }
+        };
+        if(current >= level(distance - LOD_HYSTERESIS) &&
+                current <= level(distance + LOD_HYSTERESIS)) {
+            return current;
+        }
+        return level(distance);
+    }
+
     std::vector<ChunkModelData> adjacent(const Vector3i position, const World &world) {
         std::vector<ChunkModelData> adj;
         adj.reserve(7);
@@ -154,12 +389,60 @@ namespace konstructs {
         return data;
     }
 
+    /* Check if two models are built from the same chunks. Chunks
+     * changed by the client itself have no revision, but since chunk
+     * data is never changed in place the blocks identify it. */
+    bool same_model_data(const ChunkModelData &a, const ChunkModelData &b) {
+        for(auto input : MODEL_INPUTS) {
+            if((a.*input).blocks != (b.*input).blocks ||
+                    (a.*input).revision != (b.*input).revision) {
+                return false;
+            }
+        }
+        return true;
+    }
+
+    /* Create the cache key of a model, returns false if the model can
+     * not be cached since it is built from chunks changed by the client
+     * itself (they have no revision) */
+    bool model_key(const ChunkModelData &data, const int lod, ModelKey &key) {
+        key.position = data.position;
+        key.lod = lod;
+        key.missing = 0;
+        for(int i = 0; i < MODEL_INPUT_CHUNKS; i++) {
+            const ChunkData &input = data.*MODEL_INPUTS[i];
+            if(input.blocks == SOLID_CHUNK.blocks) {
+                key.missing |= 1 << i;
+            } else if(input.revision == 0) {
+                return false;
+            }
+            key.revisions[i] = input.revision;
+        }
+        return true;
+    }
+
     std::vector<std::shared_ptr<ChunkModelResult>> ChunkModelFactory::fetch_models() {
         std::vector<std::shared_ptr<ChunkModelResult>> return_models;
         {
             std::lock_guard<std::mutex> lock(mutex);
             return_models = models;
             models.clear();
+            /* The models replace the models of their chunks, except for
+             * models of some sections that are patched into them */
+            for(auto &model : return_models) {
+                if(model->sections != ALL_SECTIONS) {
+                    continue;
+                }
+                if(model->faces == 0) {
+                    model_lods.erase(model->position);
+                } else {
+                    model_lods[model->position] = model->lod;
+                }
+                auto queued = jobs.find(model->position);
+                if(queued != jobs.end()) {
+                    queued->second.lod = model_lod(model->position);
+                }
+            }
         }
         return return_models;
     }
@@ -167,31 +450,94 @@ namespace konstructs {
     void ChunkModelFactory::worker() {
         while(1) {
             std::unique_lock<std::mutex> ulock(mutex);
-            chunks_condition.wait(ulock, [&] {return !chunks.empty();});
-            auto cmp = [&](const Vector3i &a, const Vector3i &b) {
-                return (a - player_chunk).norm() < (b - player_chunk).norm();
-            };
-            auto it = std::min_element(chunks.begin(), chunks.end(), cmp);
-            auto position = *it;
-            chunks.erase(it);
-            auto itr = model_data.find(position);
-            if(itr == model_data.end()) {
-                continue;
+            /* Pick the closest job, skipping chunks that are already
+             * being built and jobs that wait for their neighbours */
+            auto it = jobs.end();
+            while(1) {
+                auto now = std::chrono::steady_clock::now();
+                auto timeout = std::chrono::milliseconds(MODEL_DEFER_TIMEOUT);
+                auto wake = now + timeout;
+                float closest = 0;
+                /* Jobs queued while waiting may have moved all jobs and
+                 * the end of the table, so the search starts over */
+                it = jobs.end();
+                for(auto job = jobs.begin(); job != jobs.end(); ++job) {
+                    if(computing.find(job->first) != computing.end()) {
+                        continue;
+                    }
+                    if(!job->second.complete && job->second.queued + timeout > now) {
+                        wake = std::min(wake, job->second.queued + timeout);
+                        continue;
+                    }
+                    float distance = (job->first - player_chunk).cast<float>().norm();
+                    if(it == jobs.end() || distance < closest) {
+                        it = job;
+                        closest = distance;
+                    }
+                }
+                if(it != jobs.end()) {
+                    break;
+                }
+                if(jobs.empty()) {
+                    chunks_condition.wait(ulock);
+                } else {
+                    chunks_condition.wait_until(ulock, wake);
+                }
             }
-            auto data = itr->second;
-            model_data.erase(itr);
+            auto position = it->first;
+            ChunkModelJob job = it->second;
+            jobs.erase(it);
+            computing.insert({position, job});
+            const ChunkModelData &data = job.data;
+            int lod = level_of_detail((position - player_chunk).cast<float>().norm(), job.lod);
+            /* Sections can only be patched into a model of the same level */
+            const int sections = lod == job.lod ? job.sections : ALL_SECTIONS;
             ulock.unlock();
-            auto result = compute_chunk(data, block_data);
+            shared_ptr<ChunkModelResult> result;
+            const bool hidden = chunk_hidden(data, block_data);
+            if(hidden) {
+                result = std::make_shared<ChunkModelResult>(position, 2, 0, lod,
+                         lod == 0 ? sections : ALL_SECTIONS);
+            } else {
+                ModelKey key;
+                const bool cacheable = sections == ALL_SECTIONS && model_key(data, lod, key);
+                if(cacheable) {
+                    result = cache.get(key);
+                }
+                if(!result) {
+                    if(lod == 0) {
+                        result = compute_chunk(data, block_data, sections);
+                    } else {
+                        result = compute_chunk_lod(data, block_data, lod);
+                    }
+                    if(cacheable) {
+                        cache.put(key, result);
+                    }
+                }
+            }
+            ulock.lock();
+            computing.erase(position);
+            auto queued = jobs.find(position);
+            if(queued != jobs.end()) {
+                /* The chunk changed while the model was built, the
+                 * newer job builds our sections as well */
+                queued->second.sections |= sections;
+                cancelled++;
+                chunks_condition.notify_all();
+                continue;
+            }
+            /* Empty models are returned as well, they replace any
+             * previous model of the chunk */
+            models.push_back(result);
+            if(hidden) {
+                trivial++;
+            }
             if(result->size > 0) {
-                std::lock_guard<std::mutex> ulock(mutex);
-                models.push_back(result);
                 created++;
-                processed++;
             } else {
-                std::lock_guard<std::mutex> ulock(mutex);
                 empty++;
-                processed++;
             }
+            processed++;
         }
     }
 
@@ -201,6 +547,14 @@ namespace konstructs {
 #define XYZ(x, y, z) ((y) * XZ_SIZE * XZ_SIZE + (x) * XZ_SIZE + (z))
 #define XZ(x, z) ((x) * XZ_SIZE + (z))
 
+/* Corners of the blocks of a chunk, from XZ_LO + 1 to XZ_HI */
+#define CORNER_SIZE (CHUNK_SIZE + 1)
+#define CORNER(x, y, z) (((y) - XZ_LO - 1) * CORNER_SIZE * CORNER_SIZE + ((x) - XZ_LO - 1) * CORNER_SIZE + ((z) - XZ_LO - 1))
+
+/* Blocks of a chunk and the blocks next to it, from XZ_LO to XZ_HI */
+#define SHADE_SIZE (CHUNK_SIZE + 2)
+#define SHADE(x, y, z) (((y) - XZ_LO) * SHADE_SIZE * SHADE_SIZE + ((x) - XZ_LO) * SHADE_SIZE + ((z) - XZ_LO))
+
     void occlusion(
         char neighbors[27], char shades[27],
         char ao[6][4]) {
@@ -237,12 +591,150 @@ namespace konstructs {
         }
     }
 
-    bool face_visible(int self, int neighbour, const char *is_transparent, const char *state) {
-        return is_transparent[neighbour] || (self != neighbour && state[neighbour] == STATE_LIQUID);
+    bool face_visible(int self, int neighbour, const BlockTypeInfo &block_data) {
+        const uint8_t flags = block_data.types[neighbour].flags;
+        return (flags & BLOCK_FLAG_TRANSPARENT) ||
+            (self != neighbour && block_state(flags) == STATE_LIQUID);
+    }
+
+    static inline int count_bits(uint32_t v) {
+#ifdef _MSC_VER
+        return __popcnt(v);
+#else
+        return __builtin_popcount(v);
+#endif
+    }
+
+    static inline int lowest_bit(uint32_t v) {
+#ifdef _MSC_VER
+        unsigned long i;
+        _BitScanForward(&i, v);
+        return i;
+#else
+        return __builtin_ctz(v);
+#endif
+    }
+
+/* Rows of blocks along x, one for each y and z from XZ_LO to XZ_HI. Bit
+ * i of a row is the block at x = XZ_LO + 1 + i, the blocks at XZ_LO and
+ * XZ_HI are stored on their own.
+ */
+#define ROWS (CHUNK_SIZE + 2)
+#define ROW(y, z) (((y) - XZ_LO) * ROWS + ((z) - XZ_LO))
+
+/* Face masks of the chunk, one row for each y and z in the chunk */
+#define FACE_ROW(ey, ez) ((ey) * CHUNK_SIZE + (ez))
+#define FACE_ROWS (CHUNK_SIZE * CHUNK_SIZE)
+
+    /* Compute the faces of the chunk that have a set neighbour in
+     * the rows bits (with lo and hi being the blocks before and after
+     * each row), for blocks that are not set in skip. Only the rows
+     * with ey from low up to high are computed. The faces of each
+     * direction are stored in masks, in the same order as for
+     * make_cube2.
+     */
+    void face_masks(const uint32_t *bits, const uint32_t *lo, const uint32_t *hi,
+                    const uint32_t *skip, const int low, const int high, uint32_t *masks) {
+        uint32_t *left = masks;
+        uint32_t *right = masks + FACE_ROWS;
+        uint32_t *top = masks + FACE_ROWS * 2;
+        uint32_t *bottom = masks + FACE_ROWS * 3;
+        uint32_t *front = masks + FACE_ROWS * 4;
+        uint32_t *back = masks + FACE_ROWS * 5;
+        for(int ey = low; ey < high; ey++) {
+#ifdef USE_SSE2
+            /* Four rows at a time */
+            for(int ez = 0; ez < CHUNK_SIZE; ez += 4) {
+                const int r = ROW(ey + XZ_LO + 1, ez + XZ_LO + 1);
+                const int f = FACE_ROW(ey, ez);
+                const __m128i s = _mm_loadu_si128((const __m128i*)(skip + r));
+                const __m128i b = _mm_loadu_si128((const __m128i*)(bits + r));
+                const __m128i l = _mm_loadu_si128((const __m128i*)(lo + r));
+                const __m128i h = _mm_loadu_si128((const __m128i*)(hi + r));
+                _mm_storeu_si128((__m128i*)(left + f),
+                                 _mm_andnot_si128(s, _mm_or_si128(_mm_slli_epi32(b, 1), l)));
+                _mm_storeu_si128((__m128i*)(right + f),
+                                 _mm_andnot_si128(s, _mm_or_si128(_mm_srli_epi32(b, 1),
+                                                  _mm_slli_epi32(h, 31))));
+                _mm_storeu_si128((__m128i*)(top + f),
+                                 _mm_andnot_si128(s, _mm_loadu_si128((const __m128i*)(bits + r + ROWS))));
+                _mm_storeu_si128((__m128i*)(bottom + f),
+                                 _mm_andnot_si128(s, _mm_loadu_si128((const __m128i*)(bits + r - ROWS))));
+                _mm_storeu_si128((__m128i*)(front + f),
+                                 _mm_andnot_si128(s, _mm_loadu_si128((const __m128i*)(bits + r - 1))));
+                _mm_storeu_si128((__m128i*)(back + f),
+                                 _mm_andnot_si128(s, _mm_loadu_si128((const __m128i*)(bits + r + 1))));
+            }
+#else
+            for(int ez = 0; ez < CHUNK_SIZE; ez++) {
+                const int r = ROW(ey + XZ_LO + 1, ez + XZ_LO + 1);
+                const int f = FACE_ROW(ey, ez);
+                const uint32_t s = ~skip[r];
+                left[f] = ((bits[r] << 1) | lo[r]) & s;
+                right[f] = ((bits[r] >> 1) | (hi[r] << 31)) & s;
+                top[f] = bits[r + ROWS] & s;
+                bottom[f] = bits[r - ROWS] & s;
+                front[f] = bits[r - 1] & s;
+                back[f] = bits[r + 1] & s;
+            }
+#endif
+        }
+    }
+
+    /* Check if the blocks of a side of a neighbouring chunk hide all
+     * faces of a chunk made of blocks of type */
+    bool side_hidden(const ChunkData &chunk, const int type, const int axis, const int layer,
+                     const BlockTypeInfo &block_data) {
+        const uint16_t *types = chunk.types();
+        if(chunk.uniform) {
+            return !face_visible(type, types[0], block_data);
+        }
+        for(int i = 0; i < CHUNK_SIZE; i++) {
+            for(int j = 0; j < CHUNK_SIZE; j++) {
+                int index;
+                if(axis == 0) {
+                    index = layer + i * CHUNK_SIZE + j * CHUNK_SIZE * CHUNK_SIZE;
+                } else if(axis == 1) {
+                    index = i + layer * CHUNK_SIZE + j * CHUNK_SIZE * CHUNK_SIZE;
+                } else {
+                    index = i + j * CHUNK_SIZE + layer * CHUNK_SIZE * CHUNK_SIZE;
+                }
+                if(face_visible(type, types[index], block_data)) {
+                    return false;
+                }
+            }
+        }
+        return true;
+    }
+
+    /* Check if a chunk has no visible faces without looking at all of
+     * its blocks, this is the case for chunks that are only gas and
+     * for chunks of one opaque type that are surrounded by blocks that
+     * hide them (e.g. deep underground).
+     */
+    bool chunk_hidden(const ChunkModelData &data, const BlockTypeInfo &block_data) {
+        if(!data.self.uniform) {
+            return false;
+        }
+        const int type = data.self.types()[0];
+        if(block_data.state(type) == STATE_GAS) {
+            return true;
+        }
+        /* Faces between the blocks of the chunk itself */
+        if(face_visible(type, type, block_data)) {
+            return false;
+        }
+        return
+            side_hidden(data.left, type, 0, CHUNK_SIZE - 1, block_data) &&
+            side_hidden(data.right, type, 0, 0, block_data) &&
+            side_hidden(data.below, type, 1, CHUNK_SIZE - 1, block_data) &&
+            side_hidden(data.above, type, 1, 0, block_data) &&
+            side_hidden(data.front, type, 2, CHUNK_SIZE - 1, block_data) &&
+            side_hidden(data.back, type, 2, 0, block_data);
     }
 
     RGBAmbient calculateRGBAmbient(std::vector<BlockData> &blocks, int x, int y, int z,
-                                   const char *is_transparent) {
+                                   const BlockTypeInfo &block_data) {
 
         int total = 0;
         RGBAmbient rgba = {0,0,0,0,0};
@@ -250,7 +742,7 @@ namespace konstructs {
             for(int dy = 0; dy < 2; dy++) {
                 for(int dz = 0; dz < 2; dz++) {
                     BlockData b = blocks[XYZ(x - dx, y - dy, z - dz)];
-                    if(is_transparent[b.type]) {
+                    if(block_data.is_transparent(b.type)) {
                         total++;
                         rgba.r += b.r;
                         rgba.g += b.g;
@@ -275,10 +767,32 @@ namespace konstructs {
     }
 
     shared_ptr<ChunkModelResult> compute_chunk(const ChunkModelData &data,
-            const BlockTypeInfo &block_data) {
-        std::vector<BlockData> blocks(XZ_SIZE * XZ_SIZE * XZ_SIZE);
+            const BlockTypeInfo &block_data, const int sections) {
+        /* The buffer is kept between calls instead of being allocated
+         * every time. Cells outside of the blocks that are populated
+         * below may hold blocks of an earlier call, but are never read
+         * (cells that are never populated stay zero) */
+        static thread_local std::vector<BlockData> blocks(XZ_SIZE * XZ_SIZE * XZ_SIZE);
         std::vector<char> highest(XZ_SIZE * XZ_SIZE);
 
+        /* The heights ey from low up to high hold the requested
+         * sections. Only the blocks from one below them to eight above
+         * them are needed, one block for the faces and the light and
+         * eight for the shade. */
+        int first = 0;
+        int last = CHUNK_SECTIONS - 1;
+        while(first < last && !(sections & (1 << first))) {
+            first++;
+        }
+        while(last > first && !(sections & (1 << last))) {
+            last--;
+        }
+        const int low = first * CHUNK_SECTION_HEIGHT;
+        const int high = (last + 1) * CHUNK_SECTION_HEIGHT;
+        const int fill_low = std::max(low - 1, 0);
+        const int fill_high = std::min(high + 8, CHUNK_SIZE);
+        const int above_rows = std::max(high + 8 - CHUNK_SIZE, 0);
+
         BlockData *above = data.above.blocks.get();
         BlockData *below = data.below.blocks.get();
         BlockData *left = data.left.blocks.get();
@@ -298,10 +812,6 @@ namespace konstructs {
         BlockData *left_back = data.left_back.blocks.get();
         BlockData *right_back = data.right_back.blocks.get();
 
-        const char *is_transparent = block_data.is_transparent;
-        const char *is_plant = block_data.is_plant;
-        const char *state = block_data.state;
-
         int ox = - CHUNK_SIZE - 1;
         int oy = - CHUNK_SIZE - 1;
         int oz = - CHUNK_SIZE - 1;
@@ -309,12 +819,12 @@ namespace konstructs {
         /* Populate the blocks array with the chunk itself */
         const BlockData *self = data.self.blocks.get();
 
-        CHUNK_FOR_EACH(self, ex, ey, ez, eb) {
+        CHUNK_FOR_EACH(self, fill_low, fill_high, ex, ey, ez, eb) {
             int x = ex - ox;
             int y = ey - oy;
             int z = ez - oz;
             blocks[XYZ(x, y, z)] = eb;
-            if (!is_transparent[eb.type]) {
+            if (!block_data.is_transparent(eb.type)) {
                 highest[XZ(x, z)] = std::max((int)highest[XZ(x, z)], y);
             }
         } END_CHUNK_FOR_EACH;
@@ -322,74 +832,76 @@ namespace konstructs {
         /* With the six sides of the chunk */
 
         /* Populate the blocks array with the chunk below */
-        CHUNK_FOR_EACH_XZ(below, CHUNK_SIZE - 1, ex, ey, ez, eb) {
-            int x = ex - ox;
-            int y = ey - CHUNK_SIZE - oy;
-            int z = ez - oz;
-            blocks[XYZ(x, y, z)] = eb;
-            if (!is_transparent[eb.type]) {
-                highest[XZ(x, z)] = std::max((int)highest[XZ(x, z)], y);
-            }
-        } END_CHUNK_FOR_EACH_2D;
+        if(low == 0) {
+            CHUNK_FOR_EACH_XZ(below, CHUNK_SIZE - 1, ex, ey, ez, eb) {
+                int x = ex - ox;
+                int y = ey - CHUNK_SIZE - oy;
+                int z = ez - oz;
+                blocks[XYZ(x, y, z)] = eb;
+                if (!block_data.is_transparent(eb.type)) {
+                    highest[XZ(x, z)] = std::max((int)highest[XZ(x, z)], y);
+                }
+            } END_CHUNK_FOR_EACH_2D;
+        }
 
 
         /* Populate the blocks array with the chunk above
          * The shading requires additional 8 blocks
          */
-        for(int i = 0; i < 8; i++) {
+        for(int i = 0; i < above_rows; i++) {
             CHUNK_FOR_EACH_XZ(above, i, ex, ey, ez, eb) {
                 int x = ex - ox;
                 int y = ey + CHUNK_SIZE - oy;
                 int z = ez - oz;
                 blocks[XYZ(x, y, z)] = eb;
-                if (!is_transparent[eb.type]) {
+                if (!block_data.is_transparent(eb.type)) {
                     highest[XZ(x, z)] = std::max((int)highest[XZ(x, z)], y);
                 }
             } END_CHUNK_FOR_EACH_2D;
         }
 
         /* Populate the blocks array with the chunk left */
-        CHUNK_FOR_EACH_YZ(left, CHUNK_SIZE - 1, ex, ey, ez, eb) {
+        CHUNK_FOR_EACH_YZ(left, CHUNK_SIZE - 1, fill_low, fill_high, ex, ey, ez, eb) {
             int x = ex - CHUNK_SIZE - ox;
             int y = ey - oy;
             int z = ez - oz;
             blocks[XYZ(x, y, z)] = eb;
-            if (!is_transparent[eb.type]) {
+            if (!block_data.is_transparent(eb.type)) {
                 highest[XZ(x, z)] = std::max((int)highest[XZ(x, z)], y);
             }
         } END_CHUNK_FOR_EACH_2D;
 
         /* Populate the blocks array with the chunk right */
-        CHUNK_FOR_EACH_YZ(right, 0, ex, ey, ez, eb) {
+        CHUNK_FOR_EACH_YZ(right, 0, fill_low, fill_high, ex, ey, ez, eb) {
             int x = ex + CHUNK_SIZE - ox;
             int y = ey - oy;
             int z = ez - oz;
             blocks[XYZ(x, y, z)] = eb;
-            if (!is_transparent[eb.type]) {
+            if (!block_data.is_transparent(eb.type)) {
                 highest[XZ(x, z)] = std::max((int)highest[XZ(x, z)], y);
             }
         } END_CHUNK_FOR_EACH_2D;
 
 
         /* Populate the blocks array with the chunk front */
-        CHUNK_FOR_EACH_XY(front, CHUNK_SIZE - 1, ex, ey, ez, eb) {
+        CHUNK_FOR_EACH_XY(front, CHUNK_SIZE - 1, fill_low, fill_high, ex, ey, ez, eb) {
             int x = ex - ox;
             int y = ey - oy;
             int z = ez - CHUNK_SIZE - oz;
             blocks[XYZ(x, y, z)] = eb;
-            if (!is_transparent[eb.type]) {
+            if (!block_data.is_transparent(eb.type)) {
                 highest[XZ(x, z)] = std::max((int)highest[XZ(x, z)], y);
             }
         } END_CHUNK_FOR_EACH_2D;
 
 
         /* Populate the blocks array with the chunk back */
-        CHUNK_FOR_EACH_XY(back, 0, ex, ey, ez, eb) {
+        CHUNK_FOR_EACH_XY(back, 0, fill_low, fill_high, ex, ey, ez, eb) {
             int x = ex - ox;
             int y = ey - oy;
             int z = ez + CHUNK_SIZE - oz;
             blocks[XYZ(x, y, z)] = eb;
-            if (!is_transparent[eb.type]) {
+            if (!block_data.is_transparent(eb.type)) {
                 highest[XZ(x, z)] = std::max((int)highest[XZ(x, z)], y);
             }
         } END_CHUNK_FOR_EACH_2D;
@@ -398,14 +910,14 @@ namespace konstructs {
          * Shading yet again requires 8 additional blocks
          */
 
-        for(int i = 0; i < 8; i++) {
+        for(int i = 0; i < above_rows; i++) {
             /* Populate the blocks array with the chunk above-left */
             CHUNK_FOR_EACH_Z(above_left, CHUNK_SIZE - 1, i, ex, ey, ez, eb) {
                 int x = ex - CHUNK_SIZE - ox;
                 int y = ey + CHUNK_SIZE - oy;
                 int z = ez - oz;
                 blocks[XYZ(x, y, z)] = eb;
-                if (!is_transparent[eb.type]) {
+                if (!block_data.is_transparent(eb.type)) {
                     highest[XZ(x, z)] = std::max((int)highest[XZ(x, z)], y);
                 }
             } END_CHUNK_FOR_EACH_1D;
@@ -416,7 +928,7 @@ namespace konstructs {
                 int y = ey + CHUNK_SIZE - oy;
                 int z = ez - oz;
                 blocks[XYZ(x, y, z)] = eb;
-                if (!is_transparent[eb.type]) {
+                if (!block_data.is_transparent(eb.type)) {
                     highest[XZ(x, z)] = std::max((int)highest[XZ(x, z)], y);
                 }
             } END_CHUNK_FOR_EACH_1D;
@@ -427,7 +939,7 @@ namespace konstructs {
                 int y = ey + CHUNK_SIZE - oy;
                 int z = ez - CHUNK_SIZE - oz;
                 blocks[XYZ(x, y, z)] = eb;
-                if (!is_transparent[eb.type]) {
+                if (!block_data.is_transparent(eb.type)) {
                     highest[XZ(x, z)] = std::max((int)highest[XZ(x, z)], y);
                 }
             } END_CHUNK_FOR_EACH_1D;
@@ -437,7 +949,7 @@ namespace konstructs {
                 int y = ey + CHUNK_SIZE - oy;
                 int z = ez + CHUNK_SIZE - oz;
                 blocks[XYZ(x, y, z)] = eb;
-                if (!is_transparent[eb.type]) {
+                if (!block_data.is_transparent(eb.type)) {
                     highest[XZ(x, z)] = std::max((int)highest[XZ(x, z)], y);
                 }
             } END_CHUNK_FOR_EACH_1D;
@@ -452,7 +964,7 @@ namespace konstructs {
                 int z = ez - CHUNK_SIZE - oz;
                 BlockData eb = above_left_front[ex+ey*CHUNK_SIZE+ez*CHUNK_SIZE*CHUNK_SIZE];
                 blocks[XYZ(x, y, z)] = eb;
-                if (!is_transparent[eb.type]) {
+                if (!block_data.is_transparent(eb.type)) {
                     highest[XZ(x, z)] = std::max((int)highest[XZ(x, z)], y);
                 }
             }
@@ -467,7 +979,7 @@ namespace konstructs {
                 int z = ez - CHUNK_SIZE - oz;
                 BlockData eb = above_right_front[ex+ey*CHUNK_SIZE+ez*CHUNK_SIZE*CHUNK_SIZE];
                 blocks[XYZ(x, y, z)] = eb;
-                if (!is_transparent[eb.type]) {
+                if (!block_data.is_transparent(eb.type)) {
                     highest[XZ(x, z)] = std::max((int)highest[XZ(x, z)], y);
                 }
             }
@@ -482,7 +994,7 @@ namespace konstructs {
                 int z = ez + CHUNK_SIZE - oz;
                 BlockData eb = above_left_back[ex+ey*CHUNK_SIZE+ez*CHUNK_SIZE*CHUNK_SIZE];
                 blocks[XYZ(x, y, z)] = eb;
-                if (!is_transparent[eb.type]) {
+                if (!block_data.is_transparent(eb.type)) {
                     highest[XZ(x, z)] = std::max((int)highest[XZ(x, z)], y);
                 }
             }
@@ -497,7 +1009,7 @@ namespace konstructs {
                 int z = ez + CHUNK_SIZE - oz;
                 BlockData eb = above_right_back[ex+ey*CHUNK_SIZE+ez*CHUNK_SIZE*CHUNK_SIZE];
                 blocks[XYZ(x, y, z)] = eb;
-                if (!is_transparent[eb.type]) {
+                if (!block_data.is_transparent(eb.type)) {
                     highest[XZ(x, z)] = std::max((int)highest[XZ(x, z)], y);
                 }
             }
@@ -507,160 +1019,425 @@ namespace konstructs {
         /* Populate the corner cases on the same level */
 
         /* Populate the blocks array with the chunk left-front */
-        CHUNK_FOR_EACH_Y(left_front, CHUNK_SIZE - 1, CHUNK_SIZE - 1, ex, ey, ez, eb) {
+        CHUNK_FOR_EACH_Y(left_front, CHUNK_SIZE - 1, CHUNK_SIZE - 1, fill_low, fill_high, ex, ey, ez, eb) {
             int x = ex - CHUNK_SIZE - ox;
             int y = ey - oy;
             int z = ez - CHUNK_SIZE - oz;
             blocks[XYZ(x, y, z)] = eb;
-            if (!is_transparent[eb.type]) {
+            if (!block_data.is_transparent(eb.type)) {
                 highest[XZ(x, z)] = std::max((int)highest[XZ(x, z)], y);
             }
         } END_CHUNK_FOR_EACH_1D;
 
         /* Populate the blocks array with the chunk left-back */
-        CHUNK_FOR_EACH_Y(left_back, CHUNK_SIZE - 1, 0, ex, ey, ez, eb) {
+        CHUNK_FOR_EACH_Y(left_back, CHUNK_SIZE - 1, 0, fill_low, fill_high, ex, ey, ez, eb) {
             int x = ex - CHUNK_SIZE - ox;
             int y = ey - oy;
             int z = ez + CHUNK_SIZE - oz;
             blocks[XYZ(x, y, z)] = eb;
-            if (!is_transparent[eb.type]) {
+            if (!block_data.is_transparent(eb.type)) {
                 highest[XZ(x, z)] = std::max((int)highest[XZ(x, z)], y);
             }
         } END_CHUNK_FOR_EACH_1D;
 
         /* Populate the blocks array with the chunk right-front */
-        CHUNK_FOR_EACH_Y(right_front, 0, CHUNK_SIZE - 1, ex, ey, ez, eb) {
+        CHUNK_FOR_EACH_Y(right_front, 0, CHUNK_SIZE - 1, fill_low, fill_high, ex, ey, ez, eb) {
             int x = ex + CHUNK_SIZE - ox;
             int y = ey - oy;
             int z = ez - CHUNK_SIZE - oz;
             blocks[XYZ(x, y, z)] = eb;
-            if (!is_transparent[eb.type]) {
+            if (!block_data.is_transparent(eb.type)) {
                 highest[XZ(x, z)] = std::max((int)highest[XZ(x, z)], y);
             }
         } END_CHUNK_FOR_EACH_1D;
 
         /* Populate the blocks array with the chunk right-back */
-        CHUNK_FOR_EACH_Y(right_back, 0, 0, ex, ey, ez, eb) {
+        CHUNK_FOR_EACH_Y(right_back, 0, 0, fill_low, fill_high, ex, ey, ez, eb) {
             int x = ex + CHUNK_SIZE - ox;
             int y = ey - oy;
             int z = ez + CHUNK_SIZE - oz;
             blocks[XYZ(x, y, z)] = eb;
-            if (!is_transparent[eb.type]) {
+            if (!block_data.is_transparent(eb.type)) {
                 highest[XZ(x, z)] = std::max((int)highest[XZ(x, z)], y);
             }
         } END_CHUNK_FOR_EACH_1D;
 
 
+        /* Bit sets of the blocks: open blocks (transparent or liquid)
+         * show the faces next to them, liquid blocks that are not
+         * transparent only do so for blocks of another type. Gas blocks
+         * have no faces and plants are always drawn with four faces. */
+        uint32_t open[ROWS * ROWS] = {0};
+        uint32_t open_lo[ROWS * ROWS] = {0};
+        uint32_t open_hi[ROWS * ROWS] = {0};
+        uint32_t liquid[ROWS * ROWS] = {0};
+        uint32_t liquid_lo[ROWS * ROWS] = {0};
+        uint32_t liquid_hi[ROWS * ROWS] = {0};
+        uint32_t gas[ROWS * ROWS] = {0};
+        uint32_t plant[ROWS * ROWS] = {0};
+
+        for(int y = low - 1 - oy; y <= high - oy; y++) {
+            for(int z = XZ_LO; z <= XZ_HI; z++) {
+                const int r = ROW(y, z);
+                uint32_t o = 0, l = 0, g = 0, p = 0;
+                for(int i = 0; i < CHUNK_SIZE; i++) {
+                    const uint16_t type = blocks[XYZ(XZ_LO + 1 + i, y, z)].type;
+                    /* All properties of the type come from one record */
+                    const uint8_t flags = block_data.types[type].flags;
+                    const int state = block_state(flags);
+                    const bool t = (flags & BLOCK_FLAG_TRANSPARENT) != 0;
+                    const bool q = !t && state == STATE_LIQUID;
+                    o |= (uint32_t)(t || q) << i;
+                    l |= (uint32_t)q << i;
+                    g |= (uint32_t)(state == STATE_GAS) << i;
+                    p |= (uint32_t)((flags & BLOCK_FLAG_PLANT) != 0) << i;
+                }
+                open[r] = o;
+                liquid[r] = l;
+                gas[r] = g;
+                plant[r] = p;
+                const uint16_t lo_type = blocks[XYZ(XZ_LO, y, z)].type;
+                const uint16_t hi_type = blocks[XYZ(XZ_HI, y, z)].type;
+                const uint8_t lo_flags = block_data.types[lo_type].flags;
+                const uint8_t hi_flags = block_data.types[hi_type].flags;
+                const bool lo_liquid = block_state(lo_flags) == STATE_LIQUID;
+                const bool hi_liquid = block_state(hi_flags) == STATE_LIQUID;
+                open_lo[r] = (lo_flags & BLOCK_FLAG_TRANSPARENT) || lo_liquid;
+                open_hi[r] = (hi_flags & BLOCK_FLAG_TRANSPARENT) || hi_liquid;
+                liquid_lo[r] = !(lo_flags & BLOCK_FLAG_TRANSPARENT) && lo_liquid;
+                liquid_hi[r] = !(hi_flags & BLOCK_FLAG_TRANSPARENT) && hi_liquid;
+            }
+        }
+
+        /* Visible faces of each block in each direction */
+        std::vector<uint32_t> masks(FACE_ROWS * 6);
+        face_masks(open, open_lo, open_hi, gas, low, high, masks.data());
+
+        /* Faces against liquid blocks of the same type are hidden */
+        std::vector<uint32_t> liquid_masks(FACE_ROWS * 6);
+        face_masks(liquid, liquid_lo, liquid_hi, gas, low, high, liquid_masks.data());
+        static const int neighbour_offset[6][3] = {
+            {-1, 0, 0}, {1, 0, 0}, {0, 1, 0}, {0, -1, 0}, {0, 0, -1}, {0, 0, 1}
+        };
+        for(int d = 0; d < 6; d++) {
+            for(int row = FACE_ROW(low, 0); row < FACE_ROW(high, 0); row++) {
+                uint32_t check = liquid_masks[d * FACE_ROWS + row];
+                while(check) {
+                    const int ex = lowest_bit(check);
+                    check &= check - 1;
+                    const int x = ex - ox;
+                    const int y = row / CHUNK_SIZE - oy;
+                    const int z = row % CHUNK_SIZE - oz;
+                    const BlockData &n = blocks[XYZ(x + neighbour_offset[d][0],
+                                                    y + neighbour_offset[d][1],
+                                                    z + neighbour_offset[d][2])];
+                    if(blocks[XYZ(x, y, z)].type == n.type) {
+                        masks[d * FACE_ROWS + row] &= ~(1u << ex);
+                    }
+                }
+            }
+        }
+
         // count exposed faces
         int faces = 0;
-        CHUNK_FOR_EACH(self, ex, ey, ez, eb) {
-            if (state[eb.type] == STATE_GAS) {
+        int section_faces[CHUNK_SECTIONS] = {0};
+        for(int section = 0; section < CHUNK_SECTIONS; section++) {
+            if(!(sections & (1 << section))) {
                 continue;
             }
-            int x = ex - ox;
-            int y = ey - oy;
-            int z = ez - oz;
-            int f1 = face_visible(eb.type, blocks[XYZ(x - 1, y, z)].type, is_transparent, state);
-            int f2 = face_visible(eb.type, blocks[XYZ(x + 1, y, z)].type, is_transparent, state);
-            int f3 = face_visible(eb.type, blocks[XYZ(x, y + 1, z)].type, is_transparent, state);
-            int f4 = face_visible(eb.type, blocks[XYZ(x, y - 1, z)].type, is_transparent, state);
-            int f5 = face_visible(eb.type, blocks[XYZ(x, y, z - 1)].type, is_transparent, state);
-            int f6 = face_visible(eb.type, blocks[XYZ(x, y, z + 1)].type, is_transparent, state);
-            int total = f1 + f2 + f3 + f4 + f5 + f6;
-
-            if (total == 0) {
-                continue;
+            for(int ey = section * CHUNK_SECTION_HEIGHT; ey < (section + 1) * CHUNK_SECTION_HEIGHT; ey++) {
+                for(int ez = 0; ez < CHUNK_SIZE; ez++) {
+                    const int row = FACE_ROW(ey, ez);
+                    const uint32_t plants = plant[ROW(ey - oy, ez - oz)];
+                    uint32_t any = 0;
+                    for(int d = 0; d < 6; d++) {
+                        const uint32_t m = masks[d * FACE_ROWS + row];
+                        section_faces[section] += count_bits(m & ~plants);
+                        any |= m;
+                    }
+                    section_faces[section] += 4 * count_bits(any & plants);
+                }
             }
+            faces += section_faces[section];
+        }
 
-            if (is_plant[eb.type]) {
-                total = 4;
+        /* The light of a corner is shared by the eight blocks around it
+         * and the shade of a block by the 27 blocks around it, so
+         * both are computed once, when first needed. The grids only
+         * cover the heights of the requested sections. */
+        const int corner_base = low * CORNER_SIZE * CORNER_SIZE;
+        const int shade_base = low * SHADE_SIZE * SHADE_SIZE;
+        const int corner_layers = high - low + 1;
+        const int shade_layers = high - low + 2;
+        std::vector<RGBAmbient> corners(CORNER_SIZE * CORNER_SIZE * corner_layers);
+        std::vector<char> corner_done(CORNER_SIZE * CORNER_SIZE * corner_layers, 0);
+        std::vector<char> shades_grid(SHADE_SIZE * SHADE_SIZE * shade_layers, -1);
+
+        auto corner = [&](int x, int y, int z) {
+            int i = CORNER(x, y, z) - corner_base;
+            if(!corner_done[i]) {
+                corners[i] = calculateRGBAmbient(blocks, x, y, z, block_data);
+                corner_done[i] = 1;
             }
+            return corners[i];
+        };
 
-            faces += total;
-        } END_CHUNK_FOR_EACH;
+        auto shade = [&](int x, int y, int z) {
+            char &s = shades_grid[SHADE(x, y, z) - shade_base];
+            if(s < 0) {
+                s = 0;
+                if (y <= highest[XZ(x, z)]) {
+                    for (int oy = 0; oy < 8; oy++) {
+                        if (!block_data.is_transparent(blocks[XYZ(x, y + oy, z)].type)) {
+                            s = 8 - oy;
+                            break;
+                        }
+                    }
+                }
+            }
+            return s;
+        };
 
         // generate geometry
-        auto result = std::make_shared<ChunkModelResult>(data.position, 2, faces);
+        auto result = std::make_shared<ChunkModelResult>(data.position, 2, faces, 0, sections);
         GLuint * vertices = result->data();
         int offset = 0;
+        for(int section = 0; section < CHUNK_SECTIONS; section++) {
+            result->section_faces[section] = section_faces[section];
+        }
 
-        CHUNK_FOR_EACH(self, ex, ey, ez, eb) {
-            if (state[eb.type] == STATE_GAS) {
-                continue;
-            }
-            int x = ex - ox;
-            int y = ey - oy;
-            int z = ez - oz;
-
-            BlockData left_data = blocks[XYZ(x - 1, y, z)];
-            uint8_t left = face_visible(eb.type, left_data.type, is_transparent, state);
-            BlockData right_data = blocks[XYZ(x + 1, y, z)];
-            uint8_t right = face_visible(eb.type, right_data.type, is_transparent, state);
-            BlockData top_data = blocks[XYZ(x, y + 1, z)];
-            uint8_t top = face_visible(eb.type, top_data.type, is_transparent, state);
-            BlockData bottom_data = blocks[XYZ(x, y - 1, z)];
-            uint8_t bottom = face_visible(eb.type, bottom_data.type, is_transparent, state);
-            BlockData front_data = blocks[XYZ(x, y, z - 1)];
-            uint8_t front = face_visible(eb.type, front_data.type, is_transparent, state);
-            BlockData back_data = blocks[XYZ(x, y, z + 1)];
-            uint8_t back = face_visible(eb.type, back_data.type, is_transparent, state);
-
-            uint8_t faces[6] = {left, right, top, bottom, front, back};
-
-            int total = left + right + top + bottom + front + back;
-            if (total == 0) {
+        for(int section = 0; section < CHUNK_SECTIONS; section++) {
+            if(!(sections & (1 << section))) {
                 continue;
             }
+            for(int ey = section * CHUNK_SECTION_HEIGHT; ey < (section + 1) * CHUNK_SECTION_HEIGHT; ey++) {
+                for(int ez = 0; ez < CHUNK_SIZE; ez++) {
+                    const int row = FACE_ROW(ey, ez);
+                    uint32_t any = 0;
+                    for(int d = 0; d < 6; d++) {
+                        any |= masks[d * FACE_ROWS + row];
+                    }
+                    while(any) {
+                        const int ex = lowest_bit(any);
+                        any &= any - 1;
+                        const BlockData eb = self[ex+ey*CHUNK_SIZE+ez*CHUNK_SIZE*CHUNK_SIZE];
+                        int x = ex - ox;
+                        int y = ey - oy;
+                        int z = ez - oz;
+
+                        uint8_t faces[6];
+                        int total = 0;
+                        for(int d = 0; d < 6; d++) {
+                            faces[d] = (masks[d * FACE_ROWS + row] >> ex) & 1;
+                            total += faces[d];
+                        }
 
-            RGBAmbient rgb_ambient[8] = {
-                calculateRGBAmbient(blocks, x, y, z, is_transparent),
-                calculateRGBAmbient(blocks, x, y, z + 1, is_transparent),
-                calculateRGBAmbient(blocks, x, y + 1, z, is_transparent),
-                calculateRGBAmbient(blocks, x + 1, y, z, is_transparent),
-                calculateRGBAmbient(blocks, x + 1, y + 1, z, is_transparent),
-                calculateRGBAmbient(blocks, x, y + 1, z + 1, is_transparent),
-                calculateRGBAmbient(blocks, x + 1, y, z + 1, is_transparent),
-                calculateRGBAmbient(blocks, x + 1, y + 1, z + 1, is_transparent)
-            };
-            char neighbors[27] = {0};
-            char shades[27] = {0};
-            int index = 0;
-            for (int dx = -1; dx <= 1; dx++) {
-                for (int dy = -1; dy <= 1; dy++) {
-                    for (int dz = -1; dz <= 1; dz++) {
-                        neighbors[index] = !is_transparent[blocks[XYZ(x + dx, y + dy, z + dz)].type];
-                        shades[index] = 0;
-                        if (y + dy <= highest[XZ(x + dx, z + dz)]) {
-                            for (int oy = 0; oy < 8; oy++) {
-                                if (!is_transparent[blocks[XYZ(x + dx, y + dy + oy, z + dz)].type]) {
-                                    shades[index] = 8 - oy;
-                                    break;
+                        RGBAmbient rgb_ambient[8] = {
+                            corner(x, y, z),
+                            corner(x, y, z + 1),
+                            corner(x, y + 1, z),
+                            corner(x + 1, y, z),
+                            corner(x + 1, y + 1, z),
+                            corner(x, y + 1, z + 1),
+                            corner(x + 1, y, z + 1),
+                            corner(x + 1, y + 1, z + 1)
+                        };
+                        char neighbors[27] = {0};
+                        char shades[27] = {0};
+                        int index = 0;
+                        for (int dx = -1; dx <= 1; dx++) {
+                            for (int dy = -1; dy <= 1; dy++) {
+                                for (int dz = -1; dz <= 1; dz++) {
+                                    neighbors[index] = !block_data.is_transparent(blocks[XYZ(x + dx, y + dy, z + dz)].type);
+                                    shades[index] = shade(x + dx, y + dy, z + dz);
+                                    index++;
                                 }
                             }
                         }
-                        index++;
+                        char ao[6][4];
+                        occlusion(neighbors, shades, ao);
+                        if (block_data.is_plant(eb.type)) {
+                            total = 4;
+                            char min_ao = 1;
+                            for (int a = 0; a < 6; a++) {
+                                for (int b = 0; b < 4; b++) {
+                                    min_ao = std::min(min_ao, ao[a][b]);
+                                }
+                            }
+                            make_plant(vertices + offset, min_ao,
+                                       ex, ey, ez, eb, block_data.types);
+                        } else {
+                            int damage = (int)(8.0f - ((float)eb.health / (float)(MAX_HEALTH + 1)) * 8.0f);
+                            make_cube2(vertices + offset, ao, faces, rgb_ambient,
+                                       ex, ey, ez, eb, damage, block_data.types);
+                        }
+                        offset += total * 12;
                     }
                 }
             }
-            char ao[6][4];
-            occlusion(neighbors, shades, ao);
-            if (is_plant[eb.type]) {
-                total = 4;
-                char min_ao = 1;
-                for (int a = 0; a < 6; a++) {
-                    for (int b = 0; b < 4; b++) {
-                        min_ao = std::min(min_ao, ao[a][b]);
+        }
+
+        return result;
+    }
+
+    /* A voxel of a level of detail model, it covers scale^3 blocks */
+    struct LodCell {
+        BlockData block;
+        bool solid;
+        RGBAmbient light;
+    };
+
+    /* Downsample the scale^3 blocks of a cell. The cell is solid if at
+     * least half of its blocks are solid and it takes the type of its
+     * top most solid block, so that e.g. grass stays green from a
+     * distance. The light is the average of the transparent blocks.
+     */
+    LodCell lod_cell(const BlockData *blocks, const int cx, const int cy, const int cz,
+                     const int scale, const BlockTypeInfo &block_data) {
+        LodCell cell;
+        cell.block = BlockData();
+        cell.block.type = VACUUM_TYPE;
+        int solids = 0;
+        int total = 0;
+        int r = 0, g = 0, b = 0, light = 0, ambient = 0;
+        for(int ey = cy * scale + scale - 1; ey >= cy * scale; ey--) {
+            for(int ez = cz * scale; ez < cz * scale + scale; ez++) {
+                for(int ex = cx * scale; ex < cx * scale + scale; ex++) {
+                    const BlockData &eb = blocks[ex+ey*CHUNK_SIZE+ez*CHUNK_SIZE*CHUNK_SIZE];
+                    if(block_data.state(eb.type) != STATE_GAS && !block_data.is_plant(eb.type)) {
+                        if(solids == 0) {
+                            cell.block = eb;
+                        }
+                        solids++;
+                    }
+                    if(block_data.is_transparent(eb.type)) {
+                        total++;
+                        r += eb.r;
+                        g += eb.g;
+                        b += eb.b;
+                        light += eb.light;
+                        ambient += eb.ambient;
                     }
                 }
-                make_plant(vertices + offset, min_ao,
-                           ex, ey, ez, eb, block_data.blocks);
-            } else {
-                int damage = (int)(8.0f - ((float)eb.health / (float)(MAX_HEALTH + 1)) * 8.0f);
-                make_cube2(vertices + offset, ao, faces, rgb_ambient,
-                           ex, ey, ez, eb, damage, block_data.blocks);
             }
-            offset += total * 12;
-        } END_CHUNK_FOR_EACH;
+        }
+        cell.solid = solids * 2 >= scale * scale * scale;
+        if(total > 0) {
+            cell.light = {(uint8_t)(r / total), (uint8_t)(g / total), (uint8_t)(b / total),
+                          (uint8_t)(light / total), (uint8_t)(ambient / total)
+                         };
+        } else {
+            cell.light = {0, 0, 0, 0, 0};
+        }
+        return cell;
+    }
+
+    /* Compute a reduced detail model of a chunk, where each voxel covers
+     * 2^lod blocks in each direction. Only the six face neighbours are
+     * considered and no ambient occlusion is calculated.
+     */
+    shared_ptr<ChunkModelResult> compute_chunk_lod(const ChunkModelData &data,
+            const BlockTypeInfo &block_data, const int lod) {
+        const int scale = 1 << lod;
+        const int n = CHUNK_SIZE / scale;
+        const int size = n + 2;
+
+        /* The cells of the chunk with a border of one cell from the neighbours */
+        std::vector<LodCell> cells(size * size * size);
+        auto cell = [&](const int x, const int y, const int z) -> LodCell& {
+            return cells[(x + 1) + (y + 1) * size + (z + 1) * size * size];
+        };
+
+        const BlockData *self = data.self.blocks.get();
+        for(int z = 0; z < n; z++) {
+            for(int y = 0; y < n; y++) {
+                for(int x = 0; x < n; x++) {
+                    cell(x, y, z) = lod_cell(self, x, y, z, scale, block_data);
+                }
+            }
+        }
+
+        for(int i = 0; i < n; i++) {
+            for(int j = 0; j < n; j++) {
+                cell(-1, i, j) = lod_cell(data.left.blocks.get(), n - 1, i, j, scale, block_data);
+                cell(n, i, j) = lod_cell(data.right.blocks.get(), 0, i, j, scale, block_data);
+                cell(i, -1, j) = lod_cell(data.below.blocks.get(), i, n - 1, j, scale, block_data);
+                cell(i, n, j) = lod_cell(data.above.blocks.get(), i, 0, j, scale, block_data);
+                cell(i, j, -1) = lod_cell(data.front.blocks.get(), i, j, n - 1, scale, block_data);
+                cell(i, j, n) = lod_cell(data.back.blocks.get(), i, j, 0, scale, block_data);
+            }
+        }
+
+        auto visible = [&](const LodCell &c, const LodCell &neighbour) {
+            return !neighbour.solid ||
+                   face_visible(c.block.type, neighbour.block.type, block_data);
+        };
+
+        // count exposed faces
+        int faces = 0;
+        for(int z = 0; z < n; z++) {
+            for(int y = 0; y < n; y++) {
+                for(int x = 0; x < n; x++) {
+                    const LodCell &c = cell(x, y, z);
+                    if(!c.solid) {
+                        continue;
+                    }
+                    faces +=
+                        visible(c, cell(x - 1, y, z)) + visible(c, cell(x + 1, y, z)) +
+                        visible(c, cell(x, y + 1, z)) + visible(c, cell(x, y - 1, z)) +
+                        visible(c, cell(x, y, z - 1)) + visible(c, cell(x, y, z + 1));
+                }
+            }
+        }
+
+        // generate geometry
+        auto result = std::make_shared<ChunkModelResult>(data.position, 2, faces, lod, ALL_SECTIONS);
+        /* Reduced detail models are always built as a whole */
+        result->section_faces[0] = faces;
+        GLuint * vertices = result->data();
+        int offset = 0;
+        char ao[6][4] = {{0}};
+
+        for(int z = 0; z < n; z++) {
+            for(int y = 0; y < n; y++) {
+                for(int x = 0; x < n; x++) {
+                    const LodCell &c = cell(x, y, z);
+                    if(!c.solid) {
+                        continue;
+                    }
+                    const LodCell *neighbours[6] = {
+                        &cell(x - 1, y, z), &cell(x + 1, y, z),
+                        &cell(x, y + 1, z), &cell(x, y - 1, z),
+                        &cell(x, y, z - 1), &cell(x, y, z + 1)
+                    };
+                    uint8_t faces[6];
+                    int total = 0;
+                    int r = 0, g = 0, b = 0, light = 0, ambient = 0;
+                    for(int i = 0; i < 6; i++) {
+                        faces[i] = visible(c, *neighbours[i]);
+                        if(faces[i]) {
+                            total++;
+                            r += neighbours[i]->light.r;
+                            g += neighbours[i]->light.g;
+                            b += neighbours[i]->light.b;
+                            light += neighbours[i]->light.light;
+                            ambient += neighbours[i]->light.ambient;
+                        }
+                    }
+                    if(total == 0) {
+                        continue;
+                    }
+                    /* The whole voxel is lit by the average of its visible neighbours */
+                    RGBAmbient rgba = {(uint8_t)(r / total), (uint8_t)(g / total), (uint8_t)(b / total),
+                                       (uint8_t)(light / total), (uint8_t)(ambient / total)
+                                      };
+                    RGBAmbient rgb_ambient[8] = {rgba, rgba, rgba, rgba, rgba, rgba, rgba, rgba};
+                    make_cube2(vertices + offset, ao, faces, rgb_ambient,
+                               x, y, z, c.block, 0, block_data.types);
+                    offset += total * 12;
+                }
+            }
+        }
 
         return result;
     }
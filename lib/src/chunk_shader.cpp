@@ -1,21 +1,57 @@
 #define _USE_MATH_DEFINES
 #include <iostream>
+#include <algorithm>
+#include <vector>
 #include <math.h>
 #include "chunk_shader.h"
 #include "matrix.h"
 
 namespace konstructs {
 
+/* Extra faces reserved for each section of a full detail model, so
+ * that it can be updated in place when blocks are placed */
+#define SECTION_SLACK(faces) ((faces) / 8 + 16)
+
+/* Number of GLuints used for one face */
+#define FACE_SIZE 12
+
     const Array3i chunk_offset = Vector3i(CHUNK_SIZE, CHUNK_SIZE, CHUNK_SIZE).array();
     ChunkModel::ChunkModel(const shared_ptr<ChunkModelResult> &data,
                            GLuint data_attr) :
         position(data->position),
         faces(data->faces),
+        lod(data->lod),
+        lod_requested(false),
         data_attr(data_attr) {
+        int capacity = 0;
+        for(int i = 0; i < CHUNK_SECTIONS; i++) {
+            section_first[i] = capacity;
+            section_faces[i] = data->section_faces[i];
+            if(lod == 0) {
+                section_capacity[i] = section_faces[i] + SECTION_SLACK(section_faces[i]);
+            } else {
+                section_capacity[i] = section_faces[i];
+            }
+            capacity += section_capacity[i];
+        }
         glGenBuffers(1, &buffer);
         glBindBuffer(GL_ARRAY_BUFFER, buffer);
-        glBufferData(GL_ARRAY_BUFFER, data->size * sizeof(GLuint),
-                     data->data(), GL_STATIC_DRAW);
+        if(capacity == data->faces) {
+            glBufferData(GL_ARRAY_BUFFER, data->size * sizeof(GLuint),
+                         data->data(), GL_STATIC_DRAW);
+        } else {
+            /* The reserved faces are left zeroed, which gives
+             * degenerate triangles that are never rasterized */
+            std::vector<GLuint> vertices(capacity * FACE_SIZE, 0);
+            const GLuint *source = data->data();
+            for(int i = 0; i < CHUNK_SECTIONS; i++) {
+                std::copy(source, source + section_faces[i] * FACE_SIZE,
+                          vertices.begin() + section_first[i] * FACE_SIZE);
+                source += section_faces[i] * FACE_SIZE;
+            }
+            glBufferData(GL_ARRAY_BUFFER, vertices.size() * sizeof(GLuint),
+                         vertices.data(), GL_STATIC_DRAW);
+        }
         Vector3f pos =
             (position.array() * chunk_offset).matrix().cast<float>();
 
@@ -23,8 +59,37 @@ namespace konstructs {
         translation = Affine3f(Translation3f(rpos)).matrix();
     }
 
+    /* Replace the sections contained in a partial model, returns false
+     * if they do not fit in the space reserved for them */
+    bool ChunkModel::update(const shared_ptr<ChunkModelResult> &data) {
+        for(int i = 0; i < CHUNK_SECTIONS; i++) {
+            if((data->sections & (1 << i)) && data->section_faces[i] > section_capacity[i]) {
+                return false;
+            }
+        }
+        glBindBuffer(GL_ARRAY_BUFFER, buffer);
+        const GLuint *source = data->data();
+        for(int i = 0; i < CHUNK_SECTIONS; i++) {
+            if(!(data->sections & (1 << i))) {
+                continue;
+            }
+            std::vector<GLuint> vertices(section_capacity[i] * FACE_SIZE, 0);
+            std::copy(source, source + data->section_faces[i] * FACE_SIZE, vertices.begin());
+            source += data->section_faces[i] * FACE_SIZE;
+            glBufferSubData(GL_ARRAY_BUFFER, section_first[i] * FACE_SIZE * sizeof(GLuint),
+                            vertices.size() * sizeof(GLuint), vertices.data());
+            faces += data->section_faces[i] - section_faces[i];
+            section_faces[i] = data->section_faces[i];
+        }
+        return true;
+    }
+
     int ChunkModel::vertices() {
-        return faces*6;
+        int capacity = 0;
+        for(int i = 0; i < CHUNK_SECTIONS; i++) {
+            capacity += section_capacity[i];
+        }
+        return capacity*6;
     }
 
     void ChunkModel::bind() {
@@ -34,8 +99,24 @@ namespace konstructs {
                                0, 0);
     }
 
-    void ChunkShader::add(const shared_ptr<ChunkModelResult> &data) {
+    /* Add a model, returns false if the model contains only some sections
+     * and there is no full detail model they can be applied to */
+    bool ChunkShader::add(const shared_ptr<ChunkModelResult> &data) {
         auto it = models.find(data->position);
+        if(data->sections != ALL_SECTIONS) {
+            if(it == models.end() || it->second->lod != 0) {
+                return false;
+            }
+            return it->second->update(data);
+        }
+        if(data->faces == 0) {
+            /* The chunk no longer has any visible faces */
+            if (it != models.end()) {
+                delete it->second;
+                models.erase(it);
+            }
+            return true;
+        }
         auto model = new ChunkModel(data, data_attr);
         if (it != models.end()) {
             auto second = it->second;
@@ -44,7 +125,25 @@ namespace konstructs {
         } else {
             models.insert({data->position, model});
         }
+        return true;
+    }
 
+    /* Find models that should be rebuilt at another level of detail */
+    std::vector<Vector3i> ChunkShader::lod_updates(const ChunkModelFactory &factory,
+            const Vector3i &player_chunk) {
+        std::vector<Vector3i> positions;
+        for(auto &pair: models) {
+            auto m = pair.second;
+            if(m->lod_requested) {
+                continue;
+            }
+            float distance = (m->position - player_chunk).cast<float>().norm();
+            if(factory.level_of_detail(distance, m->lod) != m->lod) {
+                m->lod_requested = true;
+                positions.push_back(m->position);
+            }
+        }
+        return positions;
     }
 
     ChunkShader::ChunkShader(const float fov, const GLuint block_texture,  const GLuint damage_texture,
@@ -54,6 +153,7 @@ namespace konstructs {
         data_attr(attributeId("data")),
         matrix(uniformId("matrix")),
         translation(uniformId("translation")),
+        scale(uniformId("scale")),
         sampler(uniformId("sampler")),
         sky_sampler(uniformId("sky_sampler")),
         damage_sampler(uniformId("damage_sampler")),
@@ -106,6 +206,7 @@ namespace konstructs {
                         const auto m = it->second;
                         visible++;
                         c.set(translation, m->translation);
+                        c.set(scale, (float)(1 << m->lod));
                         c.draw(m);
                         faces += m->faces;
                     }
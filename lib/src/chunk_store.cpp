@@ -0,0 +1,397 @@
+#include <cstdlib>
+#include <cstring>
+#include <cstdint>
+#include <iostream>
+#if !defined(_WIN32) && !defined(__EMSCRIPTEN__)
+#include <sys/mman.h>
+#define USE_MMAP
+#endif
+#include "chunk_store.h"
+#include "util.h"
+
+/* Every store starts with this, followed by the records */
+#define STORE_MAGIC "KCS1"
+#define STORE_MAGIC_SIZE 4
+/* p, q, k, revision, codec and size of the compressed data, a record
+ * without data removes the chunk */
+#define RECORD_HEADER_SIZE 24
+/* Smallest store that is compacted while it is open */
+#define COMPACT_MIN_SIZE (64*1024*1024)
+
+namespace konstructs {
+
+    using std::cout;
+    using std::endl;
+
+    static std::string store_name(const std::string &hostname) {
+        return safe_file_name(hostname) + ".chunks";
+    }
+
+    static void write_header(FILE *f, const Vector3i &position, const uint32_t revision,
+                             const int codec, const uint32_t size) {
+        int32_t header[6] = {position[0], position[1], position[2],
+                             (int32_t)revision, codec, (int32_t)size};
+        fwrite(header, sizeof(int32_t), 6, f);
+    }
+
+    ChunkStore::ChunkStore() :
+        file(nullptr), file_size(0), live(0), mapped(nullptr), mapped_size(0),
+        sequence(0), stopping(true) {}
+
+    ChunkStore::~ChunkStore() {
+        close();
+    }
+
+    bool ChunkStore::open(const std::string &hostname) {
+        close();
+        std::lock_guard<std::mutex> lock(mutex);
+        std::string dir = data_directory();
+        if(dir.empty()) {
+            return false;
+        }
+        path = dir + "/" + store_name(hostname);
+
+        /* Find the latest record of every chunk */
+        live = 0;
+        long end = STORE_MAGIC_SIZE;
+        bool truncated = false;
+        FILE *f = fopen(path.c_str(), "rb");
+        if(f) {
+            char magic[STORE_MAGIC_SIZE];
+            if(fread(magic, 1, STORE_MAGIC_SIZE, f) != STORE_MAGIC_SIZE ||
+               memcmp(magic, STORE_MAGIC, STORE_MAGIC_SIZE) != 0) {
+                truncated = true;
+                end = 0;
+            } else {
+                /* Seeking past the end succeeds, records are checked
+                 * against the length of the file instead */
+                fseek(f, 0, SEEK_END);
+                long length = ftell(f);
+                fseek(f, STORE_MAGIC_SIZE, SEEK_SET);
+                int32_t header[6];
+                while(fread(header, sizeof(int32_t), 6, f) == 6) {
+                    long offset = end + RECORD_HEADER_SIZE;
+                    uint32_t size = (uint32_t)header[5];
+                    if(offset + (long)size > length || fseek(f, size, SEEK_CUR) != 0) {
+                        break;
+                    }
+                    Vector3i position(header[0], header[1], header[2]);
+                    auto it = index.find(position);
+                    if(it != index.end()) {
+                        live -= it->second.size + RECORD_HEADER_SIZE;
+                        if(size == 0) {
+                            index.erase(it);
+                        }
+                    }
+                    end = offset + size;
+                    if(size == 0) {
+                        continue;
+                    }
+                    index[position] = {offset, size, (uint32_t)header[3], header[4]};
+                    live += size + RECORD_HEADER_SIZE;
+                }
+                truncated = length != end;
+            }
+            fclose(f);
+        }
+
+        /* Rewrite the store if most of it is replaced records, or if
+         * it ends with a record that was not completely written */
+        if(truncated || end - STORE_MAGIC_SIZE > 2 * live) {
+            compact();
+        }
+
+        if(!open_file()) {
+            return false;
+        }
+        {
+            std::lock_guard<std::mutex> queue_lock(queue_mutex);
+            stopping = false;
+        }
+        writer_thread = std::thread(&ChunkStore::writer, this);
+        return true;
+    }
+
+    bool ChunkStore::open_file() {
+        file = fopen(path.c_str(), "a+b");
+        if(!file) {
+            cout << "Failed to open chunk store: " << path << endl;
+            index.clear();
+            live = 0;
+            return false;
+        }
+        fseek(file, 0, SEEK_END);
+        file_size = ftell(file);
+        if(file_size == 0) {
+            fwrite(STORE_MAGIC, 1, STORE_MAGIC_SIZE, file);
+            fflush(file);
+            file_size = STORE_MAGIC_SIZE;
+        }
+        map_file();
+        return true;
+    }
+
+    /* Rewrite the store with only the latest records, the store file
+     * must not be open */
+    void ChunkStore::compact() {
+        FILE *in = fopen(path.c_str(), "rb");
+        std::string tmp_path = path + ".tmp";
+        FILE *out = fopen(tmp_path.c_str(), "wb");
+        if(!in || !out) {
+            if(in) fclose(in);
+            if(out) fclose(out);
+            index.clear();
+            live = 0;
+            remove(path.c_str());
+            return;
+        }
+        fwrite(STORE_MAGIC, 1, STORE_MAGIC_SIZE, out);
+        long offset = STORE_MAGIC_SIZE;
+        std::vector<char> data;
+        for(auto it = index.begin(); it != index.end();) {
+            ChunkStoreEntry &entry = it->second;
+            data.resize(entry.size);
+            /* A record that can not be read is dropped */
+            if(fseek(in, entry.offset, SEEK_SET) != 0 ||
+               fread(data.data(), 1, entry.size, in) != entry.size) {
+                live -= entry.size + RECORD_HEADER_SIZE;
+                it = index.erase(it);
+                continue;
+            }
+            write_header(out, it->first, entry.revision, entry.codec, entry.size);
+            fwrite(data.data(), 1, entry.size, out);
+            entry.offset = offset + RECORD_HEADER_SIZE;
+            offset = entry.offset + entry.size;
+            ++it;
+        }
+        fclose(in);
+        fclose(out);
+        remove(path.c_str());
+        if(rename(tmp_path.c_str(), path.c_str()) != 0) {
+            index.clear();
+            live = 0;
+            remove(tmp_path.c_str());
+        }
+    }
+
+    void ChunkStore::close() {
+        /* Let the writer finish the chunks that are waiting */
+        if(writer_thread.joinable()) {
+            {
+                std::lock_guard<std::mutex> lock(queue_mutex);
+                stopping = true;
+            }
+            queue_condition.notify_all();
+            writer_thread.join();
+        }
+        std::lock_guard<std::mutex> lock(mutex);
+        unmap_file();
+        if(file) {
+            fclose(file);
+            file = nullptr;
+        }
+        file_size = 0;
+        live = 0;
+        index.clear();
+    }
+
+    void ChunkStore::map_file() {
+#if defined(USE_MMAP)
+        void *m = mmap(nullptr, file_size, PROT_READ, MAP_SHARED, fileno(file), 0);
+        if(m != MAP_FAILED) {
+            mapped = (char*)m;
+            mapped_size = file_size;
+        }
+#endif
+    }
+
+    void ChunkStore::unmap_file() {
+#if defined(USE_MMAP)
+        if(mapped) {
+            munmap(mapped, mapped_size);
+        }
+#endif
+        mapped = nullptr;
+        mapped_size = 0;
+    }
+
+    void ChunkStore::put(const Vector3i &position, const uint32_t revision, const int codec,
+                         const char *data, const uint32_t size) {
+        PendingChunk chunk;
+        chunk.revision = revision;
+        chunk.codec = codec;
+        chunk.data = std::make_shared<const std::vector<char>>(data, data + size);
+        queue(position, chunk);
+    }
+
+    void ChunkStore::put(const ChunkData &chunk) {
+        PendingChunk pending_chunk;
+        pending_chunk.revision = chunk.revision;
+        pending_chunk.codec = CODEC_ZLIB;
+        pending_chunk.chunk = std::make_shared<const ChunkData>(chunk);
+        queue(chunk.position, pending_chunk);
+    }
+
+    void ChunkStore::discard(const Vector3i &position) {
+        queue(position, PendingChunk());
+    }
+
+    /* Replace any chunk at the same position that is still waiting */
+    void ChunkStore::queue(const Vector3i &position, PendingChunk chunk) {
+        {
+            std::lock_guard<std::mutex> lock(queue_mutex);
+            if(stopping) {
+                return;
+            }
+            chunk.sequence = sequence++;
+            pending[position] = chunk;
+        }
+        queue_condition.notify_all();
+    }
+
+    void ChunkStore::writer() {
+        std::unique_lock<std::mutex> ulock(queue_mutex);
+        while(true) {
+            queue_condition.wait(ulock, [this]{ return stopping || !pending.empty(); });
+            if(pending.empty()) {
+                return;
+            }
+            /* Chunks may be queued again while this batch is written */
+            ChunkMap<PendingChunk> batch = pending;
+            ulock.unlock();
+
+            std::vector<char> encoded;
+            for(auto &pair : batch) {
+                const PendingChunk &chunk = pair.second;
+                if(chunk.chunk) {
+                    encoded = chunk.chunk->encode();
+                    write(pair.first, chunk.revision, chunk.codec, encoded.data(), encoded.size());
+                } else if(chunk.data) {
+                    write(pair.first, chunk.revision, chunk.codec,
+                          chunk.data->data(), chunk.data->size());
+                } else {
+                    erase(pair.first);
+                }
+            }
+
+            {
+                std::lock_guard<std::mutex> lock(mutex);
+                if(file) {
+                    fflush(file);
+                }
+                /* Most of a large store is replaced records, rewrite it
+                 * instead of waiting until it is opened again */
+                if(file && file_size > COMPACT_MIN_SIZE &&
+                   file_size - STORE_MAGIC_SIZE > 2 * live) {
+                    unmap_file();
+                    fclose(file);
+                    file = nullptr;
+                    compact();
+                    open_file();
+                }
+            }
+
+            ulock.lock();
+            for(auto &pair : batch) {
+                auto it = pending.find(pair.first);
+                if(it != pending.end() && it->second.sequence == pair.second.sequence) {
+                    pending.erase(it);
+                }
+            }
+        }
+    }
+
+    void ChunkStore::write(const Vector3i &position, const uint32_t revision, const int codec,
+                           const char *data, const uint32_t size) {
+        std::lock_guard<std::mutex> lock(mutex);
+        if(!file || size == 0) {
+            return;
+        }
+        auto it = index.find(position);
+        /* The server often sends chunks again without any changes */
+        if(it != index.end() && it->second.revision == revision && it->second.size == size &&
+           it->second.codec == codec && revision != 0) {
+            return;
+        }
+        if(it != index.end()) {
+            live -= it->second.size + RECORD_HEADER_SIZE;
+        }
+        fseek(file, 0, SEEK_END);
+        write_header(file, position, revision, codec, size);
+        fwrite(data, 1, size, file);
+        index[position] = {file_size + RECORD_HEADER_SIZE, size, revision, codec};
+        file_size += RECORD_HEADER_SIZE + size;
+        live += RECORD_HEADER_SIZE + size;
+    }
+
+    /* Append a record that removes the chunk */
+    void ChunkStore::erase(const Vector3i &position) {
+        std::lock_guard<std::mutex> lock(mutex);
+        auto it = index.find(position);
+        if(!file || it == index.end()) {
+            return;
+        }
+        live -= it->second.size + RECORD_HEADER_SIZE;
+        index.erase(it);
+        fseek(file, 0, SEEK_END);
+        write_header(file, position, 0, 0, 0);
+        file_size += RECORD_HEADER_SIZE;
+    }
+
+    bool ChunkStore::contains(const Vector3i &position) {
+        {
+            std::lock_guard<std::mutex> lock(queue_mutex);
+            auto it = pending.find(position);
+            if(it != pending.end()) {
+                return it->second.data || it->second.chunk;
+            }
+        }
+        std::lock_guard<std::mutex> lock(mutex);
+        return index.find(position) != index.end();
+    }
+
+    bool ChunkStore::get(const Vector3i &position, std::vector<char> &data, int &codec) {
+        /* A chunk that is waiting is newer than the one in the file */
+        PendingChunk chunk;
+        bool waiting = false;
+        {
+            std::lock_guard<std::mutex> lock(queue_mutex);
+            auto it = pending.find(position);
+            if(it != pending.end()) {
+                chunk = it->second;
+                waiting = true;
+            }
+        }
+        if(waiting) {
+            codec = chunk.codec;
+            if(chunk.chunk) {
+                data = chunk.chunk->encode();
+            } else if(chunk.data) {
+                data = *chunk.data;
+            } else {
+                return false;
+            }
+            return true;
+        }
+        std::lock_guard<std::mutex> lock(mutex);
+        auto it = index.find(position);
+        if(it == index.end()) {
+            return false;
+        }
+        data.resize(it->second.size);
+        codec = it->second.codec;
+        return read(it->second, data.data());
+    }
+
+    bool ChunkStore::read(const ChunkStoreEntry &entry, char *data) {
+        /* Records written since the store was opened are not mapped */
+        if(mapped && entry.offset + (long)entry.size <= mapped_size) {
+            memcpy(data, mapped + entry.offset, entry.size);
+            return true;
+        }
+        if(fseek(file, entry.offset, SEEK_SET) != 0) {
+            return false;
+        }
+        return fread(data, 1, entry.size, file) == entry.size;
+    }
+};
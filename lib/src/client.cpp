@@ -22,6 +22,10 @@
 #define MAX_RECV_SIZE 4096*1024
 #define PACKETS (MAX_PENDING_CHUNKS * 2)
 #define HEADER_SIZE 4
+/* p, q, k, base revision and revision */
+#define DELTA_HEADER_SIZE (5 * sizeof(int))
+/* Index of the block in the chunk followed by the block */
+#define DELTA_BLOCK_SIZE (sizeof(uint16_t) + BLOCK_SIZE)
 
 namespace konstructs {
     using nonstd::nullopt;
@@ -29,12 +33,11 @@ namespace konstructs {
     const int NO_CHUNK_FOUND = 0x0FFFFFFF;
 
     Client::Client(bool debug_mode) :
-        connected(false), debug_mode(debug_mode),
+        connected(false), debug_mode(debug_mode), codec(CODEC_ZLIB),
         player_chunk(0,0,0), radius(0), loaded_radius(0) {
         recv_thread = new std::thread(&Client::recv_worker, this);
         send_thread = new std::thread(&Client::send_worker, this);
         chunk_thread = new std::thread(&Client::chunk_worker, this);
-        inflation_buffer = new char[BLOCK_BUFFER_SIZE];
     }
 
     string Client::get_error_message() {
@@ -68,7 +71,37 @@ namespace konstructs {
             error_message = "Could not connect to server";
             throw std::runtime_error(error_message);
         }
+        if(!store.open(hostname)) {
+            std::cout << "Chunk store not available, chunks will not be kept between sessions" << std::endl;
+        }
+        codec = CODEC_ZLIB;
         version(PROTOCOL_VERSION, nick, hash);
+        offer_codecs();
+    }
+
+    /* Let the server know what other codecs than zlib chunks can be sent with */
+    void Client::offer_codecs() {
+        auto codecs = supported_codecs();
+        if(codecs.size() < 2) {
+            // Only zlib, which every server uses by default
+            return;
+        }
+        std::stringstream ss;
+        ss << "Z";
+        for(int c : codecs) {
+            ss << "," << codec_name(c);
+        }
+        send_string(ss.str());
+    }
+
+    /* The server picked one of the offered codecs for the chunks that follow */
+    void Client::process_codec(Packet *packet) {
+        std::string str = packet->to_string();
+        int c = codec_by_name(str.substr(1));
+        if(c < 0) {
+            throw std::runtime_error("Unknown codec: " + str);
+        }
+        codec = c;
     }
 
     size_t Client::recv_all(char* out_buf, const size_t size) {
@@ -103,6 +136,17 @@ namespace konstructs {
         chunk_updated(pos);
     }
 
+    /* The server has no newer revision of a chunk than the one held */
+    void Client::process_chunk_not_modified(Packet *packet) {
+        std::string str = packet->to_string();
+        int p,q,k;
+        if(sscanf(str.c_str(), ",%d,%d,%d", &p, &q, &k) != 3) {
+            throw std::runtime_error(str);
+        }
+        Vector3i pos(p, q, k);
+        chunk_not_modified(pos);
+    }
+
 
     void Client::process_error(Packet *packet) {
         error_message = packet->to_string().substr(1);
@@ -123,13 +167,57 @@ namespace konstructs {
         pos += sizeof(int);
 
         Vector3i position(p, q, k);
-        received_chunk(position);
         const int blocks_size = packet->size - 3 * sizeof(int);
-        auto chunk = ChunkData(position, pos, blocks_size, (uint8_t*)inflation_buffer, cached_data);
+        auto chunk = ChunkData(position, pos, blocks_size, cached_data, codec);
+        received_chunk(position, chunk.revision);
+        if(chunk.complete) {
+            store.put(position, chunk.revision, codec, pos, blocks_size);
+        } else {
+            store.discard(position);
+        }
         std::lock_guard<std::mutex> lock_packets(packets_mutex);
         chunks.push_back(chunk);
     }
 
+    void Client::process_chunk_delta(Packet *packet) {
+        if(packet->size < DELTA_HEADER_SIZE ||
+           (packet->size - DELTA_HEADER_SIZE) % DELTA_BLOCK_SIZE != 0) {
+            throw std::runtime_error("Malformed chunk delta");
+        }
+        int *header = (int*)packet->buffer();
+        ChunkDelta delta;
+        delta.position = Vector3i(ntohl(header[0]), ntohl(header[1]), ntohl(header[2]));
+        delta.base = ntohl(header[3]);
+        delta.revision = ntohl(header[4]);
+        const int count = (packet->size - DELTA_HEADER_SIZE) / DELTA_BLOCK_SIZE;
+        const uint8_t *pos = (uint8_t*)packet->buffer() + DELTA_HEADER_SIZE;
+        delta.changes.reserve(count);
+        for(int i = 0; i < count; i++) {
+            int index = (pos[0] << 8) + pos[1];
+            if(index >= CHUNK_SIZE*CHUNK_SIZE*CHUNK_SIZE) {
+                throw std::runtime_error("Malformed chunk delta");
+            }
+            delta.changes.push_back({index, read_block(pos + sizeof(uint16_t))});
+            pos += DELTA_BLOCK_SIZE;
+        }
+
+        std::lock_guard<std::mutex> lock_packets(packets_mutex);
+        // A chunk that is not yet in the world must get the changes
+        // here, or it would replace the changed chunk when inserted
+        for(auto it = chunks.rbegin(); it != chunks.rend(); ++it) {
+            if(it->position == delta.position) {
+                if(it->revision == delta.base) {
+                    *it = it->apply(delta.revision, delta.changes);
+                    delta_applied(*it);
+                } else {
+                    refetch_chunk(delta.position);
+                }
+                return;
+            }
+        }
+        deltas.push_back(delta);
+    }
+
     void Client::recv_worker() {
         if (debug_mode) {
             std::cout<<"[Recv worker]: started"<<std::endl;
@@ -174,6 +262,12 @@ namespace konstructs {
                         process_error(packet.get());
                     } else if(packet->type == 'c') {
                         process_chunk_updated(packet.get());
+                    } else if(packet->type == 'N') {
+                        process_chunk_not_modified(packet.get());
+                    } else if(packet->type == 'B') {
+                        process_chunk_delta(packet.get());
+                    } else if(packet->type == 'Z') {
+                        process_codec(packet.get());
                     } else {
                         std::lock_guard<std::mutex> lock_packets(packets_mutex);
                         packets.push(packet);
@@ -226,6 +320,36 @@ namespace konstructs {
         return head;
     }
 
+    vector<ChunkDelta> Client::receive_deltas() {
+        std::lock_guard<std::mutex> lock_packets(packets_mutex);
+        vector<ChunkDelta> head;
+        head.swap(deltas);
+        return head;
+    }
+
+    /* The changes of a delta was applied to the chunk in the world,
+     * the store must not keep the chunk from before the changes */
+    void Client::delta_applied(const ChunkData &chunk) {
+        store.put(chunk);
+        std::lock_guard<std::mutex> ulck_chunk(mutex_chunk);
+        held_queue.push_back({chunk.position, chunk.revision});
+    }
+
+    /* The chunk in the world could not be updated, get all of it again */
+    void Client::refetch_chunk(const Vector3i &pos) {
+        chunk_updated(pos);
+    }
+
+    /* The chunks were evicted from the world, they must be received
+     * or loaded again the next time they are needed */
+    void Client::forget(const vector<Vector3i> &positions) {
+        if(positions.empty()) {
+            return;
+        }
+        std::lock_guard<std::mutex> ulck_chunk(mutex_chunk);
+        forget_queue.insert(forget_queue.end(), positions.begin(), positions.end());
+    }
+
     int Client::send_all(const char *data, int length) {
         int count = 0;
         while (count < length) {
@@ -311,9 +435,13 @@ namespace konstructs {
         send_string(ss.str());
     }
 
-    void Client::chunk(const Vector3i position) {
+    void Client::chunk(const Vector3i position, const uint32_t revision) {
         std::stringstream ss;
         ss << "C," << position[0] << "," << position[1] << "," << position[2];
+        if(revision != 0) {
+            // The server replies with 'N' if it has no newer revision
+            ss << "," << revision;
+        }
         send_string(ss.str());
     }
 
@@ -412,9 +540,14 @@ namespace konstructs {
         return loaded_radius;
     }
 
-    void Client::received_chunk(const Vector3i &pos) {
+    void Client::received_chunk(const Vector3i &pos, const uint32_t revision) {
+        std::lock_guard<std::mutex> ulck_chunk(mutex_chunk);
+        received_queue.push_back({pos, revision});
+    }
+
+    void Client::chunk_not_modified(const Vector3i &pos) {
         std::lock_guard<std::mutex> ulck_chunk(mutex_chunk);
-        received_queue.push_back(pos);
+        not_modified_queue.push_back(pos);
     }
 
     /* The chunk is not received, and never requested */
@@ -432,13 +565,58 @@ namespace konstructs {
         return requested.find(pos) == requested.end() && updated.find(pos) != updated.end();
     }
 
+    /* Ask the server for a chunk, with the revision of it that is held if any */
+    void Client::request_chunk(const Vector3i &pos) {
+        requested.insert(pos);
+        auto it = held.find(pos);
+        chunk(pos, it != held.end() ? it->second : 0);
+    }
+
     /* Ask the server for a chunk, and wait a little while */
     void Client::request_chunk_and_sleep(Vector3i pos, int msec) {
-        requested.insert(pos);
-        chunk(pos);
+        request_chunk(pos);
         std::this_thread::sleep_for(std::chrono::milliseconds(msec));
     }
 
+    /* Show chunks from the chunk store while they are requested from the server */
+    void Client::load_stored_chunks(priority_queue<ChunkToFetch, vector<ChunkToFetch>, LessThanByScore> &to_load,
+                                    const Vector3i &p_chunk, const int r) {
+        {
+            // Don't load chunks faster than they are inserted into the world
+            std::lock_guard<std::mutex> lock_packets(packets_mutex);
+            if(chunks.size() >= STORE_LOADS) {
+                return;
+            }
+        }
+        int loaded = 0;
+        while(!to_load.empty() && loaded < STORE_LOADS) {
+            Vector3i pos = to_load.top().chunk;
+            to_load.pop();
+            // A chunk that is requested or received will soon be, or
+            // already is, more recent than the stored one
+            if((pos - p_chunk).norm() > r || !is_empty_chunk(pos) ||
+               stored.find(pos) != stored.end()) {
+                continue;
+            }
+            int stored_codec;
+            if(!store.get(pos, store_buffer, stored_codec) || store_buffer.size() <= BLOCKS_HEADER_SIZE) {
+                continue;
+            }
+            auto chunk = ChunkData(pos, store_buffer.data(), store_buffer.size(),
+                                   store_cached_data, stored_codec);
+            if(!chunk.complete) {
+                // Fetched from the server as if it was never stored
+                store.discard(pos);
+                continue;
+            }
+            stored.insert(pos);
+            held[pos] = chunk.revision;
+            std::lock_guard<std::mutex> lock_packets(packets_mutex);
+            chunks.push_back(chunk);
+            loaded++;
+        }
+    }
+
     void Client::chunk_worker() {
         if (debug_mode) {
             std::cout<<"[Chunk worker]: started"<<std::endl;
@@ -462,6 +640,10 @@ namespace konstructs {
             bool chunk_changed = false; // Stores if the chunk the player is in changed
             // Stores the chunks that needs to be fetched in priority order
             priority_queue<ChunkToFetch, vector<ChunkToFetch>, LessThanByScore> chunks_to_fetch;
+            // Stores the chunks that can be loaded from the chunk store in priority order
+            priority_queue<ChunkToFetch, vector<ChunkToFetch>, LessThanByScore> chunks_to_load;
+            stored.clear();
+            held.clear();
 
             while(connected && logged_in) {
 
@@ -470,27 +652,62 @@ namespace konstructs {
                     // shared variables and empties the updated and received queues
                     std::lock_guard<std::mutex> lck_chunk(mutex_chunk);
 
-                    // Copy all chunks from the updated queue
-                    for(auto chunk: updated_queue) {
-                        updated.insert(chunk);
-                    }
-
-                    // Clear the updated queue
-                    updated_queue.clear();
-
                     // Copy all chunks from the receive queue
                     for(auto chunk: received_queue) {
                         // Remove received chunks from requested set
-                        requested.erase(chunk);
+                        requested.erase(chunk.first);
                         // Remove received chunks from updated set
-                        updated.erase(chunk);
+                        updated.erase(chunk.first);
                         // Insert into received set
-                        received.insert(chunk);
+                        received.insert(chunk.first);
+                        // Remember the revision for later requests
+                        held[chunk.first] = chunk.second;
                     }
 
                     // Clear received queue
                     received_queue.clear();
 
+                    // Chunks that were not modified are received, the held revision is still current
+                    for(auto chunk: not_modified_queue) {
+                        requested.erase(chunk);
+                        updated.erase(chunk);
+                        received.insert(chunk);
+                    }
+
+                    not_modified_queue.clear();
+
+                    // Copy all chunks from the updated queue, after the received
+                    // chunks as a change may have been made after they were sent
+                    for(auto chunk: updated_queue) {
+                        updated.insert(chunk);
+                    }
+
+                    // Clear the updated queue
+                    updated_queue.clear();
+
+                    // Chunks that were changed by a delta, only update revisions that are held
+                    for(auto chunk: held_queue) {
+                        auto it = held.find(chunk.first);
+                        if(it != held.end()) {
+                            it->second = chunk.second;
+                        }
+                    }
+
+                    held_queue.clear();
+
+                    // Chunks evicted from the world are no longer received or loaded
+                    for(auto chunk: forget_queue) {
+                        received.erase(chunk);
+                        stored.erase(chunk);
+                        held.erase(chunk);
+                        // Chunks inside the radius must be fetched again
+                        if((chunk - player_chunk).norm() <= radius) {
+                            chunk_changed = true;
+                        }
+                    }
+
+                    forget_queue.clear();
+
                     // Check if player chunk changed
                     if(p_chunk != player_chunk) {
                         // Update local chunk variable
@@ -513,11 +730,8 @@ namespace konstructs {
 
                                 Vector3i lpos = p_chunk + Vector3i(p, q, s);
                                 if (is_empty_chunk(lpos)) {
-                                    // Insert into requested set
-                                    requested.insert(lpos);
-
-                                    // Request the chunk
-                                    chunk(lpos);
+                                    // Insert into requested set and request the chunk
+                                    request_chunk(lpos);
                                 }
                             }
                         }
@@ -526,7 +740,10 @@ namespace konstructs {
                     // Empty the priority queue
                     chunks_to_fetch = priority_queue<ChunkToFetch, vector<ChunkToFetch>, LessThanByScore>();
 
-                    // Rebuild the priority queue
+                    // Empty the stored chunks queue
+                    chunks_to_load = priority_queue<ChunkToFetch, vector<ChunkToFetch>, LessThanByScore>();
+
+                    // Rebuild the priority queues
                     for(int p = -r - 1; p < r; p++) {
                         for(int q = -r - 1; q < r; q++) {
                             for(int k = -r - 1; k < r; k++) {
@@ -538,6 +755,9 @@ namespace konstructs {
                                     if(distance <= r) {
                                         // Add chunk to queue
                                         chunks_to_fetch.push({distance, pos});
+                                        if(stored.find(pos) == stored.end() && store.contains(pos)) {
+                                            chunks_to_load.push({distance, pos});
+                                        }
                                     }
                                 }
                             }
@@ -564,6 +784,9 @@ namespace konstructs {
                                     // that is chunks within the old radius
                                     if(distance <= r && distance >= old_r) {
                                         chunks_to_fetch.push({distance, pos});
+                                        if(stored.find(pos) == stored.end() && store.contains(pos)) {
+                                            chunks_to_load.push({distance, pos});
+                                        }
                                     }
                                 }
                             }
@@ -586,6 +809,28 @@ namespace konstructs {
                     }
                 }
 
+                // Remove old chunks in stored set the same way
+                for(auto it = stored.begin(); it != stored.end();) {
+                    int distance = (*it - p_chunk).norm();
+                    if(distance >= (r + KEEP_EXTRA_CHUNKS)) {
+                        it = stored.erase(it);
+                    } else {
+                        ++it;
+                    }
+                }
+
+                // Forget revisions of chunks that may no longer be in the world
+                for(auto it = held.begin(); it != held.end();) {
+                    int distance = (it->first - p_chunk).norm();
+                    if(distance >= (r + KEEP_EXTRA_CHUNKS)) {
+                        it = held.erase(it);
+                    } else {
+                        ++it;
+                    }
+                }
+
+                load_stored_chunks(chunks_to_load, p_chunk, r);
+
                 // Look at the update queue and add to request queue
                 for(auto it = updated.begin(); it != updated.end();) {
                     Vector3i pos = *it;
@@ -618,12 +863,10 @@ namespace konstructs {
 
                     // Check that at least one suitable chunk was found
                     if(c.score != NO_CHUNK_FOUND) {
-                        // Insert into requested
-                        requested.insert(c.chunk);
                         // Remove from updated
                         updated.erase(c.chunk);
-                        // Request chunk
-                        chunk(c.chunk);
+                        // Insert into requested and request chunk
+                        request_chunk(c.chunk);
                         // Update loaded radius
                         set_loaded_radius(c.score);
                     }
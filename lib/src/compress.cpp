@@ -1,25 +1,197 @@
 #include <zlib.h>
 #include <stdio.h>
+#if defined(KONSTRUCTS_LZ4)
+#include <lz4.h>
+#endif
+#if defined(KONSTRUCTS_ZSTD)
+#include <zstd.h>
+#endif
 #include "compress.h"
 
-int inflate_data(char *in, int in_size, char *out, int out_size) {
+/* Size of the parts that are passed on when decompressing a stream */
+#define STREAM_WINDOW_SIZE 16384
+/* Largest payload that is decompressed at once when a codec can't stream */
+#define MAX_DECOMPRESSED_SIZE (4096*1024)
+
+/* A stream for every thread that decompresses chunks, it is reset
+ * instead of set up again for every chunk */
+struct InflateStream {
     z_stream strm;
+    bool initialized;
+};
+
+static thread_local InflateStream inflate_stream = {};
+
+/* Set up or reset the stream of this thread */
+static z_stream &reset_inflate_stream() {
+    z_stream &strm = inflate_stream.strm;
+    if(!inflate_stream.initialized) {
+        strm.zalloc = Z_NULL;
+        strm.zfree = Z_NULL;
+        strm.opaque = Z_NULL;
+        strm.avail_in = 0;
+        strm.next_in = Z_NULL;
+        inflateInit(&strm);
+        inflate_stream.initialized = true;
+    } else {
+        inflateReset(&strm);
+    }
+    return strm;
+}
 
-    strm.zalloc = Z_NULL;
-    strm.zfree = Z_NULL;
-    strm.opaque = Z_NULL;
+int inflate_data(char *in, int in_size, char *out, int out_size) {
+    z_stream &strm = reset_inflate_stream();
 
     strm.avail_in = in_size;
     strm.next_in = (Bytef*)in;
     strm.avail_out = out_size;
     strm.next_out = (Bytef*)out;
 
-    inflateInit(&strm);
     int ret;
     if ((ret = inflate(&strm, Z_FINISH)) != Z_STREAM_END) {
         printf("inflate: return code %d\n", ret);
     }
-    inflateEnd(&strm);
 
     return strm.total_out;
 }
+
+int deflate_data(const char *in, int in_size, std::vector<char> &out) {
+    const size_t start = out.size();
+    uLongf size = compressBound(in_size);
+    out.resize(start + size);
+    int ret = compress2((Bytef*)out.data() + start, &size, (const Bytef*)in, in_size, Z_DEFAULT_COMPRESSION);
+    if(ret != Z_OK) {
+        printf("deflate: return code %d\n", ret);
+        size = 0;
+    }
+    out.resize(start + size);
+    return size;
+}
+
+#if defined(KONSTRUCTS_ZSTD)
+static thread_local ZSTD_DCtx *zstd_context = nullptr;
+#endif
+
+int decompress_data(const int codec, char *in, int in_size, char *out, int out_size) {
+    switch(codec) {
+#if defined(KONSTRUCTS_LZ4)
+    case CODEC_LZ4: {
+        int ret = LZ4_decompress_safe(in, out, in_size, out_size);
+        if(ret < 0) {
+            printf("lz4: return code %d\n", ret);
+            return 0;
+        }
+        return ret;
+    }
+#endif
+#if defined(KONSTRUCTS_ZSTD)
+    case CODEC_ZSTD: {
+        if(!zstd_context) {
+            zstd_context = ZSTD_createDCtx();
+        }
+        size_t ret = ZSTD_decompressDCtx(zstd_context, out, out_size, in, in_size);
+        if(ZSTD_isError(ret)) {
+            printf("zstd: %s\n", ZSTD_getErrorName(ret));
+            return 0;
+        }
+        return (int)ret;
+    }
+#endif
+    default:
+        return inflate_data(in, in_size, out, out_size);
+    }
+}
+
+int decompress_stream(const int codec, char *in, int in_size,
+                      const std::function<void(const char *data, int size)> &consume) {
+    static thread_local char window[STREAM_WINDOW_SIZE];
+    int total = 0;
+    switch(codec) {
+#if defined(KONSTRUCTS_LZ4)
+    case CODEC_LZ4: {
+        /* The LZ4 block format can only be decompressed all at once */
+        static thread_local std::vector<char> out(MAX_DECOMPRESSED_SIZE);
+        total = decompress_data(codec, in, in_size, out.data(), out.size());
+        consume(out.data(), total);
+        return total;
+    }
+#endif
+#if defined(KONSTRUCTS_ZSTD)
+    case CODEC_ZSTD: {
+        if(!zstd_context) {
+            zstd_context = ZSTD_createDCtx();
+        }
+        ZSTD_DCtx_reset(zstd_context, ZSTD_reset_session_only);
+        ZSTD_inBuffer input = {in, (size_t)in_size, 0};
+        ZSTD_outBuffer output;
+        size_t ret;
+        do {
+            output = {window, STREAM_WINDOW_SIZE, 0};
+            ret = ZSTD_decompressStream(zstd_context, &output, &input);
+            if(ZSTD_isError(ret)) {
+                printf("zstd: %s\n", ZSTD_getErrorName(ret));
+                break;
+            }
+            if(output.pos > 0) {
+                consume(window, output.pos);
+                total += output.pos;
+            }
+            // Stop at the end of the frame, or when there is nothing more to decompress
+        } while(ret != 0 && (input.pos < input.size || output.pos == output.size));
+        return total;
+    }
+#endif
+    default: {
+        z_stream &strm = reset_inflate_stream();
+        strm.avail_in = in_size;
+        strm.next_in = (Bytef*)in;
+        int ret;
+        do {
+            strm.avail_out = STREAM_WINDOW_SIZE;
+            strm.next_out = (Bytef*)window;
+            ret = inflate(&strm, Z_NO_FLUSH);
+            int produced = STREAM_WINDOW_SIZE - strm.avail_out;
+            if(produced > 0) {
+                consume(window, produced);
+                total += produced;
+            }
+        } while(ret == Z_OK);
+        if(ret != Z_STREAM_END) {
+            printf("inflate: return code %d\n", ret);
+        }
+        return total;
+    }
+    }
+}
+
+const char *codec_name(const int codec) {
+    switch(codec) {
+    case CODEC_LZ4:
+        return "lz4";
+    case CODEC_ZSTD:
+        return "zstd";
+    default:
+        return "zlib";
+    }
+}
+
+int codec_by_name(const std::string &name) {
+    for(int codec : supported_codecs()) {
+        if(name == codec_name(codec)) {
+            return codec;
+        }
+    }
+    return -1;
+}
+
+std::vector<int> supported_codecs() {
+    std::vector<int> codecs;
+#if defined(KONSTRUCTS_ZSTD)
+    codecs.push_back(CODEC_ZSTD);
+#endif
+#if defined(KONSTRUCTS_LZ4)
+    codecs.push_back(CODEC_LZ4);
+#endif
+    codecs.push_back(CODEC_ZLIB);
+    return codecs;
+}
@@ -82,13 +82,13 @@ void make_cube_faces(
 void make_rotated_cube(float *data, char ao[6][4],
                        int left, int right, int top, int bottom, int front, int back,
                        float x, float y, float z, float n, float rx, float ry, float rz,
-                       int w, const int blocks[256][6]) {
-    int wleft = blocks[w][0];
-    int wright = blocks[w][1];
-    int wtop = blocks[w][2];
-    int wbottom = blocks[w][3];
-    int wfront = blocks[w][4];
-    int wback = blocks[w][5];
+                       int w, const BlockType *types) {
+    int wleft = types[w].textures[0];
+    int wright = types[w].textures[1];
+    int wtop = types[w].textures[2];
+    int wbottom = types[w].textures[3];
+    int wfront = types[w].textures[4];
+    int wback = types[w].textures[5];
     make_cube_faces(
         data, ao,
         left, right, top, bottom, front, back,
@@ -117,13 +117,13 @@ void make_rotated_cube(float *data, char ao[6][4],
 void make_cube(
     float *data, char ao[6][4],
     int left, int right, int top, int bottom, int front, int back,
-    float x, float y, float z, float n, int w, const int blocks[256][6]) {
-    int wleft = blocks[w][0];
-    int wright = blocks[w][1];
-    int wtop = blocks[w][2];
-    int wbottom = blocks[w][3];
-    int wfront = blocks[w][4];
-    int wback = blocks[w][5];
+    float x, float y, float z, float n, int w, const BlockType *types) {
+    int wleft = types[w].textures[0];
+    int wright = types[w].textures[1];
+    int wtop = types[w].textures[2];
+    int wbottom = types[w].textures[3];
+    int wfront = types[w].textures[4];
+    int wback = types[w].textures[5];
     make_cube_faces(
         data, ao,
         left, right, top, bottom, front, back,
@@ -155,7 +155,7 @@ void make_cube(
 #define OFF_LIGHT 26
 
 void make_cube2(GLuint *data, char ao[6][4], uint8_t faces[6], RGBAmbient corner_data[8],
-                int x, int y, int z, const BlockData block, int damage, const int blocks[256][6]) {
+                int x, int y, int z, const BlockData block, int damage, const BlockType *types) {
     /*
      * For each corner of the cube, which vertex should be used (see vertex shader)
      */
@@ -498,8 +498,8 @@ void make_cube2(GLuint *data, char ao[6][4], uint8_t faces[6], RGBAmbient corner
                         (ao[i][j] << OFF_AO) + (damage_u << OFF_DAMAGE_U) +
                         (damage_v << OFF_DAMAGE_V);
             *(d++) = d1;
-            int du = (blocks[block.type][tex[dir][rot][i]] % 16) + (uvs[dir][rot][i][j][0] ? 1 : 0);
-            int dv = (blocks[block.type][tex[dir][rot][i]] / 16) + (uvs[dir][rot][i][j][1] ? 1 : 0);
+            int du = (types[block.type].textures[tex[dir][rot][i]] % 16) + (uvs[dir][rot][i][j][0] ? 1 : 0);
+            int dv = (types[block.type].textures[tex[dir][rot][i]] / 16) + (uvs[dir][rot][i][j][1] ? 1 : 0);
 
             GLuint d2 = (du << OFF_DU) + (dv << OFF_DV) + (rgba.ambient << OFF_AL) +
                         (rgba.r << OFF_R) + (rgba.g << OFF_G) +
@@ -511,7 +511,7 @@ void make_cube2(GLuint *data, char ao[6][4], uint8_t faces[6], RGBAmbient corner
 
 void make_plant(
     GLuint *data, char ao,
-    int x, int y, int z, const BlockData block, const int blocks[256][6]) {
+    int x, int y, int z, const BlockData block, const BlockType *types) {
     static const int position_index[4][4] = {
         {8, 9, 10, 11},
         {8, 9, 10, 11},
@@ -540,8 +540,8 @@ void make_plant(
                         (ao << OFF_AO) + (0 << OFF_DAMAGE_U) +
                         (0 << OFF_DAMAGE_V);
             *(d++) = d1;
-            int du = (blocks[block.type][i] % 16) + (uvs[i][j][0] ? 1 : 0);
-            int dv = (blocks[block.type][i] / 16) + (uvs[i][j][1] ? 1 : 0);
+            int du = (types[block.type].textures[i] % 16) + (uvs[i][j][0] ? 1 : 0);
+            int dv = (types[block.type].textures[i] / 16) + (uvs[i][j][1] ? 1 : 0);
             GLuint d2 = (du << OFF_DU) + (dv << OFF_DV) + (block.ambient << OFF_AL) +
                         (block.r << OFF_R) + (block.g << OFF_G) +
                         (block.b << OFF_B) + (block.light << OFF_LIGHT);
@@ -1,3 +1,4 @@
+#include <stdexcept>
 #include "hud.h"
 
 namespace konstructs {
@@ -5,10 +6,14 @@ namespace konstructs {
     Hud::Hud(const int columns, const int rows, const int belt_size):
         rows(rows),
         columns(columns),
+        bg(columns * rows, -1),
+        item_stacks(columns * rows, nullopt),
         belt_size(belt_size),
         held_stack(nullopt),
         selection(0),
-        interactive(false) {
+        interactive(false),
+        bg_version(1),
+        stack_version(1) {
         for(int i = 0; i < belt_size; i++) {
             belt.push_back(nullopt);
         }
@@ -22,61 +27,73 @@ namespace konstructs {
     void Hud::reset_held() {
         held_stack = nullopt;
     }
+    /* Positions outside of the HUD are sent by servers with a larger
+     * inventory, they are ignored like when resetting */
     void Hud::set_background(const Vector2i pos, const int t) {
-        bg.erase(pos);
-        bg.insert({pos, t});
+        if(!inside(pos)) {
+            return;
+        }
+        int i = index(pos);
+        if(bg[i] == t) {
+            return;
+        }
+        bg[i] = t;
+        bg_version++;
     }
     void Hud::reset_background(const Vector2i pos) {
-        bg.erase(pos);
+        if(inside(pos) && bg[index(pos)] >= 0) {
+            bg[index(pos)] = -1;
+            bg_version++;
+        }
     }
     bool Hud::active(const Vector2i pos) const {
-        return bg.find(pos) != bg.end() || item_stacks.find(pos) != item_stacks.end();
-    }
-    std::unordered_map<Vector2i, int, matrix_hash<Vector2i>> Hud::backgrounds() const {
-        if(!interactive) {
-            std::unordered_map<Vector2i, int, matrix_hash<Vector2i>> new_bg(bg);
-            for(int i = 0; i < belt_size; i++) {
-                Vector2i pos((columns - belt_size) / 2 + i, 0);
-                new_bg.erase(pos);
-                if(i == selection)
-                    new_bg.insert({pos, 3});
-                else
-                    new_bg.insert({pos, 2});
-            }
-            return new_bg;
-        } else {
-            return bg;
+        return inside(pos) && (bg[index(pos)] >= 0 || item_stacks[index(pos)]);
+    }
+    int Hud::background(const Vector2i &pos) const {
+        int b = belt_index(pos);
+        if(b >= 0) {
+            return b == selection ? 3 : 2;
         }
+        return bg[index(pos)];
     }
     void Hud::set_stack(const Vector2i pos, const ItemStack stack) {
-        item_stacks.erase(pos);
-        item_stacks.insert({pos, stack});
+        if(!inside(pos)) {
+            return;
+        }
+        optional<ItemStack> &s = item_stacks[index(pos)];
+        if(s && s->amount == stack.amount &&
+           s->type == stack.type && s->health == stack.health) {
+            return;
+        }
+        s = stack;
+        stack_version++;
     }
     void Hud::reset_stack(const Vector2i pos) {
-        item_stacks.erase(pos);
-    }
-    std::unordered_map<Vector2i, ItemStack, matrix_hash<Vector2i>> Hud::stacks() const {
-        if(!interactive) {
-            std::unordered_map<Vector2i, ItemStack, matrix_hash<Vector2i>>
-                    new_item_stacks(item_stacks);
-            for(int i = 0; i < belt_size; i++) {
-                auto stack = belt[i];
-                Vector2i pos((columns - belt_size) / 2 + i, 0);
-                new_item_stacks.erase(pos);
-                if(stack) {
-                    new_item_stacks.insert({pos, *stack});
-                }
-            }
-            return new_item_stacks;
-        } else {
-            return item_stacks;
+        if(inside(pos) && item_stacks[index(pos)]) {
+            item_stacks[index(pos)] = nullopt;
+            stack_version++;
         }
     }
+    optional<ItemStack> Hud::stack(const Vector2i &pos) const {
+        int b = belt_index(pos);
+        if(b >= 0) {
+            return belt[b];
+        }
+        return item_stacks[index(pos)];
+    }
     void Hud::set_belt(const int pos, ItemStack stack) {
+        if(pos < 0 || pos >= belt_size) {
+            return;
+        }
         belt[pos] = stack;
+        stack_version++;
     }
     void Hud::reset_belt(const int pos) {
+        if(pos < 0 || pos >= belt_size) {
+            return;
+        }
         belt[pos] = nullopt;
+        stack_version++;
     }
     optional<ItemStack> Hud::selected() const {
         return belt[selection];
@@ -89,10 +106,12 @@ namespace konstructs {
             return selection;
         }
         selection -= direction;
+        bg_version++;
         return selection;
     }
     void Hud::set_selected(int s) {
         selection = s;
+        bg_version++;
         for(int i = 0; i < 9; i++) {
             Vector2i pos(i + 4, 0);
             if(i == selection) {
@@ -107,9 +126,41 @@ namespace konstructs {
         return selection;
     }
     void Hud::set_interactive(bool i) {
-        interactive = i;
+        if(interactive != i) {
+            interactive = i;
+            bg_version++;
+            stack_version++;
+        }
     }
     bool Hud::get_interactive() const {
         return interactive;
     }
+    /* Rebuild all models, e.g. because block types changed */
+    void Hud::invalidate() {
+        bg_version++;
+        stack_version++;
+    }
+    uint32_t Hud::backgrounds_version() const {
+        return bg_version;
+    }
+    uint32_t Hud::stacks_version() const {
+        return stack_version;
+    }
+    bool Hud::inside(const Vector2i &pos) const {
+        return pos[0] >= 0 && pos[0] < columns && pos[1] >= 0 && pos[1] < rows;
+    }
+    int Hud::index(const Vector2i &pos) const {
+        if(!inside(pos)) {
+            throw std::out_of_range("Position outside of the HUD");
+        }
+        return pos[0] + pos[1] * columns;
+    }
+    /* The belt slot shown at a position, or -1 if the belt is hidden there */
+    int Hud::belt_index(const Vector2i &pos) const {
+        int i = pos[0] - (columns - belt_size) / 2;
+        if(interactive || pos[1] != 0 || i < 0 || i >= belt_size) {
+            return -1;
+        }
+        return i;
+    }
 };
@@ -1,4 +1,4 @@
-#include <string>
+#include <cstdio>
 #include <math.h>
 #include "matrix.h"
 #include "hud.h"
@@ -7,7 +7,6 @@
 
 namespace konstructs {
     using matrix::projection_2d;
-    using std::vector;
 
     Matrix4f hud_translation_matrix(const float scale, const float xscale,
                                     const float screen_area);
@@ -18,23 +17,26 @@ namespace konstructs {
                     float rx, float ry, float rz, float *d,
                     const BlockTypeInfo &blocks);
 
-    void make_stacks(const std::unordered_map<Vector2i, ItemStack, matrix_hash<Vector2i>> &stacks,
-                     float *d,
-                     const float rx,
-                     const float ry,
-                     const float rz,
-                     const BlockTypeInfo &blocks);
+    int make_stacks(const Hud &hud, float *d,
+                    const float rx,
+                    const float ry,
+                    const float rz,
+                    const BlockTypeInfo &blocks);
+
+    int count_amount_characters(const Hud &hud);
 
-    void make_stack_amounts(const std::unordered_map<Vector2i, ItemStack, matrix_hash<Vector2i>> &stacks, float *d);
+    int make_stack_amounts(const Hud &hud, float *d);
 
-    vector<float> make_square(const std::unordered_map<Vector2i, int, matrix_hash<Vector2i>> &background);
+    int make_square(const Hud &hud, float *d);
 
-    vector<float> make_health_bars(const std::unordered_map<Vector2i, ItemStack, matrix_hash<Vector2i>> &stacks);
+    int make_health_bars(const Hud &hud, float *d);
 
     BaseModel::BaseModel(const GLuint position_attr, const GLuint normal_attr,
                          const GLuint uv_attr) :
-        position_attr(position_attr), normal_attr(normal_attr),
-        uv_attr(uv_attr) {}
+        verts(0), position_attr(position_attr), normal_attr(normal_attr),
+        uv_attr(uv_attr), capacity(0) {
+        glGenBuffers(1, &buffer);
+    }
 
     void BaseModel::bind() {
         glBindBuffer(GL_ARRAY_BUFFER, buffer);
@@ -53,101 +55,76 @@ namespace konstructs {
         return verts;
     }
 
-    ItemStackModel::ItemStackModel(const GLuint position_attr, const GLuint normal_attr,
-                                   const GLuint uv_attr,
-                                   const std::unordered_map<Vector2i, ItemStack, matrix_hash<Vector2i>> &stacks,
-                                   const BlockTypeInfo &blocks) :
-        BaseModel(position_attr, normal_attr, uv_attr) {
-
-        verts = 0;
-        for (const auto &pair: stacks) {
-            if(blocks.is_plant[pair.second.type]) {
-                verts += 6;
-            } else {
-                verts += (6 * 6);
-            }
+    /* Scratch memory for at least the given number of vertices, it is
+     * kept between updates so that it is only allocated once */
+    float *BaseModel::reserve(const int vertices) {
+        if(scratch.size() < (size_t)vertices * 10) {
+            scratch.resize(vertices * 10);
         }
+        return scratch.data();
+    }
 
-        float *data = new float[verts * 10];
-        make_stacks(stacks, data, - M_PI / 8, M_PI / 8, 0, blocks);
-
-        glGenBuffers(1, &buffer);
+    /* Replace the vertices of the model, reusing its buffer if they fit */
+    void BaseModel::upload(const float *data, const int vertices) {
+        verts = vertices;
+        const size_t size = vertices * 10 * sizeof(GLfloat);
+        if(size == 0) {
+            return;
+        }
         glBindBuffer(GL_ARRAY_BUFFER, buffer);
-        glBufferData(GL_ARRAY_BUFFER, verts * 10 * sizeof(GLfloat),
-                     data, GL_STATIC_DRAW);
-        delete[] data;
+        if(size > capacity) {
+            glBufferData(GL_ARRAY_BUFFER, size, data, GL_DYNAMIC_DRAW);
+            capacity = size;
+        } else {
+            glBufferSubData(GL_ARRAY_BUFFER, 0, size, data);
+        }
     }
 
-    AmountModel::AmountModel(const GLuint position_attr, const GLuint normal_attr,
-                             const GLuint uv_attr,
-                             const std::unordered_map<Vector2i, ItemStack, matrix_hash<Vector2i>> &stacks):
-        BaseModel(position_attr, normal_attr, uv_attr) {
-        int total_text_length = 0;
-        for (const auto &pair: stacks) {
-            if(pair.second.amount == 0) {
-                continue;
-            }
-            if(pair.second.amount > 9) {
-                total_text_length += 2;
-            } else {
-                total_text_length ++;
-            }
-        }
-        float *data = new float[total_text_length * 10 * 6];
+    ItemStackModel::ItemStackModel(const GLuint position_attr, const GLuint normal_attr,
+                                   const GLuint uv_attr) :
+        BaseModel(position_attr, normal_attr, uv_attr) {}
 
-        make_stack_amounts(stacks, data);
+    void ItemStackModel::update(const Hud &hud, const BlockTypeInfo &blocks) {
+        float *data = reserve(hud.columns * hud.rows * 6 * 6);
+        upload(data, make_stacks(hud, data, - M_PI / 8, M_PI / 8, 0, blocks));
+    }
 
-        glGenBuffers(1, &buffer);
-        glBindBuffer(GL_ARRAY_BUFFER, buffer);
-        glBufferData(GL_ARRAY_BUFFER, total_text_length * 10 * 6 * sizeof(GLfloat),
-                     data, GL_STATIC_DRAW);
-        verts = total_text_length * 6;
-        delete[] data;
+    AmountModel::AmountModel(const GLuint position_attr, const GLuint normal_attr,
+                             const GLuint uv_attr):
+        BaseModel(position_attr, normal_attr, uv_attr) {}
+
+    void AmountModel::update(const Hud &hud) {
+        float *data = reserve(count_amount_characters(hud) * 6);
+        upload(data, make_stack_amounts(hud, data));
     }
 
-    HudModel::HudModel(const std::unordered_map<Vector2i, int, matrix_hash<Vector2i>> &background,
-                       const GLuint position_attr, const GLuint normal_attr,
+    HudModel::HudModel(const GLuint position_attr, const GLuint normal_attr,
                        const GLuint uv_attr) :
-        BaseModel(position_attr, normal_attr, uv_attr) {
-
-        auto data = make_square(background);
+        BaseModel(position_attr, normal_attr, uv_attr) {}
 
-        glGenBuffers(1, &buffer);
-        glBindBuffer(GL_ARRAY_BUFFER, buffer);
-        glBufferData(GL_ARRAY_BUFFER, data.size() * sizeof(GLfloat),
-                     data.data(), GL_STATIC_DRAW);
-        verts = data.size() / 10;
+    void HudModel::update(const Hud &hud) {
+        float *data = reserve(hud.columns * hud.rows * 6);
+        upload(data, make_square(hud, data));
     }
 
-    HealthBarModel::HealthBarModel(const std::unordered_map<Vector2i, ItemStack, matrix_hash<Vector2i>> &stacks,
-                                   const GLuint position_attr, const GLuint normal_attr,
+    HealthBarModel::HealthBarModel(const GLuint position_attr, const GLuint normal_attr,
                                    const GLuint uv_attr) :
-        BaseModel(position_attr, normal_attr, uv_attr) {
-
-        auto data = make_health_bars(stacks);
+        BaseModel(position_attr, normal_attr, uv_attr) {}
 
-        glGenBuffers(1, &buffer);
-        glBindBuffer(GL_ARRAY_BUFFER, buffer);
-        glBufferData(GL_ARRAY_BUFFER, data.size() * sizeof(GLfloat),
-                     data.data(), GL_STATIC_DRAW);
-        verts = data.size() / 10;
+    void HealthBarModel::update(const Hud &hud) {
+        float *data = reserve(hud.columns * hud.rows * 6);
+        upload(data, make_health_bars(hud, data));
     }
 
     BlockModel::BlockModel(const GLuint position_attr, const GLuint normal_attr,
-                           const GLuint uv_attr,
-                           const int type, const float x, const float y,
-                           const float size,
-                           const BlockTypeInfo &blocks) :
-        BaseModel(position_attr, normal_attr, uv_attr) {
-        verts = blocks.is_plant[type] ? 6 : 6 * 6;
-        float *data = new float[verts * 10];
-        make_block(type, x, y, 0.0, size, - M_PI / 8, M_PI / 8, M_PI / 32, data, blocks);
-
-        glGenBuffers(1, &buffer);
-        glBindBuffer(GL_ARRAY_BUFFER, buffer);
-        glBufferData(GL_ARRAY_BUFFER, verts * 10 * sizeof(GLfloat),
-                     data, GL_STATIC_DRAW);
-        delete[] data;
+                           const GLuint uv_attr) :
+        BaseModel(position_attr, normal_attr, uv_attr) {}
+
+    void BlockModel::update(const int type, const float size,
+                            const BlockTypeInfo &blocks) {
+        float *data = reserve(6 * 6);
+        make_block(type, 0.0, 0.0, 0.0, size, - M_PI / 8, M_PI / 8, M_PI / 32, data, blocks);
+        upload(data, blocks.is_plant(type) ? 6 : 6 * 6);
     }
 
     HudShader::HudShader(const int columns, const int rows, const GLuint texture,
@@ -225,7 +202,16 @@ namespace konstructs {
         health_bar_texture(health_bar_texture),
         columns(columns),
         rows(rows),
-        screen_area(0.6) {}
+        screen_area(0.6),
+        background_model(position, normal, uv),
+        stack_model(position, normal, uv),
+        health_bar_model(position, normal, uv),
+        amount_model(position, normal, uv),
+        held_model(position, normal, uv),
+        backgrounds_version(0),
+        stacks_version(0),
+        held_type(-1),
+        held_size(0) {}
 
     optional<Vector2i> HudShader::clicked_at(const double x, const double y,
             const int width, const int height) {
@@ -265,11 +251,21 @@ namespace konstructs {
             /* Use background texture*/
             c.set(sampler, texture);
 
-            /* Generate and draw background model */
+            /* Only rebuild the models whose part of the HUD changed */
+            if(hud.backgrounds_version() != backgrounds_version) {
+                background_model.update(hud);
+                backgrounds_version = hud.backgrounds_version();
+            }
+            if(hud.stacks_version() != stacks_version) {
+                stack_model.update(hud, blocks);
+                health_bar_model.update(hud);
+                amount_model.update(hud);
+                stacks_version = hud.stacks_version();
+            }
 
-            HudModel hm(hud.backgrounds(), position, normal, uv);
+            /* Draw background model */
             c.enable(GL_BLEND);
-            c.draw(hm);
+            c.draw(background_model);
             c.disable(GL_BLEND);
 
             c.enable(GL_DEPTH_TEST);
@@ -277,9 +273,8 @@ namespace konstructs {
 
             /* Use block texture */
             c.set(sampler, block_texture);
-            /* Generate and draw item stacks */
-            ItemStackModel ism(position, normal, uv, hud.stacks(), blocks);
-            c.draw(ism);
+            /* Draw item stacks */
+            c.draw(stack_model);
 
             /* Check for held block*/
             auto held = hud.held();
@@ -293,16 +288,21 @@ namespace konstructs {
                 Matrix4f m = Matrix4f::Identity();
                 /* This scales items drawn so that they are kept "square" */
                 m(0) = xscale;
-                Vector4f v = Vector4f::Zero();
+                /* The block is moved to the mouse by the offset */
+                Vector4f v(x, y, 0.0f, 0.0f);
                 c.set(matrix, m);
                 c.set(offset, v);
                 /* Use block textures */
                 c.set(sampler, block_texture);
-                /* Generate a single block model */
-                BlockModel bm(position, normal, uv, held->type, x / xscale, y,
-                              scale * xscale * screen_area * 0.55, blocks);
+                /* The held block model is only rebuilt when it changes */
+                float size = scale * xscale * screen_area * 0.55;
+                if(held->type != held_type || size != held_size) {
+                    held_model.update(held->type, size, blocks);
+                    held_type = held->type;
+                    held_size = size;
+                }
                 glClear(GL_DEPTH_BUFFER_BIT);
-                c.draw(bm);
+                c.draw(held_model);
             }
             c.disable(GL_CULL_FACE);
             c.disable(GL_DEPTH_TEST);
@@ -315,17 +315,15 @@ namespace konstructs {
             /* Use health bar texture */
             c.set(sampler, health_bar_texture);
 
-            /* Generate and draw health bars */
-            HealthBarModel hbm(hud.stacks(), position, normal, uv);
-            c.draw(hbm);
+            /* Draw health bars */
+            c.draw(health_bar_model);
 
             /* Use font texture */
             c.set(sampler, font_texture);
 
-            /* Generate and draw item stack amounts */
-            AmountModel am(position, normal, uv, hud.stacks());
+            /* Draw item stack amounts */
             c.enable(GL_BLEND);
-            c.draw(am);
+            c.draw(amount_model);
             c.disable(GL_BLEND);
 
         });
@@ -345,146 +343,139 @@ namespace konstructs {
         return Vector4f(-2*xscale*screen_area, -1.0f, 0.0f, 0.0f);
     }
 
-    vector<float> make_square(const std::unordered_map<Vector2i, int, matrix_hash<Vector2i>> &background) {
-        vector<float> m;
+    /* Write a vertex of a flat HUD quad, returns where the next one goes */
+    float *make_hud_vertex(float *d, const float x, const float y,
+                           const float u, const float v) {
+        d[0] = x; d[1] = y; d[2] = 0.0f;
+        d[3] = 0.0f; d[4] = 1.0f; d[5] = 0.0f;
+        d[6] = u; d[7] = v;
+        d[8] = 0.0f; d[9] = 0.0f;
+        return d + 10;
+    }
+
+    /* Write the two triangles of a quad from (x0, y0) to (x1, y1) */
+    float *make_hud_quad(float *d, const float x0, const float y0,
+                         const float x1, const float y1,
+                         const float u0, const float u1) {
+        d = make_hud_vertex(d, x0, y1, u0, 1.0f);
+        d = make_hud_vertex(d, x1, y1, u1, 1.0f);
+        d = make_hud_vertex(d, x0, y0, u0, 0.0f);
+        d = make_hud_vertex(d, x0, y0, u0, 0.0f);
+        d = make_hud_vertex(d, x1, y1, u1, 1.0f);
+        d = make_hud_vertex(d, x1, y0, u1, 0.0f);
+        return d;
+    }
+
+    int make_square(const Hud &hud, float *d) {
+        int vertices = 0;
         float ts = 0.25;
-        for(auto pair: background) {
-            int i = pair.first[0];
-            int j = pair.first[1];
-            int t = pair.second;
-            if(t >= 0) {
-                m.push_back(-0.0f+i); m.push_back(1.0f+j); m.push_back(0.0f);
-                m.push_back(0.0f); m.push_back(1.0f); m.push_back(0.0f);
-                m.push_back(t*ts); m.push_back(1.0f);
-                m.push_back(0.0f); m.push_back(0.0f);
-
-                m.push_back(1.0f+i);  m.push_back(1.0f+j);  m.push_back(0.0f);
-                m.push_back(0.0f); m.push_back(1.0f); m.push_back(0.0f);
-                m.push_back(t*ts + ts); m.push_back(1.0f);
-                m.push_back(0.0f); m.push_back(0.0f);
-
-                m.push_back(-0.0f+i); m.push_back(-0.0f+j);  m.push_back(0.0f);
-                m.push_back(0.0f); m.push_back(1.0f); m.push_back(0.0f);
-                m.push_back(t*ts); m.push_back(0.0f);
-                m.push_back(0.0f); m.push_back(0.0f);
-
-                m.push_back(-0.0f+i); m.push_back(-0.0f+j);  m.push_back(0.0f);
-                m.push_back(0.0f); m.push_back(1.0f); m.push_back(0.0f);
-                m.push_back(t*ts); m.push_back(0.0f);
-                m.push_back(0.0f); m.push_back(0.0f);
-
-                m.push_back(1.0f+i);  m.push_back(1.0f+j);  m.push_back(0.0f);
-                m.push_back(0.0f); m.push_back(1.0f); m.push_back(0.0f);
-                m.push_back(t*ts + ts); m.push_back(1.0f);
-                m.push_back(0.0f); m.push_back(0.0f);
-
-                m.push_back(1.0f+i); m.push_back(-0.0f+j);  m.push_back(0.0f);
-                m.push_back(0.0f); m.push_back(1.0f); m.push_back(0.0f);
-                m.push_back(t*ts + ts); m.push_back(0.0f);
-                m.push_back(0.0f); m.push_back(0.0f);
+        for(int j = 0; j < hud.rows; j++) {
+            for(int i = 0; i < hud.columns; i++) {
+                int t = hud.background(Vector2i(i, j));
+                if(t >= 0) {
+                    d = make_hud_quad(d, i, j, 1.0f + i, 1.0f + j, t*ts, t*ts + ts);
+                    vertices += 6;
+                }
             }
         }
-        return m;
+        return vertices;
     }
 
     void make_block(int type, float x, float y, float z, float size,
                     float rx, float ry, float rz, float *d,
                     const BlockTypeInfo &blocks) {
         char ao[6][4] = {0};
-        if(blocks.is_plant[type]) {
+        if(blocks.is_plant(type)) {
             make_rotated_cube(d, ao,
                               0, 0, 0, 0, 0, 1,
                               x, y, z, size, 0, 0, 0,
-                              type, blocks.blocks);
+                              type, blocks.types);
         } else {
             make_rotated_cube(d, ao,
                               1, 1, 1, 1, 1, 1,
                               x, y, z, size, rx, ry, rz,
-                              type, blocks.blocks);
+                              type, blocks.types);
         }
     }
 
-    void make_stacks(const std::unordered_map<Vector2i, ItemStack, matrix_hash<Vector2i>> &stacks,
-                     float *d,
-                     const float rx,
-                     const float ry,
-                     const float rz,
-                     const BlockTypeInfo &blocks) {
-
-        int offset = 0;
-        for (const auto &pair: stacks) {
-            make_block(pair.second.type, pair.first[0] + 0.5, pair.first[1] + 0.45, 0, 0.3,
-                       rx, ry, rz, d + offset, blocks);
-            offset += blocks.is_plant[pair.second.type] ? 10 * 6 : 10 * 6 * 6;
+    int make_stacks(const Hud &hud, float *d,
+                    const float rx,
+                    const float ry,
+                    const float rz,
+                    const BlockTypeInfo &blocks) {
+
+        int vertices = 0;
+        for(int j = 0; j < hud.rows; j++) {
+            for(int i = 0; i < hud.columns; i++) {
+                auto stack = hud.stack(Vector2i(i, j));
+                if(!stack) {
+                    continue;
+                }
+                make_block(stack->type, i + 0.5, j + 0.45, 0, 0.3,
+                           rx, ry, rz, d + vertices * 10, blocks);
+                vertices += blocks.is_plant(stack->type) ? 6 : 6 * 6;
+            }
         }
+        return vertices;
     }
 
-    vector<float> make_health_bars(const std::unordered_map<Vector2i, ItemStack, matrix_hash<Vector2i>> &stacks) {
-
-        vector<float> m;
+    int make_health_bars(const Hud &hud, float *d) {
+        int vertices = 0;
         float ts = 0.125f;
-        for (const auto &pair: stacks) {
-            if(pair.second.amount == 0) {
-                continue;
+        float offset = 0.11f;
+        float bar_bottom = 0.1f;
+        float bar_height = bar_bottom + 0.06f;
+        for(int j = 0; j < hud.rows; j++) {
+            for(int i = 0; i < hud.columns; i++) {
+                auto stack = hud.stack(Vector2i(i, j));
+                if(!stack || stack->amount == 0) {
+                    continue;
+                }
+                float h = (float)stack->health / (float)(MAX_HEALTH + 1);
+                int t = (int)(h * 8.0f);
+                float health = h * (1.0f - offset * 2.0f);
+                d = make_hud_quad(d, offset + i, bar_bottom + j,
+                                  offset + health + i, bar_height + j,
+                                  t*ts, t*ts + ts);
+                vertices += 6;
             }
-            int i = pair.first[0];
-            int j = pair.first[1];
-            float offset = 0.11f;
-            float h = (float)pair.second.health / (float)(MAX_HEALTH + 1);
-            int t = (int)(h * 8.0f);
-            float health = h * (1.0f - offset * 2.0f);
-            float bar_bottom = 0.1f;
-            float bar_height = bar_bottom + 0.06f;
-
-            m.push_back(offset+i); m.push_back(bar_height+j); m.push_back(0.0f);
-            m.push_back(0.0f); m.push_back(1.0f); m.push_back(0.0f);
-            m.push_back(t*ts); m.push_back(1.0f);
-            m.push_back(0.0f); m.push_back(0.0f);
-
-            m.push_back(offset+health+i);  m.push_back(bar_height+j);  m.push_back(0.0f);
-            m.push_back(0.0f); m.push_back(1.0f); m.push_back(0.0f);
-            m.push_back(t*ts + ts); m.push_back(1.0f);
-            m.push_back(0.0f); m.push_back(0.0f);
-
-            m.push_back(offset+i); m.push_back(bar_bottom+j);  m.push_back(0.0f);
-            m.push_back(0.0f); m.push_back(1.0f); m.push_back(0.0f);
-            m.push_back(t*ts); m.push_back(0.0f);
-            m.push_back(0.0f); m.push_back(0.0f);
-
-            m.push_back(offset+i); m.push_back(bar_bottom+j);  m.push_back(0.0f);
-            m.push_back(0.0f); m.push_back(1.0f); m.push_back(0.0f);
-            m.push_back(t*ts); m.push_back(0.0f);
-            m.push_back(0.0f); m.push_back(0.0f);
-
-            m.push_back(offset+health+i);  m.push_back(bar_height+j);  m.push_back(0.0f);
-            m.push_back(0.0f); m.push_back(1.0f); m.push_back(0.0f);
-            m.push_back(t*ts + ts); m.push_back(1.0f);
-            m.push_back(0.0f); m.push_back(0.0f);
-
-            m.push_back(offset+health+i); m.push_back(bar_bottom+j);  m.push_back(0.0f);
-            m.push_back(0.0f); m.push_back(1.0f); m.push_back(0.0f);
-            m.push_back(t*ts + ts); m.push_back(0.0f);
-            m.push_back(0.0f); m.push_back(0.0f);
         }
-        return m;
+        return vertices;
     }
 
-    void make_stack_amounts(const std::unordered_map<Vector2i, ItemStack, matrix_hash<Vector2i>> &stacks,
-                            float *d) {
-        int i = 0;
-
-        for (const auto &pair: stacks) {
-            if(pair.second.amount == 0) {
-                continue;
+    int count_amount_characters(const Hud &hud) {
+        int characters = 0;
+        for(int j = 0; j < hud.rows; j++) {
+            for(int i = 0; i < hud.columns; i++) {
+                auto stack = hud.stack(Vector2i(i, j));
+                if(stack && stack->amount > 0) {
+                    char text[16];
+                    characters += snprintf(text, sizeof(text), "%u", stack->amount);
+                }
             }
-            std::string text = std::to_string(pair.second.amount);
-            for (int index = 0; index < text.length(); index++) {
-                int offset = text.length() - index - 1;
-                make_character(d + i * 10 * 6, pair.first[0] - (float)offset*0.2 + 0.75f, pair.first[1] + 0.25f, 0.1, 0.2, text[index],
-                               0.0);
-                i++;
+        }
+        return characters;
+    }
+
+    int make_stack_amounts(const Hud &hud, float *d) {
+        int characters = 0;
+        for(int j = 0; j < hud.rows; j++) {
+            for(int i = 0; i < hud.columns; i++) {
+                auto stack = hud.stack(Vector2i(i, j));
+                if(!stack || stack->amount == 0) {
+                    continue;
+                }
+                char text[16];
+                int length = snprintf(text, sizeof(text), "%u", stack->amount);
+                for (int index = 0; index < length; index++) {
+                    int offset = length - index - 1;
+                    make_character(d + characters * 10 * 6, i - (float)offset*0.2 + 0.75f, j + 0.25f,
+                                   0.1, 0.2, text[index], 0.0);
+                    characters++;
+                }
             }
         }
+        return characters * 6;
     }
 
 };
@@ -0,0 +1,81 @@
+#include "model_cache.h"
+#include "chunk_factory.h"
+
+namespace konstructs {
+
+    bool ModelKey::operator==(const ModelKey &other) const {
+        if(position != other.position || lod != other.lod || missing != other.missing) {
+            return false;
+        }
+        for(int i = 0; i < MODEL_INPUT_CHUNKS; i++) {
+            if(revisions[i] != other.revisions[i]) {
+                return false;
+            }
+        }
+        return true;
+    }
+
+    std::size_t model_key_hash::operator()(const ModelKey &key) const {
+        size_t seed = matrix_hash<Vector3i>()(key.position);
+        auto combine = [&](const uint32_t v) {
+            seed ^= std::hash<uint32_t>()(v) + 0x9e3779b9 + (seed << 6) + (seed >> 2);
+        };
+        combine(key.lod);
+        combine(key.missing);
+        for(int i = 0; i < MODEL_INPUT_CHUNKS; i++) {
+            combine(key.revisions[i]);
+        }
+        return seed;
+    }
+
+    static size_t model_size(const shared_ptr<ChunkModelResult> &model) {
+        return sizeof(ChunkModelResult) + model->size * sizeof(GLuint);
+    }
+
+    ModelCache::ModelCache(const size_t max_size) :
+        max_size(max_size), size(0), hit_count(0) {}
+
+    shared_ptr<ChunkModelResult> ModelCache::get(const ModelKey &key) {
+        std::lock_guard<std::mutex> lock(mutex);
+        auto it = index.find(key);
+        if(it == index.end()) {
+            return nullptr;
+        }
+        /* Move the entry first, it is now the most recently used */
+        entries.splice(entries.begin(), entries, it->second);
+        hit_count++;
+        return it->second->second;
+    }
+
+    void ModelCache::put(const ModelKey &key, const shared_ptr<ChunkModelResult> &model) {
+        std::lock_guard<std::mutex> lock(mutex);
+        auto it = index.find(key);
+        if(it != index.end()) {
+            size -= model_size(it->second->second);
+            entries.erase(it->second);
+            index.erase(it);
+        }
+        entries.push_front({key, model});
+        index.insert({key, entries.begin()});
+        size += model_size(model);
+        /* Evict the least recently used models */
+        while(size > max_size && !entries.empty()) {
+            auto &last = entries.back();
+            size -= model_size(last.second);
+            index.erase(last.first);
+            entries.pop_back();
+        }
+    }
+
+    void ModelCache::clear() {
+        std::lock_guard<std::mutex> lock(mutex);
+        entries.clear();
+        index.clear();
+        size = 0;
+    }
+
+    int ModelCache::hits() {
+        std::lock_guard<std::mutex> lock(mutex);
+        return hit_count;
+    }
+};
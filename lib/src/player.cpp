@@ -10,14 +10,21 @@ namespace konstructs {
 
     static float CAMERA_OFFSET = 0.5f;
     static Vector3f CAMERA_OFFSET_VECTOR = Vector3f(0, CAMERA_OFFSET, 0);
+    /* Length of a physics tick in seconds */
+    static float PHYSICS_TICK = 1.0f / 120.0f;
+    /* Ticks run at most for one update, the rest of the time is dropped */
+    static int MAX_PHYSICS_TICKS = 30;
+    /* Distance at which the player touches a block without entering it */
+    static float COLLISION_EPSILON = 0.001f;
 
-    static bool block_is_obstacle(const optional<BlockData> &block, const BlockTypeInfo &blocks) {
-        return block && blocks.is_obstacle[(*block).type];
+    static bool block_is_obstacle(const optional<uint16_t> &type, const BlockTypeInfo &blocks) {
+        return type && blocks.is_obstacle(*type);
     }
 
     Player::Player(const int id, const Vector3f position, const float rx,
                    const float ry):
-        id(id), position(position), mrx(rx), mry(ry), flying(false), dy(0) {}
+        id(id), position(position), mrx(rx), mry(ry), flying(false), dy(0),
+        simulated(position), last_simulated(position), accumulator(0) {}
 
     Matrix4f Player::direction() const {
         return (Affine3f(AngleAxisf(mrx, Vector3f::UnitX())) *
@@ -48,17 +55,18 @@ namespace konstructs {
     }
 
     Vector3i Player::feet() const {
-        return Vector3i(roundf(position[0]), roundf(position[1]) - 1, roundf(position[2]));
+        return Vector3i(roundf(simulated[0]), roundf(simulated[1]) - 1, roundf(simulated[2]));
     }
 
     bool Player::can_place(Vector3i block, const World &world, const BlockTypeInfo &blocks) {
+        WorldCursor cursor(world);
         Vector3i f = feet();
         /* Are we trying to place blocks on ourselves? */
         if(block(0) == f(0) && block(2) == f(2) && block(1) >= f(1) && block(1) < f(1) + 2) {
             /* We may place on our feet under certain circumstances */
             if(f(1) == block(1)) {
                 /* Allow placing on our feet if the block above our head is not an obstacle*/
-                return !block_is_obstacle(world.get_block(Vector3i(f(0), f(1) + 2, f(2))), blocks);
+                return !block_is_obstacle(cursor.get_type(Vector3i(f(0), f(1) + 2, f(2))), blocks);
             } else {
                 /* We are never allowed to place on our head */
                 return false;
@@ -67,117 +75,140 @@ namespace konstructs {
         return true;
     }
 
+    /**
+     * Advance the physics in fixed ticks of PHYSICS_TICK seconds. Time
+     * that does not add up to a whole tick is kept for the next call,
+     * and the rendered position is interpolated between the last two
+     * ticks by how far into the next tick we are.
+     */
     Vector3f Player::update_position(int sz, int sx, float dt,
                                      const World &world, const BlockTypeInfo &blocks,
                                      const float near_distance, const bool jump,
                                      const bool sneaking) {
-        optional<ChunkData> chunk_opt = world.chunk_by_block(position);
-
-        if(chunk_opt) { // Only update position if the chunk we are in is loaded
-            float vx = 0, vy = 0, vz = 0;
-            if (!sz && !sx) { // Not mowing in X or Z
-                vx = 0;
-                vz = 0;
-            } else { // Moving in X or Z
-
-
-                float strafe = atan2f(sz, sx);
-
-                if (flying) {
-                    float m = cosf(mrx);
-                    float y = sinf(mrx);
-                    if (sx) {
-                        if (!sz) {
-                            y = 0;
-                        }
-                        m = 1;
-                    }
-                    if (sz < 0) {
-                        y = -y;
-                    }
-                    vx = cosf(mry + strafe) * m;
-                    vy = y;
-                    vz = sinf(mry + strafe) * m;
-                } else {
-                    vx = cosf(mry + strafe);
-                    vy = 0;
-                    vz = sinf(mry + strafe);
-                }
-            }
+        // Only update position if the chunk we are in is loaded
+        if(world.find(chunked_vec(simulated)) == world.end()) {
+            accumulator = 0;
+            last_simulated = simulated;
+            position = simulated;
+            return simulated;
+        }
+
+        // All ticks read blocks close to the player
+        WorldCursor cursor(world);
+        accumulator += dt;
+        int ticks = 0;
+        while(accumulator >= PHYSICS_TICK && ticks < MAX_PHYSICS_TICKS) {
+            last_simulated = simulated;
+            tick(sz, sx, cursor, blocks, near_distance, jump, sneaking);
+            accumulator -= PHYSICS_TICK;
+            ticks++;
+        }
+        // Drop time we could not keep up with instead of catching up later
+        accumulator = std::min(accumulator, PHYSICS_TICK);
 
-            if(jump) {
-                if(flying) {
-                    // Jump in flight moves upward at constant speed
-                    vy = 1;
-                } else if(dy == 0) {
-                    // Jump when walking changes the acceleration upwards to 8
-                    dy = 8;
-                } else {
-                    // Get middle of block
-                    Vector3i iPos((int)(position[0] + 0.5f), (int)(position[1]), (int)(position[2] + 0.5f));
-                    auto chunk = world.chunk_by_block(iPos);
-
-                    if(chunk && blocks.state[chunk->get(iPos).type] == STATE_LIQUID) {
-                        dy = 5.5;
+        float alpha = accumulator / PHYSICS_TICK;
+        position = last_simulated + (simulated - last_simulated) * alpha;
+        return simulated;
+    }
+
+    /* Advance the physics by one tick */
+    void Player::tick(int sz, int sx, WorldCursor &cursor, const BlockTypeInfo &blocks,
+                      const float near_distance, const bool jump, const bool sneaking) {
+        float vx = 0, vy = 0, vz = 0;
+        if (!sz && !sx) { // Not mowing in X or Z
+            vx = 0;
+            vz = 0;
+        } else { // Moving in X or Z
+
+
+            float strafe = atan2f(sz, sx);
+
+            if (flying) {
+                float m = cosf(mrx);
+                float y = sinf(mrx);
+                if (sx) {
+                    if (!sz) {
+                        y = 0;
                     }
+                    m = 1;
+                }
+                if (sz < 0) {
+                    y = -y;
                 }
+                vx = cosf(mry + strafe) * m;
+                vy = y;
+                vz = sinf(mry + strafe) * m;
+            } else {
+                vx = cosf(mry + strafe);
+                vy = 0;
+                vz = sinf(mry + strafe);
             }
+        }
 
-            float speed = flying ? 20 : 5;
-            int estimate =
-                roundf(sqrtf(powf(vx * speed, 2) +
-                             powf(vy * speed + std::abs(dy) * 2, 2) +
-                             powf(vz * speed, 2)) * dt * 8);
-            int step = std::max(8, estimate);
-            float ut = dt / step;
-            vx = vx * ut * speed;
-            vy = vy * ut * speed;
-            vz = vz * ut * speed;
-            for (int i = 0; i < step; i++) {
-                if (flying) {
-                    // When flying upwards acceleration is constant i.e. not falling
-                    dy = 0;
-                } else {
-                    // Calculate "gravity" by decreasing upwards acceleration
-                    dy -= ut * 25;
-                    dy = std::max(dy, -250.0f);
-                }
-                position += Vector3f(vx, vy + dy * ut, vz);
-                if (collide(world, blocks, near_distance, sneaking)) {
-                    dy = 0;
+        if(jump) {
+            if(flying) {
+                // Jump in flight moves upward at constant speed
+                vy = 1;
+            } else if(dy == 0) {
+                // Jump when walking changes the acceleration upwards to 8
+                dy = 8;
+            } else {
+                // Get middle of block
+                Vector3i iPos((int)(simulated[0] + 0.5f), (int)(simulated[1]), (int)(simulated[2] + 0.5f));
+                auto type = cursor.get_type(iPos);
+
+                if(type && blocks.state(*type) == STATE_LIQUID) {
+                    dy = 5.5;
                 }
             }
-            if (position[1] < 0) {
-                position[1] = 2;
-            }
         }
-        return position;
+
+        if (flying) {
+            // When flying upwards acceleration is constant i.e. not falling
+            dy = 0;
+        } else {
+            // Calculate "gravity" by decreasing upwards acceleration
+            dy -= PHYSICS_TICK * 25;
+            dy = std::max(dy, -250.0f);
+        }
+
+        float speed = flying ? 20 : 5;
+        Vector3f delta(vx * speed, vy * speed + dy, vz * speed);
+        delta *= PHYSICS_TICK;
+        if (collide(cursor, blocks, delta, near_distance, sneaking)) {
+            dy = 0;
+        }
+        if (simulated[1] < 0) {
+            simulated[1] = 2;
+        }
     }
 
+    /**
+     * Find the closest block within 8 blocks that the camera is
+     * pointing at, together with the block in front of it.
+     */
     optional<pair<Block, Block>> Player::looking_at(const World &world,
     const BlockTypeInfo &blocks) const {
-        optional<pair<Block, Block>> block(nullopt);
-        float best = 0;
+        const int m = 4;
+        const float max_distance = 8.0f;
         const Vector3f v = camera_direction();
-        const Vector3f camera_position = camera();
-        int p = chunked(camera_position[0]);
-        int q = chunked(camera_position[2]);
-        int k = chunked(camera_position[1]);
-        const auto &atAndAround = world.atAndAround({p, q, k});
-        for (const auto &chunk: atAndAround) {
-            const auto &seen = chunk.get(camera_position, v, 8.0f, blocks);
-            if (seen) {
-                auto h = seen->second;
-                float d = sqrtf(powf(h.position[0] - camera_position[0], 2) +
-                                powf(h.position[1] - camera_position[1], 2) +
-                                powf(h.position[2] - camera_position[2], 2));
-                if (best == 0 || d < best) {
-                    best = d;
-                    block = seen;
+        Vector3f pos = camera();
+        WorldCursor cursor(world);
+        Vector3i blockPos(roundf(pos[0]), roundf(pos[1]), roundf(pos[2]));
+        for (int i = 0; i < max_distance * m; i++) {
+            const Vector3i nBlockPos(roundf(pos[0]), roundf(pos[1]), roundf(pos[2]));
+            if (nBlockPos != blockPos) {
+                const auto type = cursor.get_type(nBlockPos);
+                if (type && (blocks.is_obstacle(*type) || blocks.is_plant(*type))) {
+                    BlockData data = *cursor.get_block(nBlockPos);
+                    return optional<pair<Block, Block>>(pair<Block, Block>(Block(blockPos, data),
+                                                        Block(nBlockPos, data)));
                 }
+                blockPos = nBlockPos;
             }
+            pos += (v / m);
         }
-        return block;
+        return nullopt;
     }
 
     void Player::rotate_x(float speed) {
@@ -208,70 +239,112 @@ namespace konstructs {
         return mry;
     }
 
-    int Player::collide(const World &world, const BlockTypeInfo &blocks,
-                        const float near_distance, const bool sneaking) {
-        int result = 0;
-        float x = position[0];
-        float y = position[1];
-        float z = position[2];
-        int height = 2;
-        int p = chunked(x);
-        int q = chunked(z);
-        int k = chunked(y);
-        int nx = roundf(x);
-        int ny = roundf(y);
-        int nz = roundf(z);
-        float px = x - nx;
-        float py = y - ny;
-        float pz = z - nz;
-        float pad = near_distance * 2;
-
-        try {
+    /* Voxels that overlap the open interval (from, to) along one axis,
+     * blocks are centered on integer positions */
+    static void overlapping(const float from, const float to, int &first, int &last) {
+        first = (int)floorf(from + COLLISION_EPSILON - 0.5f) + 1;
+        last = (int)ceilf(to - COLLISION_EPSILON + 0.5f) - 1;
+    }
 
-            if (block_is_obstacle(world.get_block(feet()), blocks)) {
-                position[1] += 1.0f;
-                return 1;
+    /* Check if any obstacle is in the given range of voxels */
+    static bool obstacle_in(WorldCursor &cursor, const BlockTypeInfo &blocks,
+                            const Vector3i &first, const Vector3i &last) {
+        for(int x = first[0]; x <= last[0]; x++) {
+            for(int y = first[1]; y <= last[1]; y++) {
+                for(int z = first[2]; z <= last[2]; z++) {
+                    if(block_is_obstacle(cursor.get_type(Vector3i(x, y, z)), blocks)) {
+                        return true;
+                    }
+                }
             }
+        }
+        return false;
+    }
 
-            if(sneaking) {
-                if (px < -pad && !block_is_obstacle(world.get_block(Vector3i(nx - 1, ny - 2, nz)), blocks)) {
-                    position[0] = nx - pad;
-                }
-                if (px > pad && !block_is_obstacle(world.get_block(Vector3i(nx + 1, ny - 2, nz)), blocks)) {
-                    position[0] = nx + pad;
-                }
-                if (pz < -pad && !block_is_obstacle(world.get_block(Vector3i(nx, ny - 2, nz - 1)), blocks)) {
-                    position[2] = nz - pad;
-                }
-                if (pz > pad && !block_is_obstacle(world.get_block(Vector3i(nx, ny - 2, nz + 1)), blocks)) {
-                    position[2] = nz + pad;
+    /**
+     * Move the box of the player along one axis, stopping at the first
+     * layer of voxels on the way that contains an obstacle. Returns
+     * true if the movement was stopped.
+     */
+    bool Player::sweep(WorldCursor &cursor, const BlockTypeInfo &blocks,
+                       const Vector3f &low, const Vector3f &high,
+                       const int axis, const float distance) {
+        if(distance == 0) {
+            return false;
+        }
+        Vector3f min = simulated + low;
+        Vector3f max = simulated + high;
+        /* Voxels the box covers along the other axes */
+        Vector3i first, last;
+        for(int i = 0; i < 3; i++) {
+            overlapping(min[i], max[i], first[i], last[i]);
+        }
+        if(distance > 0) {
+            /* Layers entered by the leading face of the box */
+            int start = (int)ceilf(max[axis] + 0.5f - COLLISION_EPSILON);
+            int end = (int)ceilf(max[axis] + distance + 0.5f) - 1;
+            for(int layer = start; layer <= end; layer++) {
+                first[axis] = last[axis] = layer;
+                if(obstacle_in(cursor, blocks, first, last)) {
+                    simulated[axis] = layer - 0.5f - high[axis];
+                    return true;
                 }
             }
-            for (int dy = 0; dy < height; dy++) {
-                if (px < -pad && block_is_obstacle(world.get_block(Vector3i(nx - 1, ny - dy, nz)), blocks)) {
-                    position[0] = nx - pad;
-                }
-                if (px > pad && block_is_obstacle(world.get_block(Vector3i(nx + 1, ny - dy, nz)), blocks)) {
-                    position[0] = nx + pad;
-                }
-                if (py < -pad && block_is_obstacle(world.get_block(Vector3i(nx, ny - dy - 1, nz)), blocks)) {
-                    position[1] = ny - pad;
-                    result = 1;
-                }
-                if (py > (pad - CAMERA_OFFSET) && block_is_obstacle(world.get_block(Vector3i(nx, ny - dy + 1, nz)), blocks)) {
-                    position[1] = ny + pad - CAMERA_OFFSET;
-                    result = 1;
-                }
-                if (pz < -pad && block_is_obstacle(world.get_block(Vector3i(nx, ny - dy, nz - 1)), blocks)) {
-                    position[2] = nz - pad;
-                }
-                if (pz > pad && block_is_obstacle(world.get_block(Vector3i(nx, ny - dy, nz + 1)), blocks)) {
-                    position[2] = nz + pad;
+        } else {
+            int start = (int)floorf(min[axis] - 0.5f + COLLISION_EPSILON);
+            int end = (int)floorf(min[axis] + distance - 0.5f) + 1;
+            for(int layer = start; layer >= end; layer--) {
+                first[axis] = last[axis] = layer;
+                if(obstacle_in(cursor, blocks, first, last)) {
+                    simulated[axis] = layer + 0.5f - low[axis];
+                    return true;
                 }
             }
-        } catch(std::out_of_range e) {
-            /* chunk was not loaded yet */
-            return result;
+        }
+        simulated[axis] += distance;
+        return false;
+    }
+
+    /* Check if there is an obstacle right below the box of the player */
+    bool Player::supported(WorldCursor &cursor, const BlockTypeInfo &blocks,
+                           const Vector3f &low, const Vector3f &high) {
+        Vector3f min = simulated + low;
+        Vector3f max = simulated + high;
+        Vector3i first, last;
+        overlapping(min[0], max[0], first[0], last[0]);
+        overlapping(min[2], max[2], first[2], last[2]);
+        first[1] = last[1] = (int)floorf(min[1] - 0.5f + COLLISION_EPSILON);
+        return obstacle_in(cursor, blocks, first, last);
+    }
+
+    /**
+     * Move the player by delta, resolving one axis at a time against
+     * all voxels the box passes through. Returns true if the vertical
+     * movement was stopped.
+     */
+    int Player::collide(WorldCursor &cursor, const BlockTypeInfo &blocks,
+                        const Vector3f &delta, const float near_distance,
+                        const bool sneaking) {
+        float pad = near_distance * 2;
+        /* The box of the player relative to its position */
+        const Vector3f low(pad - 0.5f, pad - 1.5f, pad - 0.5f);
+        const Vector3f high(0.5f - pad, pad + CAMERA_OFFSET, 0.5f - pad);
+
+        if (block_is_obstacle(cursor.get_type(feet()), blocks)) {
+            /* A block was placed where we stand */
+            simulated[1] += 1.0f;
+            return 1;
+        }
+
+        int result = sweep(cursor, blocks, low, high, 1, delta[1]);
+        const bool standing = result && delta[1] < 0;
+        for(int axis = 0; axis < 3; axis += 2) {
+            const float before = simulated[axis];
+            sweep(cursor, blocks, low, high, axis, delta[axis]);
+            /* Sneaking never walks off an edge */
+            if(sneaking && standing && !supported(cursor, blocks, low, high)) {
+                simulated[axis] = before;
+            }
         }
         return result;
     }
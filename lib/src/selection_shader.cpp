@@ -38,7 +38,7 @@ namespace konstructs {
     SelectionShader::SelectionShader(const float _fov,
                                      const float _near_distance, const float scale) :
         ShaderProgram(
-            "chunk",
+            "selection",
 #ifdef __EMSCRIPTEN__
             "uniform mat4 matrix;\n"
             "uniform mat4 translation;\n"
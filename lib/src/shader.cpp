@@ -1,5 +1,17 @@
 #include <string>
+#include <vector>
+#include <cstdio>
+#include <cstdint>
+#include <cstring>
 #include "shader.h"
+#include "util.h"
+
+/* Every cached program starts with this, followed by the key, the
+ * format and the length of the binary */
+#define PROGRAM_MAGIC "KSP1"
+#define PROGRAM_MAGIC_SIZE 4
+/* Larger binaries are taken as a sign of a damaged file */
+#define PROGRAM_MAX_SIZE (64 * 1024 * 1024)
 
 namespace konstructs {
     GLuint creater_shader(const GLint type, const std::string &shader) {
@@ -32,25 +44,162 @@ namespace konstructs {
         return id;
     }
 
+    /* Programs can only be cached if the driver offers a binary format */
+    static bool program_binaries_supported() {
+#if defined(__EMSCRIPTEN__)
+        return false;
+#else
+#if defined(WIN32)
+        if(!glGetProgramBinary || !glProgramBinary) {
+            return false;
+        }
+#endif
+        GLint formats = 0;
+        glGetIntegerv(GL_NUM_PROGRAM_BINARY_FORMATS, &formats);
+        /* Older contexts do not know the query */
+        glGetError();
+        return formats > 0;
+#endif
+    }
+
+    static uint64_t hash_string(uint64_t hash, const char *str) {
+        /* FNV-1a, the terminator is included to separate strings */
+        do {
+            hash ^= (unsigned char)*str;
+            hash *= 0x100000001b3ULL;
+        } while(*str++);
+        return hash;
+    }
+
+    /* Binaries are only valid for the same sources and the same driver */
+    static uint64_t program_key(const std::string &vertex_shader,
+                                const std::string &fragment_shader) {
+        uint64_t hash = 0xcbf29ce484222325ULL;
+        hash = hash_string(hash, vertex_shader.c_str());
+        hash = hash_string(hash, fragment_shader.c_str());
+        const GLenum strings[3] = {GL_VENDOR, GL_RENDERER, GL_VERSION};
+        for(GLenum s : strings) {
+            const char *value = (const char *)glGetString(s);
+            hash = hash_string(hash, value ? value : "");
+        }
+        return hash;
+    }
+
+    static std::string program_path(const std::string &shader_name) {
+        std::string dir = data_directory();
+        if(dir.empty()) {
+            return "";
+        }
+        return dir + "/" + safe_file_name(shader_name) + ".program";
+    }
+
+    /* Load a cached binary into program, returns false if there is
+     * none or if the driver rejects it */
+    static bool load_program_binary(const GLuint program, const std::string &path,
+                                    const uint64_t key) {
+        FILE *file = fopen(path.c_str(), "rb");
+        if(!file) {
+            return false;
+        }
+        char magic[PROGRAM_MAGIC_SIZE];
+        uint64_t file_key;
+        uint32_t header[2];
+        std::vector<char> binary;
+        bool ok = fread(magic, 1, PROGRAM_MAGIC_SIZE, file) == PROGRAM_MAGIC_SIZE &&
+            memcmp(magic, PROGRAM_MAGIC, PROGRAM_MAGIC_SIZE) == 0 &&
+            fread(&file_key, sizeof(file_key), 1, file) == 1 &&
+            file_key == key &&
+            fread(header, sizeof(uint32_t), 2, file) == 2 &&
+            header[1] > 0 && header[1] <= PROGRAM_MAX_SIZE;
+        if(ok) {
+            binary.resize(header[1]);
+            ok = fread(binary.data(), 1, binary.size(), file) == binary.size();
+        }
+        fclose(file);
+        if(!ok) {
+            return false;
+        }
+#if defined(__EMSCRIPTEN__)
+        return false;
+#else
+        glProgramBinary(program, header[0], binary.data(), binary.size());
+        GLint status;
+        glGetProgramiv(program, GL_LINK_STATUS, &status);
+        return status == GL_TRUE;
+#endif
+    }
+
+    static void save_program_binary(const GLuint program, const std::string &path,
+                                    const uint64_t key) {
+#if defined(__EMSCRIPTEN__)
+        return;
+#else
+        GLint length = 0;
+        glGetProgramiv(program, GL_PROGRAM_BINARY_LENGTH, &length);
+        if(length <= 0) {
+            return;
+        }
+        std::vector<char> binary(length);
+        GLenum format;
+        glGetProgramBinary(program, length, &length, &format, binary.data());
+        std::string tmp_path = path + ".tmp";
+        FILE *file = fopen(tmp_path.c_str(), "wb");
+        if(!file) {
+            return;
+        }
+        uint32_t header[2] = {format, (uint32_t)length};
+        fwrite(PROGRAM_MAGIC, 1, PROGRAM_MAGIC_SIZE, file);
+        fwrite(&key, sizeof(key), 1, file);
+        fwrite(header, sizeof(uint32_t), 2, file);
+        fwrite(binary.data(), 1, length, file);
+        bool failed = ferror(file) != 0;
+        if(fclose(file) != 0 || failed) {
+            remove(tmp_path.c_str());
+            return;
+        }
+        /* Renaming onto an existing file fails on Windows */
+        remove(path.c_str());
+        if(rename(tmp_path.c_str(), path.c_str()) != 0) {
+            remove(tmp_path.c_str());
+        }
+#endif
+    }
+
     ShaderProgram::ShaderProgram(const std::string &shader_name,
                                  const std::string &vertex_shader,
                                  const std::string &fragment_shader,
                                  const GLenum _draw_mode):
         name(shader_name),
-        vertex(creater_shader(GL_VERTEX_SHADER, vertex_shader)),
-        fragment(creater_shader(GL_FRAGMENT_SHADER, fragment_shader)),
+        vertex(0),
+        fragment(0),
         program(glCreateProgram()),
         draw_mode(_draw_mode) {
-        glAttachShader(program, vertex);
-        glAttachShader(program, fragment);
-        glLinkProgram(program);
-        GLint status;
-        glGetProgramiv(program, GL_LINK_STATUS, &status);
-        if (status != GL_TRUE) {
-            char buffer[512];
-            glGetProgramInfoLog(program, 512, nullptr, buffer);
-            std::cerr << "Linker error: " << std::endl << buffer << std::endl;
-            throw std::runtime_error("Shader linking failed!");
+        /* A cached binary of the program skips compiling and linking */
+        bool cache = program_binaries_supported();
+        std::string path = cache ? program_path(shader_name) : "";
+        uint64_t key = path.empty() ? 0 : program_key(vertex_shader, fragment_shader);
+        if(path.empty() || !load_program_binary(program, path, key)) {
+            vertex = creater_shader(GL_VERTEX_SHADER, vertex_shader);
+            fragment = creater_shader(GL_FRAGMENT_SHADER, fragment_shader);
+            glAttachShader(program, vertex);
+            glAttachShader(program, fragment);
+#if !defined(__EMSCRIPTEN__)
+            if(!path.empty()) {
+                glProgramParameteri(program, GL_PROGRAM_BINARY_RETRIEVABLE_HINT, GL_TRUE);
+            }
+#endif
+            glLinkProgram(program);
+            GLint status;
+            glGetProgramiv(program, GL_LINK_STATUS, &status);
+            if (status != GL_TRUE) {
+                char buffer[512];
+                glGetProgramInfoLog(program, 512, nullptr, buffer);
+                std::cerr << "Linker error: " << std::endl << buffer << std::endl;
+                throw std::runtime_error("Shader linking failed!");
+            }
+            if(!path.empty()) {
+                save_program_binary(program, path, key);
+            }
         }
         glGenVertexArrays(1, &vao);
         glUseProgram(program);
@@ -80,6 +229,10 @@ namespace konstructs {
         return id;
     }
 
+    bool ShaderProgram::loaded_from_cache() const {
+        return vertex == 0;
+    }
+
     void ShaderProgram::bind(std::function<void(Context context)> f) {
         glUseProgram(program);
         glBindVertexArray(vao);
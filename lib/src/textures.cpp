@@ -3,7 +3,13 @@
 #include <gl_includes.h>
 #include <iostream>
 #include <cstdlib>
+#include <algorithm>
+#include <chrono>
+#include <memory>
+#include <stdexcept>
+#include <lodepng.h>
 #include "textures.h"
+#include "asset_cache.h"
 #include "util.h"
 #define KONSTRUCTS_PATH_SIZE 256
 
@@ -43,80 +49,270 @@ namespace konstructs {
         shtxt_path(name, "shaders", path, max_len);
     }
 
-    void load_textures() {
-        char txtpth[KONSTRUCTS_PATH_SIZE];
-
-        GLuint sky;
-        glGenTextures(1, &sky);
-        glActiveTexture(GL_TEXTURE0 + SKY_TEXTURE);
-        glBindTexture(GL_TEXTURE_2D, sky);
-        glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MIN_FILTER, GL_LINEAR);
-        glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MAG_FILTER, GL_LINEAR);
-        glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_S, GL_CLAMP_TO_EDGE);
-        glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_T, GL_CLAMP_TO_EDGE);
-        texture_path("sky.png", txtpth, KONSTRUCTS_PATH_SIZE);
-        load_png_texture(txtpth);
-
-        GLuint font;
-        glGenTextures(1, &font);
-        glActiveTexture(GL_TEXTURE0 + FONT_TEXTURE);
-        glBindTexture(GL_TEXTURE_2D, font);
-        glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MIN_FILTER, GL_LINEAR);
-        glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MAG_FILTER, GL_LINEAR);
-        texture_path("font.png", txtpth, KONSTRUCTS_PATH_SIZE);
-        load_png_texture(txtpth);
-
-        GLuint inventory_texture;
-        glGenTextures(1, &inventory_texture);
-        glActiveTexture(GL_TEXTURE0 + INVENTORY_TEXTURE);
-        glBindTexture(GL_TEXTURE_2D, inventory_texture);
-        glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MIN_FILTER, GL_NEAREST);
-        glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MAG_FILTER, GL_NEAREST);
-        texture_path("inventory.png", txtpth, KONSTRUCTS_PATH_SIZE);
-        load_png_texture(txtpth);
-
-        GLuint player_texture;
-        glGenTextures(1, &player_texture);
-        glActiveTexture(GL_TEXTURE0 + PLAYER_TEXTURE);
-        glBindTexture(GL_TEXTURE_2D, player_texture);
-        glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MIN_FILTER, GL_NEAREST);
-        glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MAG_FILTER, GL_NEAREST);
-        texture_path("player.png", txtpth, KONSTRUCTS_PATH_SIZE);
-        load_png_texture(txtpth);
-
-        GLuint damage_texture;
-        glGenTextures(1, &damage_texture);
-        glActiveTexture(GL_TEXTURE0 + DAMAGE_TEXTURE);
-        glBindTexture(GL_TEXTURE_2D, damage_texture);
-        glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MIN_FILTER, GL_NEAREST);
-        glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MAG_FILTER, GL_NEAREST);
-        texture_path("damage.png", txtpth, KONSTRUCTS_PATH_SIZE);
-        load_png_texture(txtpth);
-
-        GLuint health_bar_texture;
-        glGenTextures(1, &health_bar_texture);
-        glActiveTexture(GL_TEXTURE0 + HEALTH_BAR_TEXTURE);
-        glBindTexture(GL_TEXTURE_2D, health_bar_texture);
-        glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MIN_FILTER, GL_NEAREST);
-        glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MAG_FILTER, GL_NEAREST);
-        texture_path("health_bar.png", txtpth, KONSTRUCTS_PATH_SIZE);
-        load_png_texture(txtpth);
+    /* Pixels of this color are not drawn by the chunk shader */
+    static bool color_keyed(const unsigned char *pixel) {
+        return pixel[0] == 255 && pixel[1] == 0 && pixel[2] == 255;
+    }
 
-        // Set Active texture to GL_TEXTURE0, nanogui will use the active texture
+    /* Halve an image by averaging each square of four pixels. Color
+     * keyed pixels are left out of the average, so that the key stays
+     * exact and does not bleed into what is drawn. */
+    static std::vector<unsigned char> halve_image(const std::vector<unsigned char> &data,
+                                                  const unsigned int width,
+                                                  const unsigned int height) {
+        const unsigned int new_width = width > 1 ? width / 2 : 1;
+        const unsigned int new_height = height > 1 ? height / 2 : 1;
+        std::vector<unsigned char> result(new_width * new_height * 4);
+        for(unsigned int y = 0; y < new_height; y++) {
+            for(unsigned int x = 0; x < new_width; x++) {
+                const unsigned int xs[2] = {x * 2, std::min(x * 2 + 1, width - 1)};
+                const unsigned int ys[2] = {y * 2, std::min(y * 2 + 1, height - 1)};
+                unsigned int sum[4] = {0, 0, 0, 0};
+                unsigned int count = 0;
+                for(int j = 0; j < 2; j++) {
+                    for(int i = 0; i < 2; i++) {
+                        const unsigned char *pixel = &data[(xs[i] + ys[j] * width) * 4];
+                        if(color_keyed(pixel)) {
+                            continue;
+                        }
+                        for(int c = 0; c < 4; c++) {
+                            sum[c] += pixel[c];
+                        }
+                        count++;
+                    }
+                }
+                unsigned char *out = &result[(x + y * new_width) * 4];
+                if(count < 2) {
+                    out[0] = 255; out[1] = 0; out[2] = 255; out[3] = 255;
+                } else {
+                    for(int c = 0; c < 4; c++) {
+                        out[c] = (sum[c] + count / 2) / count;
+                    }
+                }
+            }
+        }
+        return result;
+    }
+
+    /* Take over an image decoded by lodepng */
+    static TextureImage texture_image(unsigned char *data, const unsigned int width,
+                                      const unsigned int height) {
+        flip_image_vertical(data, width, height);
+        TextureImage image;
+        image.width = width;
+        image.height = height;
+        image.levels.emplace_back(data, data + width * height * 4);
+        image.tile_levels = 1;
+        free(data);
+        return image;
+    }
+
+    TextureImage decode_block_texture(const std::vector<char> &png) {
+        unsigned char *data;
+        unsigned int width, height;
+        unsigned int error = lodepng_decode32(&data, &width, &height,
+                                              (const unsigned char *)png.data(), png.size());
+        if(error) {
+            throw std::runtime_error(lodepng_error_text(error));
+        }
+        TextureImage image = texture_image(data, width, height);
+
+        /* Mipmaps reduce texture cache misses for distant blocks. All
+         * levels down to a single pixel are made, since incomplete
+         * mipmaps are not allowed everywhere. */
+        image.tile_levels = 0;
+        while(true) {
+            if(width >= BLOCK_TEXTURE_TILES && height >= BLOCK_TEXTURE_TILES) {
+                image.tile_levels++;
+            }
+            if(width == 1 && height == 1) {
+                break;
+            }
+            image.levels.push_back(halve_image(image.levels.back(), width, height));
+            width = width > 1 ? width / 2 : 1;
+            height = height > 1 ? height / 2 : 1;
+        }
+        return image;
+    }
+
+    /* Upload all levels of an image to the bound texture */
+    static void upload_texture(const TextureImage &image) {
+        for(size_t level = 0; level < image.levels.size(); level++) {
+            GLsizei width = std::max(image.width >> level, 1u);
+            GLsizei height = std::max(image.height >> level, 1u);
+            glTexImage2D(GL_TEXTURE_2D, level, GL_RGBA, width, height, 0, GL_RGBA,
+                         GL_UNSIGNED_BYTE, image.levels[level].data());
+        }
+    }
+
+    void load_block_texture(const TextureImage &image) {
+        GLuint texture;
+        glGenTextures(1, &texture);
+        glActiveTexture(GL_TEXTURE0 + BLOCK_TEXTURES);
+        glBindTexture(GL_TEXTURE_2D, texture);
+        /* Linear filtering would blend the color key into its neighbours */
+        glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MIN_FILTER, GL_NEAREST_MIPMAP_NEAREST);
+        glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MAG_FILTER, GL_NEAREST);
+#ifndef __EMSCRIPTEN__
+        /* Smaller levels would mix neighbouring tiles of the atlas */
+        glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MAX_LEVEL, std::max(image.tile_levels - 1, 0));
+#endif
+        upload_texture(image);
         glActiveTexture(GL_TEXTURE0);
     }
 
-    tinyobj::shape_t load_player() {
-        char objpth[KONSTRUCTS_PATH_SIZE];
-        model_path("player.obj", objpth, KONSTRUCTS_PATH_SIZE);
+    void BlockTextureDecoder::decode(const char *in, const size_t size) {
+        /* The worker needs its own copy, the packet is freed once handled */
+        pending.push_back(std::async(std::launch::async, decode_block_texture,
+                                     std::vector<char>(in, in + size)));
+    }
 
-        std::vector<tinyobj::shape_t> shapes;
-        std::vector<tinyobj::material_t> materials;
+    /* Futures of std::async wait for their thread when destroyed, so
+     * only those that are ready are removed */
+    optional<TextureImage> BlockTextureDecoder::fetch() {
+        optional<TextureImage> latest;
+        while(!pending.empty() &&
+              pending.front().wait_for(std::chrono::seconds(0)) == std::future_status::ready) {
+            latest = pending.front().get();
+            pending.pop_front();
+        }
+        return latest;
+    }
 
-        std::string err;
-        tinyobj::LoadObj(shapes, materials, err, objpth);
+    static double seconds_since(const std::chrono::steady_clock::time_point &start) {
+        return std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+    }
 
-        return shapes[0];
+    static LoadedAsset<TextureImage> load_texture_image(const std::string &path,
+                                                        std::shared_ptr<const AssetCache> cache) {
+        auto start = std::chrono::steady_clock::now();
+        LoadedAsset<TextureImage> result;
+        result.cached = cache->get(path.c_str(), result.asset);
+        if(!result.cached) {
+            unsigned char *data;
+            unsigned int width, height;
+            unsigned int error = lodepng_decode32_file(&data, &width, &height, path.c_str());
+            if(error) {
+                throw std::runtime_error(path + ": " + lodepng_error_text(error));
+            }
+            result.asset = texture_image(data, width, height);
+            cache->put(path.c_str(), result.asset);
+        }
+        result.seconds = seconds_since(start);
+        return result;
+    }
+
+    static LoadedAsset<tinyobj::shape_t> load_player_shape(const std::string &path,
+                                                           std::shared_ptr<const AssetCache> cache) {
+        auto start = std::chrono::steady_clock::now();
+        LoadedAsset<tinyobj::shape_t> result;
+        result.cached = cache->get(path.c_str(), result.asset);
+        if(!result.cached) {
+            std::vector<tinyobj::shape_t> shapes;
+            std::vector<tinyobj::material_t> materials;
+
+            std::string err;
+            tinyobj::LoadObj(shapes, materials, err, path.c_str());
+            if(shapes.empty()) {
+                throw std::runtime_error(path + ": " + err);
+            }
+            result.asset = shapes[0];
+            cache->put(path.c_str(), result.asset);
+        }
+        result.seconds = seconds_since(start);
+        return result;
+    }
+
+    /* Textures that are needed at startup, the block textures are sent by the server */
+    struct StartupTexture {
+        const char *name;
+        int unit;
+        int filter;
+        bool clamp;
+    };
+
+    static const StartupTexture STARTUP_TEXTURES[] = {
+        {"sky.png", SKY_TEXTURE, GL_LINEAR, true},
+        {"font.png", FONT_TEXTURE, GL_LINEAR, false},
+        {"inventory.png", INVENTORY_TEXTURE, GL_NEAREST, false},
+        {"player.png", PLAYER_TEXTURE, GL_NEAREST, false},
+        {"damage.png", DAMAGE_TEXTURE, GL_NEAREST, false},
+        {"health_bar.png", HEALTH_BAR_TEXTURE, GL_NEAREST, false}
+    };
+
+    AssetLoader::AssetLoader(const bool debug_mode) :
+        started(std::chrono::steady_clock::now()),
+        debug_mode(debug_mode),
+        textures_loaded(false) {
+        auto cache = std::make_shared<const AssetCache>();
+        char path[KONSTRUCTS_PATH_SIZE];
+
+        model_path("player.obj", path, KONSTRUCTS_PATH_SIZE);
+        player = std::async(std::launch::async, load_player_shape, std::string(path), cache);
+
+        for(const auto &texture : STARTUP_TEXTURES) {
+            texture_path(texture.name, path, KONSTRUCTS_PATH_SIZE);
+            textures.emplace_back(texture.name, texture.unit, texture.filter, texture.clamp,
+                                  std::async(std::launch::async, load_texture_image,
+                                             std::string(path), cache));
+        }
+    }
+
+    void AssetLoader::report(const char *name, const double seconds, const bool cached) const {
+        if(debug_mode) {
+            printf("Loaded %s in %.1f ms (%s)\n", name, seconds * 1000.0,
+                   cached ? "cached" : "decoded");
+        }
+    }
+
+    void AssetLoader::load_textures() {
+        /* Textures are kept when connecting to another server */
+        if(textures_loaded) {
+            return;
+        }
+        double waited = 0.0;
+        double uploaded = 0.0;
+        for(auto &texture : textures) {
+            auto start = std::chrono::steady_clock::now();
+            LoadedAsset<TextureImage> image = texture.image.get();
+            waited += seconds_since(start);
+            report(texture.name.c_str(), image.seconds, image.cached);
+
+            start = std::chrono::steady_clock::now();
+            GLuint id;
+            glGenTextures(1, &id);
+            glActiveTexture(GL_TEXTURE0 + texture.unit);
+            glBindTexture(GL_TEXTURE_2D, id);
+            glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MIN_FILTER, texture.filter);
+            glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MAG_FILTER, texture.filter);
+            if(texture.clamp) {
+                glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_S, GL_CLAMP_TO_EDGE);
+                glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_T, GL_CLAMP_TO_EDGE);
+            }
+            upload_texture(image.asset);
+            uploaded += seconds_since(start);
+        }
+        textures.clear();
+        textures_loaded = true;
+
+        // Set Active texture to GL_TEXTURE0, nanogui will use the active texture
+        glActiveTexture(GL_TEXTURE0);
+
+        if(debug_mode) {
+            printf("Textures ready %.1f ms after start, waited %.1f ms, uploaded in %.1f ms\n",
+                   seconds_since(started) * 1000.0, waited * 1000.0, uploaded * 1000.0);
+        }
+    }
+
+    tinyobj::shape_t AssetLoader::load_player() {
+        auto start = std::chrono::steady_clock::now();
+        LoadedAsset<tinyobj::shape_t> shape = player.get();
+        report("player.obj", shape.seconds, shape.cached);
+        if(debug_mode) {
+            printf("Player model ready %.1f ms after start, waited %.1f ms\n",
+                   seconds_since(started) * 1000.0, seconds_since(start) * 1000.0);
+        }
+        return shape.asset;
     }
 
     std::string load_shader(const char* name) {
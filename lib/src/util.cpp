@@ -1,8 +1,14 @@
+#include <algorithm>
+#include <ctype.h>
 #include <math.h>
 #include <stdio.h>
 #include <stdlib.h>
 #include <sys/stat.h>
-#include <lodepng.h>
+#if defined(_WIN32)
+#include <direct.h>
+#else
+#include <sys/types.h>
+#endif
 #include "matrix.h"
 #include "util.h"
 
@@ -49,45 +55,14 @@ GLuint gen_faces(int components, int faces, GLfloat *data) {
     return buffer;
 }
 
+/* Reverse the order of the rows of an RGBA image in place */
 void flip_image_vertical(
     unsigned char *data, unsigned int width, unsigned int height) {
-    unsigned int size = width * height * 4;
     unsigned int stride = sizeof(char) * width * 4;
-    unsigned char *new_data = (unsigned char*)malloc(sizeof(unsigned char) * size);
-    for (unsigned int i = 0; i < height; i++) {
+    for (unsigned int i = 0; i < height / 2; i++) {
         unsigned int j = height - i - 1;
-        memcpy(new_data + j * stride, data + i * stride, stride);
+        std::swap_ranges(data + i * stride, data + (i + 1) * stride, data + j * stride);
     }
-    memcpy(data, new_data, size);
-    free(new_data);
-}
-
-void load_png_texture(const char *file_name) {
-    unsigned int error;
-    unsigned char *data;
-    unsigned int width, height;
-    error = lodepng_decode32_file(&data, &width, &height, file_name);
-    if (error) {
-        fprintf(stderr, "error %u: %s\n", error, lodepng_error_text(error));
-    }
-    flip_image_vertical(data, width, height);
-    glTexImage2D(GL_TEXTURE_2D, 0, GL_RGBA, width, height, 0, GL_RGBA,
-                 GL_UNSIGNED_BYTE, data);
-    free(data);
-}
-
-void load_png_texture_from_buffer(const char *in, int size) {
-    unsigned int error;
-    unsigned char *data;
-    unsigned int width, height;
-    error = lodepng_decode32(&data, &width, &height, (unsigned char *)in, size);
-    if (error) {
-        fprintf(stderr, "error %u: %s\n", error, lodepng_error_text(error));
-    }
-    flip_image_vertical(data, width, height);
-    glTexImage2D(GL_TEXTURE_2D, 0, GL_RGBA, width, height, 0, GL_RGBA,
-                 GL_UNSIGNED_BYTE, data);
-    free(data);
 }
 
 int file_exist(const char *filename) {
@@ -95,3 +70,35 @@ int file_exist(const char *filename) {
     int result = stat(filename, &st);
     return result == 0;
 }
+
+namespace konstructs {
+    std::string data_directory() {
+#if defined(__EMSCRIPTEN__)
+        return "";
+#elif defined(_WIN32)
+        const char *base = getenv("APPDATA");
+        if(!base) return "";
+        std::string dir = std::string(base) + "\\konstructs";
+        _mkdir(dir.c_str());
+        return dir;
+#else
+        const char *base = getenv("HOME");
+        if(!base) return "";
+        std::string dir = std::string(base) + "/.konstructs";
+        mkdir(dir.c_str(), 0755);
+        return dir;
+#endif
+    }
+
+    std::string safe_file_name(const std::string &name) {
+        std::string result;
+        for(char c : name) {
+            if(isalnum((unsigned char)c) || c == '.' || c == '-' || c == '_') {
+                result += c;
+            } else {
+                result += '_';
+            }
+        }
+        return result;
+    }
+};
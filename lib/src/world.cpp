@@ -1,28 +1,112 @@
+#include <algorithm>
 #include "world.h"
 
 namespace konstructs {
 
     using nonstd::nullopt;
 
+    /* Memory a chunk keeps resident, chunks that share their blocks
+     * with other chunks only cost their ChunkData */
+    static size_t chunk_bytes(const ChunkData &data) {
+        size_t bytes = sizeof(ChunkData);
+        if(!data.shared) {
+            bytes += CHUNK_BLOCKS * (sizeof(BlockData) + sizeof(uint16_t));
+        }
+        return bytes;
+    }
+
+    World::World(const size_t budget) : budget(budget), resident(0) {}
+
     int World::size() const {
         return chunks.size();
     }
 
+    size_t World::bytes() const {
+        return resident;
+    }
+
+    size_t World::budget_bytes() const {
+        return budget;
+    }
+
     void World::delete_unused_chunks(const Vector3i player_chunk, const int radi) {
         for ( auto it = chunks.begin(); it != chunks.end();) {
             if ((it->second.position - player_chunk).norm() > radi) {
-                it = chunks.erase(it);
+                Vector3i pos = it->first;
+                ++it;
+                erase(pos);
             } else {
                 ++it;
             }
         }
     }
 
+    /* Evict a few chunks, first those that are outside the radius, then
+     * if the world uses more memory than its budget the farthest chunks
+     * of the whole world, until it is within its budget. Chunks close
+     * to the player are never evicted for the budget. Returns the
+     * evicted chunks, the distance of the closest chunk evicted for the
+     * budget is set in budget_distance, or -1 if none was evicted. */
+    std::vector<Vector3i> World::evict(const Vector3i &player_chunk, const int radi,
+                                       const int max_evictions, int &budget_distance) {
+        std::vector<Vector3i> evicted;
+        budget_distance = -1;
+        /* The scanned chunks are moved to the front, so that the
+         * whole world is looked at over a number of calls */
+        int scan = std::min((int)lru.size(), EVICTION_SCAN);
+        for(int i = 0; i < scan && (int)evicted.size() < max_evictions; i++) {
+            Vector3i pos = lru.back();
+            if((pos - player_chunk).norm() > radi) {
+                erase(pos);
+                evicted.push_back(pos);
+                continue;
+            }
+            lru.splice(lru.begin(), lru, residency.at(pos).lru);
+        }
+        int remaining = max_evictions - (int)evicted.size();
+        if(resident <= budget || remaining <= 0) {
+            return evicted;
+        }
+        /* The farthest chunks of a full pass over the world */
+        std::vector<pair<int, Vector3i>> candidates;
+        for(const auto &entry : chunks) {
+            int distance = (entry.first - player_chunk).norm();
+            if(distance > EVICTION_MIN_DISTANCE) {
+                candidates.push_back({distance, entry.first});
+            }
+        }
+        int count = std::min(remaining, (int)candidates.size());
+        std::partial_sort(candidates.begin(), candidates.begin() + count, candidates.end(),
+                          [](const pair<int, Vector3i> &a, const pair<int, Vector3i> &b) {
+                              return a.first > b.first;
+                          });
+        for(int i = 0; i < count && resident > budget; i++) {
+            erase(candidates[i].second);
+            evicted.push_back(candidates[i].second);
+            budget_distance = candidates[i].first;
+        }
+        return evicted;
+    }
+
+    void World::erase(const Vector3i &pos) {
+        auto it = residency.find(pos);
+        if(it != residency.end()) {
+            resident -= it->second.bytes;
+            lru.erase(it->second.lru);
+            residency.erase(it);
+        }
+        chunks.erase(pos);
+    }
+
     void World::insert(ChunkData data) {
         /* Overwrite any existing chunk, we always want the latest data */
         const Vector3i pos = data.position;
-        chunks.erase(pos);
+        erase(pos);
         chunks.insert({pos, data});
+        lru.push_front(pos);
+        size_t bytes = chunk_bytes(data);
+        residency.insert({pos, {lru.begin(), bytes}});
+        resident += bytes;
     }
 
     const optional<BlockData> World::get_block(const Vector3i &block_pos) const {
@@ -34,6 +118,16 @@ namespace konstructs {
         }
     }
 
+    /* Only looks at the types of the chunk, and does not copy it */
+    const optional<uint16_t> World::get_type(const Vector3i &block_pos) const {
+        auto it = chunks.find(chunked_vec_int(block_pos));
+        if(it != chunks.end()) {
+            return it->second.get_type(block_pos);
+        } else {
+            return nullopt;
+        }
+    }
+
     const optional<ChunkData> World::chunk_by_block(const Vector3f &block_pos) const {
         return chunk(chunked_vec(block_pos));
     }
@@ -50,28 +144,65 @@ namespace konstructs {
         }
     }
 
-    const std::vector<ChunkData> World::atAndAround(const Vector3i &pos) const {
-        std::vector<ChunkData> result;
-        for(int i = -1; i <= 1; i++) {
-            for(int j = -1; j <= 1; j++) {
-                for(int k = -1; k <= 1; k++) {
-                    try {
-                        result.push_back(chunks.at(pos + Vector3i(i, j, k)));
-                    } catch(std::out_of_range e) {
-                        // Not in this chunk
-                    }
-                }
-            }
+    ChunkMap<ChunkData>::const_iterator World::find(const Vector3i &pos) const {
+        return chunks.find(pos);
+    }
+
+    ChunkMap<ChunkData>::const_iterator World::end() const {
+        return chunks.end();
+    }
+
+    WorldCursor::WorldCursor(const World &world) :
+        world(world), origin(0, 0, 0), known(0) {}
+
+    /* Find the chunk of a block and the index of the block in it */
+    const ChunkData *WorldCursor::seek(const Vector3i &block_pos, int &index) {
+        Vector3i offset = block_pos - origin;
+        const int extent = CHUNK_SIZE * 3;
+        /* Nothing is known before the first read */
+        if(!known || offset[0] < 0 || offset[1] < 0 || offset[2] < 0 ||
+           offset[0] >= extent || offset[1] >= extent || offset[2] >= extent) {
+            /* Center the cursor on the chunk of the block */
+            Vector3i chunk_pos = chunked_vec_int(block_pos);
+            origin = Vector3i((chunk_pos[0] - 1) * CHUNK_SIZE,
+                              (chunk_pos[2] - 1) * CHUNK_SIZE,
+                              (chunk_pos[1] - 1) * CHUNK_SIZE);
+            known = 0;
+            offset = block_pos - origin;
         }
-        return result;
+        const Vector3i cell = offset / CHUNK_SIZE;
+        const int i = cell[0] + cell[1] * 3 + cell[2] * 9;
+        if(!(known & (1 << i))) {
+            /* Chunk positions are x, z, y while blocks are x, y, z */
+            auto it = world.find(Vector3i(origin[0] / CHUNK_SIZE + cell[0],
+                                          origin[2] / CHUNK_SIZE + cell[2],
+                                          origin[1] / CHUNK_SIZE + cell[1]));
+            chunks[i] = it != world.end() ? &it->second : nullptr;
+            known |= 1 << i;
+        }
+        const Vector3i local = offset - cell * CHUNK_SIZE;
+        index = local[0] + local[1] * CHUNK_SIZE + local[2] * CHUNK_SIZE * CHUNK_SIZE;
+        return chunks[i];
     }
 
-    std::unordered_map<Vector3i, ChunkData, matrix_hash<Vector3i>>::const_iterator World::find(const Vector3i &pos) const {
-        return chunks.find(pos);
+    const optional<uint16_t> WorldCursor::get_type(const Vector3i &block_pos) {
+        int index;
+        const ChunkData *chunk = seek(block_pos, index);
+        if(chunk) {
+            return chunk->types()[index];
+        } else {
+            return nullopt;
+        }
     }
 
-    std::unordered_map<Vector3i, ChunkData, matrix_hash<Vector3i>>::const_iterator World::end() const {
-        return chunks.end();
+    const optional<BlockData> WorldCursor::get_block(const Vector3i &block_pos) {
+        int index;
+        const ChunkData *chunk = seek(block_pos, index);
+        if(chunk) {
+            return chunk->blocks.get()[index];
+        } else {
+            return nullopt;
+        }
     }
 
 };
@@ -123,6 +123,9 @@ uniform float fog_distance;
 /* Chunk translation */
 uniform mat4 translation;
 
+/* Level of detail scale, each voxel covers scale blocks in every direction */
+uniform float scale;
+
 /* The per vertex data as described above */
 in uvec2 data;
 
@@ -204,6 +207,9 @@ void main() {
     /* Calculate the vertex position within the chunk by applying the block translation */
     vec4 position = block_translation * vec4(positions[vertex], 1);
 
+    /* Scale reduced detail voxels so that they cover all of their blocks */
+    position.xyz = (position.xyz + N) * scale - N;
+
     /* Calculate the global position of the vertex by applying the chunk translation */
     vec4 global_position = translation * position;
 
@@ -99,6 +99,9 @@ uniform float fog_distance;
 /* Chunk translation */
 uniform mat4 translation;
 
+/* Level of detail scale, each voxel covers scale blocks in every direction */
+uniform float scale;
+
 /* The per vertex data as described above */
 varying vec2 data;
 
@@ -199,6 +202,9 @@ positions[15] = vec3(+N, +N, +0); //15
     //vec4 position = block_translation * vec4(positions[vertex], 1); // TODO: 'Index expression must be constant'!
     vec4 position = block_translation * vec4(positions[0], 1);
 
+    /* Scale reduced detail voxels so that they cover all of their blocks */
+    position.xyz = (position.xyz + N) * scale - N;
+
     /* Calculate the global position of the vertex by applying the chunk translation */
     vec4 global_position = translation * position;
 
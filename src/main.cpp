@@ -8,6 +8,7 @@
     #include <arpa/inet.h>
 #endif
 #include <nanogui/glutil.h>
+#include <algorithm>
 #include <iostream>
 #include <iomanip>
 #include <vector>
@@ -46,6 +47,15 @@
 #define KONSTRUCTS_KEY_SNEAK GLFW_KEY_LEFT_SHIFT
 #define KONSTRUCTS_KEY_INVENTORY 'E'
 #define MOUSE_CLICK_DELAY_IN_FRAMES 15
+#define LOD_HALF_DISTANCE 6
+#define LOD_QUARTER_DISTANCE 12
+/* Chunks inserted into the world every frame, stored chunks arrive in bursts */
+#define CHUNKS_PER_FRAME 4
+/* Chunks that may be evicted from the world every frame */
+#define EVICTIONS_PER_FRAME 4
+/* Part of the world budget below which the radius may grow again
+ * after chunks were evicted for the budget */
+#define BUDGET_RECOVERED 0.75
 
 using std::cout;
 using std::cerr;
@@ -64,18 +74,22 @@ public:
     Konstructs(const string &hostname,
                const string &username,
                const string &password,
-               bool debug_mode) :
+               const size_t world_budget,
+               bool debug_mode,
+               AssetLoader &assets) :
         nanogui::Screen(Eigen::Vector2i(KONSTRUCTS_APP_WIDTH,
                                         KONSTRUCTS_APP_HEIGHT),
                         KONSTRUCTS_APP_TITLE),
+        assets(assets),
         hostname(hostname),
         username(username),
         password(password),
         player(0, Vector3f(0.0f, 0.0f, 0.0f), 0.0f, 0.0f),
         px(0), py(0),
-        model_factory(blocks),
+        model_factory(blocks, LOD_HALF_DISTANCE, LOD_QUARTER_DISTANCE),
         radius(5),
         max_radius(20),
+        budget_radius(max_radius),
         client(debug_mode),
         view_distance((float)radius*CHUNK_SIZE),
         fov(70.0f),
@@ -86,6 +100,7 @@ public:
         hud_shader(17, 14, INVENTORY_TEXTURE, BLOCK_TEXTURES, FONT_TEXTURE, HEALTH_BAR_TEXTURE),
         selection_shader(fov, near_distance, 0.52),
         day_length(600),
+        world(world_budget),
         last_frame(glfwGetTime()),
         looking_at(nullopt),
         hud(17, 14, 9),
@@ -103,13 +118,10 @@ public:
         } else {
             show_menu(0, string("Connect to a server"));
         }
-        blocks.is_plant[SOLID_TYPE] = 0;
-        blocks.is_obstacle[SOLID_TYPE] = 1;
-        blocks.is_transparent[SOLID_TYPE] = 0;
-        blocks.state[SOLID_TYPE] = STATE_SOLID;
+        blocks.types[SOLID_TYPE].flags = block_flags(false, true, false, false, STATE_SOLID);
         memset(&fps, 0, sizeof(fps));
 
-        tinyobj::shape_t shape = load_player();
+        tinyobj::shape_t shape = assets.load_player();
         player_shader = new PlayerShader(fov, PLAYER_TEXTURE, SKY_TEXTURE,
                                          near_distance, shape);
     }
@@ -200,13 +212,23 @@ public:
         frame++;
         if (client.is_connected()) {
             handle_network();
+            auto block_texture = block_texture_decoder.fetch();
+            if(block_texture) {
+                load_block_texture(*block_texture);
+            }
             handle_keys();
             handle_mouse();
             looking_at = player.looking_at(world, blocks);
             glClear(GL_DEPTH_BUFFER_BIT);
+            std::vector<Vector3i> rebuild;
             for(auto model : model_factory.fetch_models()) {
-                chunk_shader.add(model);
+                if(!chunk_shader.add(model)) {
+                    /* The sections could not be updated in place */
+                    rebuild.push_back(model->position);
+                }
             }
+            model_factory.refresh_models(rebuild, world);
+            model_factory.refresh_models(chunk_shader.lod_updates(model_factory, player_chunk), world);
             sky_shader.render(player, mSize.x(), mSize.y(), time_of_day(), view_distance);
             glClear(GL_DEPTH_BUFFER_BIT);
             faces = chunk_shader.render(player, mSize.x(), mSize.y(),
@@ -261,9 +283,12 @@ private:
             }
             os << "View distance: " << view_distance << " (" << radius << "/" << client.get_loaded_radius() << ") faces: " <<
                faces << "(" << max_faces << ") FPS: " << fps.fps << "(" << frame_fps << ")" << endl;
-            os << "Chunks: " << world.size() << " models: " << chunk_shader.size() << endl;
+            os << "Chunks: " << world.size() << " (" << world.bytes() / (1024 * 1024) << " MB) models: " <<
+               chunk_shader.size() << endl;
             os << "Model factory, waiting: " << model_factory.waiting() << " created: " << model_factory.total_created() <<
-               " empty: " << model_factory.total_empty() << " total: " <<  model_factory.total() << endl;
+               " empty: " << model_factory.total_empty() << " (trivial: " << model_factory.total_trivial() <<
+               ") total: " <<  model_factory.total() << " cancelled: " << model_factory.total_cancelled() <<
+               " coalesced: " << model_factory.total_coalesced() << " cached: " << model_factory.total_cached() << endl;
 
         }
 
@@ -291,7 +316,7 @@ private:
             view_distance = view_distance - (float)CHUNK_SIZE * 0.2f * ((60.0f - (float)frame_fps) / 60.0f);
             return true;
         } else if(frame_fps >= 60.0
-                  && radius < max_radius
+                  && radius < std::min(max_radius, budget_radius)
                   && model_factory.waiting() == 0
                   && radius <= client.get_loaded_radius()) {
             view_distance = view_distance + 0.05;
@@ -301,6 +326,19 @@ private:
         }
     }
 
+    /* The world can not hold the chunks at this distance within its
+     * budget, they must not be fetched again or they would be evicted
+     * again as soon as they are received. The limit is lifted once the
+     * world is well within its budget again. */
+    void limit_radius(const int limit) {
+        budget_radius = std::max(1, std::min(budget_radius, limit));
+        if(radius > budget_radius) {
+            radius = budget_radius;
+            view_distance = (float)(radius - 1) * CHUNK_SIZE;
+            client.set_radius(radius);
+        }
+    }
+
     void update_radius() {
         if (update_view_distance()) {
             int new_radius = (int)(view_distance / (float)CHUNK_SIZE) + 1;
@@ -341,7 +379,7 @@ private:
                                                 DIRECTION_UP,
                                                 ROTATION_IDENTITY
                                               };
-                            if(blocks.is_orientable[block.type]) {
+                            if(blocks.is_orientable(block.type)) {
                                 block.direction = direction;
                                 block.rotation = rotation;
                             }
@@ -351,7 +389,7 @@ private:
                                 ChunkData updated_chunk =
                                     chunk_opt->set(l.first.position, block);
                                 world.insert(updated_chunk);
-                                model_factory.create_models({updated_chunk.position}, world);
+                                model_factory.update_block(l.first.position, world);
                             }
                         }
                         click_delay = MOUSE_CLICK_DELAY_IN_FRAMES;
@@ -442,7 +480,7 @@ private:
             world.insert(*prio);
             model_factory.create_models({(*prio).position}, world);
         }
-        auto new_chunks = client.receive_chunks(1);
+        auto new_chunks = client.receive_chunks(CHUNKS_PER_FRAME);
         if(!new_chunks.empty()) {
             std::vector<Vector3i> positions;
             positions.reserve(new_chunks.size());
@@ -452,10 +490,32 @@ private:
             }
             model_factory.create_models(positions, world);
         }
-        if(frame % 7883 == 0) {
-            /* Book keeping */
-            world.delete_unused_chunks(player_chunk, radius + KEEP_EXTRA_CHUNKS);
+        for(auto delta : client.receive_deltas()) {
+            auto chunk = world.chunk(delta.position);
+            if(!chunk) {
+                continue;
+            }
+            if(chunk->revision != delta.base) {
+                /* The changes can not be applied to the chunk we have */
+                client.refetch_chunk(delta.position);
+                continue;
+            }
+            auto updated = chunk->apply(delta.revision, delta.changes);
+            world.insert(updated);
+            client.delta_applied(updated);
+            model_factory.update_blocks(delta.position, delta.changes, world);
+        }
+        /* Book keeping */
+        int budget_distance;
+        auto evicted = world.evict(player_chunk, radius + KEEP_EXTRA_CHUNKS, EVICTIONS_PER_FRAME,
+                                   budget_distance);
+        if(budget_distance >= 0) {
+            limit_radius(budget_distance - 1);
+        } else if(budget_radius < max_radius &&
+                  world.bytes() < world.budget_bytes() * BUDGET_RECOVERED) {
+            budget_radius = max_radius;
         }
+        client.forget(evicted);
 
     }
 
@@ -540,37 +600,37 @@ private:
                   &top, &bottom, &front, &back, &orientable) != 12) {
             throw std::runtime_error(str);
         }
-        blocks.is_plant[w] = strncmp(shape, "plant", 16) == 0;
+        if(w < 0 || w >= BLOCK_TYPES) {
+            throw std::runtime_error(str);
+        }
+        int type_state;
         if(strncmp(state, "solid", 16) == 0) {
-            blocks.state[w] = STATE_SOLID;
+            type_state = STATE_SOLID;
         } else if(strncmp(state, "liquid", 16) == 0) {
-            blocks.state[w] = STATE_LIQUID;
+            type_state = STATE_LIQUID;
         } else if(strncmp(state, "gas", 16) == 0) {
-            blocks.state[w] = STATE_GAS;
+            type_state = STATE_GAS;
         } else if(strncmp(state, "plasma", 16) == 0) {
-            blocks.state[w] = STATE_PLASMA;
+            type_state = STATE_PLASMA;
         } else {
             throw std::invalid_argument("Invalid block type state received!");
         }
-        blocks.is_obstacle[w] = obstacle;
-        blocks.is_transparent[w] = transparent;
-        blocks.is_orientable[w] = orientable;
-        blocks.blocks[w][0] = left;
-        blocks.blocks[w][1] = right;
-        blocks.blocks[w][2] = top;
-        blocks.blocks[w][3] = bottom;
-        blocks.blocks[w][4] = front;
-        blocks.blocks[w][5] = back;
+        BlockType type;
+        type.flags = block_flags(strncmp(shape, "plant", 16) == 0, obstacle, transparent,
+                                 orientable, type_state);
+        type.textures[0] = left;
+        type.textures[1] = right;
+        type.textures[2] = top;
+        type.textures[3] = bottom;
+        type.textures[4] = front;
+        type.textures[5] = back;
+        blocks.types[w] = type;
+        /* Item stacks may show this block type */
+        hud.invalidate();
     }
 
     void handle_texture(konstructs::Packet *packet) {
-        GLuint texture;
-        glGenTextures(1, &texture);
-        glActiveTexture(GL_TEXTURE0 + BLOCK_TEXTURES);
-        glBindTexture(GL_TEXTURE_2D, texture);
-        glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MIN_FILTER, GL_NEAREST);
-        glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MAG_FILTER, GL_NEAREST);
-        load_png_texture_from_buffer(packet->buffer(), packet->size);
+        block_texture_decoder.decode(packet->buffer(), packet->size);
     }
 
     void handle_belt(const string &str) {
@@ -713,8 +773,13 @@ private:
 
     void setup_connection() {
         try {
+            if(hostname != cache_hostname) {
+                /* Cached models are only valid for the server they were received from */
+                model_factory.clear_cache();
+                cache_hostname = hostname;
+            }
             client.open_connection(username, password, hostname);
-            load_textures();
+            assets.load_textures();
             client.set_connected(true);
 
             // Lock the mouse _after_ a successful connection. This prevents the
@@ -726,13 +791,17 @@ private:
         }
     }
 
+    AssetLoader &assets;
     std::string hostname;
+    std::string cache_hostname;
     std::string username;
     std::string password;
     BlockTypeInfo blocks;
     CrosshairShader crosshair_shader;
     int radius;
     int max_radius;
+    /* Largest radius the world can hold within its budget */
+    int budget_radius;
     float view_distance;
     int fov;
     float near_distance;
@@ -749,6 +818,7 @@ private:
     Vector3i player_chunk;
     optional<pair<konstructs::Block, konstructs::Block>> looking_at;
     Hud hud;
+    BlockTextureDecoder block_texture_decoder;
     double px;
     double py;
     FPS fps;
@@ -795,7 +865,8 @@ void print_usage() {
     printf("OPTIONS: -h/--help                  - Show this help\n");
     printf("         -s/--server   <address>    - Server to enter\n");
     printf("         -u/--username <username>   - Username to login\n");
-    printf("         -p/--password <password>   - Passworld to login\n\n");
+    printf("         -p/--password <password>   - Passworld to login\n");
+    printf("         -m/--memory   <megabytes>  - Memory used for chunks\n\n");
     exit(0);
 }
 
@@ -808,6 +879,7 @@ int main(int argc, char ** argv) {
     std::string hostname = "play.konstructs.org";
     std::string username = "";
     std::string password = "";
+    size_t world_budget = DEFAULT_WORLD_BUDGET;
     bool debug_mode = false;
 
     if (argc > 1) {
@@ -839,6 +911,14 @@ int main(int argc, char ** argv) {
                     ++i;
                 }
             }
+            if (strcmp(argv[i], "--memory") == 0 || strcmp(argv[i], "-m") == 0) {
+                if (!argv[i+1] || atoi(argv[i+1]) <= 0) {
+                    print_usage();
+                } else {
+                    world_budget = (size_t)atoi(argv[i+1]) * 1024 * 1024;
+                    ++i;
+                }
+            }
             if (strcmp(argv[i], "--debug") == 0 || strcmp(argv[i], "-d") == 0) {
                 debug_mode = true;
             }
@@ -852,11 +932,15 @@ int main(int argc, char ** argv) {
     }
 
     try {
+        /* Decoding starts right away, while the window is created */
+        AssetLoader assets(debug_mode);
+
         glfwSetErrorCallback(glfw_error);
         nanogui::init();
 
         {
-            nanogui::ref<Konstructs> app = new Konstructs(hostname, username, password, debug_mode);
+            nanogui::ref<Konstructs> app = new Konstructs(hostname, username, password,
+                                                          world_budget, debug_mode, assets);
             app->drawAll();
             app->setVisible(true);
             nanogui::mainloop();
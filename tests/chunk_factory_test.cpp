@@ -0,0 +1,284 @@
+#include <algorithm>
+#include <chrono>
+#include <cstdint>
+#include <random>
+#include <thread>
+#include <vector>
+#include "chunk_factory.h"
+#include "test.h"
+
+/* Golden tests of the chunk mesher. The expected hashes are of the
+ * vertex data that compute_chunk produced before the corner light and
+ * shade grids, and before the properties of a type were packed into
+ * one record. Any change to the vertex data of the mesher shows up as
+ * a different hash. */
+
+using namespace konstructs;
+
+/* Gas, opaque, transparent, liquid, plant and opaque liquid blocks */
+#define MESHER_TYPES 5
+/* Also opaque blocks that are oriented */
+#define ORIENTED_MESHER_TYPES 6
+
+static BlockTypeInfo mesher_types;
+
+static void set_type(const uint16_t type, const bool plant, const bool obstacle,
+                     const bool transparent, const bool orientable, const int state) {
+    mesher_types.types[type].flags = block_flags(plant, obstacle, transparent, orientable, state);
+    for(int i = 0; i < 6; i++) {
+        mesher_types.types[type].textures[i] = type * 7 + i;
+    }
+}
+
+static void setup_mesher_types() {
+    set_type(0, false, false, true, false, STATE_GAS);
+    set_type(1, false, true, false, false, STATE_SOLID);
+    set_type(2, false, true, true, false, STATE_SOLID);
+    set_type(3, false, false, true, false, STATE_LIQUID);
+    set_type(4, true, false, true, false, STATE_SOLID);
+    set_type(5, false, false, false, false, STATE_LIQUID);
+    set_type(6, false, true, false, true, STATE_SOLID);
+}
+
+/* Random blocks, density is the percentage of blocks that are not gas.
+ * Oriented blocks get a random direction and rotation. */
+static ChunkData random_chunk(const Vector3i &position, std::mt19937 &random,
+                              const int density, const int types, const bool oriented) {
+    BlockData *blocks = allocate_chunk_blocks();
+    for(int i = 0; i < CHUNK_BLOCKS; i++) {
+        BlockData block;
+        block.type = (int)(random() % 100) < density ? 1 + random() % types : 0;
+        block.health = random() % 2048;
+        block.direction = oriented ? random() % 6 : 0;
+        block.rotation = oriented ? random() % 4 : 0;
+        block.ambient = random() % 16;
+        block.r = random() % 16;
+        block.g = random() % 16;
+        block.b = random() % 16;
+        block.light = random() % 16;
+        blocks[i] = block;
+    }
+    return ChunkData(position, 1, blocks);
+}
+
+static uint64_t hash_word(uint64_t hash, const uint32_t word) {
+    /* FNV-1a over the bytes of the word, least significant first */
+    for(int i = 0; i < 4; i++) {
+        hash ^= (word >> (8 * i)) & 0xFF;
+        hash *= 0x100000001b3ULL;
+    }
+    return hash;
+}
+
+/* A chunk at the origin with random neighbours, some of the
+ * neighbours are missing to cover the edges of the loaded world */
+static void random_world(World &world, std::mt19937 &random, const int density,
+                         const int types, const bool oriented) {
+    for(int x = -1; x <= 1; x++) {
+        for(int y = -1; y <= 1; y++) {
+            for(int z = -1; z <= 1; z++) {
+                if(random() % 5) {
+                    world.insert(random_chunk(Vector3i(x, y, z), random, density, types, oriented));
+                }
+            }
+        }
+    }
+    world.insert(random_chunk(Vector3i(0, 0, 0), random, density, types, oriented));
+}
+
+/* Hash of the meshes of a chunk in a random world */
+static uint64_t mesh_hash(const int seed, const int density, const int types,
+                          const bool oriented = false) {
+    std::mt19937 random(seed);
+    World world;
+    random_world(world, random, density, types, oriented);
+    const ChunkModelData data = create_model_data(Vector3i(0, 0, 0), world);
+
+    uint64_t hash = 0xcbf29ce484222325ULL;
+    const int sections[3] = {ALL_SECTIONS, 1, 6};
+    for(int s : sections) {
+        auto result = compute_chunk(data, mesher_types, s);
+        hash = hash_word(hash, result->faces);
+        for(int i = 0; i < result->size; i++) {
+            hash = hash_word(hash, result->data()[i]);
+        }
+    }
+    return hash;
+}
+
+TEST(mesher, sparse) {
+    setup_mesher_types();
+    CHECK(mesh_hash(0, 5, MESHER_TYPES) == 0xfd5f407f51d182a7ULL);
+}
+
+TEST(mesher, light) {
+    setup_mesher_types();
+    CHECK(mesh_hash(1, 30, MESHER_TYPES) == 0xbf0ddb50fb3a0548ULL);
+}
+
+TEST(mesher, half) {
+    setup_mesher_types();
+    CHECK(mesh_hash(2, 60, MESHER_TYPES) == 0xcf4b5f33512a167dULL);
+}
+
+TEST(mesher, dense) {
+    setup_mesher_types();
+    CHECK(mesh_hash(3, 95, MESHER_TYPES) == 0xf5b122fc5adfe4bbULL);
+}
+
+TEST(mesher, oriented_light) {
+    setup_mesher_types();
+    CHECK(mesh_hash(10, 30, ORIENTED_MESHER_TYPES, true) == 0x4213f25d22c177a5ULL);
+}
+
+TEST(mesher, oriented_half) {
+    setup_mesher_types();
+    CHECK(mesh_hash(11, 60, ORIENTED_MESHER_TYPES, true) == 0xf8b211d13cc3ebb4ULL);
+}
+
+/* Vertex data of a section, taken from a model of all sections or of
+ * only some of them */
+static std::vector<GLuint> section_data(ChunkModelResult &result, const int section) {
+    const int face_size = 12;
+    int offset = 0;
+    for(int i = 0; i < section; i++) {
+        if(result.sections & (1 << i)) {
+            offset += result.section_faces[i] * face_size;
+        }
+    }
+    return std::vector<GLuint>(result.data() + offset,
+                               result.data() + offset + result.section_faces[section] * face_size);
+}
+
+/* A block of a chunk is changed and only the sections the factory
+ * rebuilds for it are built, patched into the old model as the chunk
+ * shader does. The patched model must be the same as the changed chunk
+ * built as a whole. Another world is built in between, so that the
+ * mesher holds its blocks from an earlier call. */
+TEST(mesher, patch_sections) {
+    setup_mesher_types();
+    std::mt19937 random(20);
+    for(int round = 0; round < 32; round++) {
+        const int density = 5 + round * 3;
+        World world;
+        random_world(world, random, density, MESHER_TYPES, false);
+        World other;
+        random_world(other, random, 100 - density, MESHER_TYPES, false);
+        auto old_model = compute_chunk(create_model_data(Vector3i(0, 0, 0), world), mesher_types,
+                                       ALL_SECTIONS);
+
+        const Vector3i block(random() % CHUNK_SIZE, random() % CHUNK_SIZE, random() % CHUNK_SIZE);
+        BlockData changed = *world.get_block(block);
+        changed.type = random() % (MESHER_TYPES + 1);
+        changed.light = random() % 16;
+        world.insert(world.find(Vector3i(0, 0, 0))->second.set(block, changed));
+        const int low = std::max(block[1] - 8, 0);
+        const int high = std::min(block[1] + 1, CHUNK_SIZE - 1);
+        int sections = 0;
+        for(int i = low / CHUNK_SECTION_HEIGHT; i <= high / CHUNK_SECTION_HEIGHT; i++) {
+            sections |= 1 << i;
+        }
+
+        compute_chunk(create_model_data(Vector3i(0, 0, 0), other), mesher_types, ALL_SECTIONS);
+        const ChunkModelData data = create_model_data(Vector3i(0, 0, 0), world);
+        auto part = compute_chunk(data, mesher_types, sections);
+        auto whole = compute_chunk(data, mesher_types, ALL_SECTIONS);
+        CHECK(part->sections == sections);
+        for(int section = 0; section < CHUNK_SECTIONS; section++) {
+            auto &patched = sections & (1 << section) ? part : old_model;
+            CHECK(patched->section_faces[section] == whole->section_faces[section]);
+            CHECK(section_data(*patched, section) == section_data(*whole, section));
+        }
+    }
+}
+
+/* Wait for the workers of the factory to build a model */
+static std::shared_ptr<ChunkModelResult> fetch_model(ChunkModelFactory &factory) {
+    for(int i = 0; i < 500; i++) {
+        auto models = factory.fetch_models();
+        if(!models.empty()) {
+            return models.back();
+        }
+        std::this_thread::sleep_for(std::chrono::milliseconds(10));
+    }
+    return nullptr;
+}
+
+/* A chunk that moves just past the threshold of the half level of
+ * detail keeps its full detail model, so that the sections of a
+ * changed block can still be patched into it */
+TEST(factory, keep_level_within_hysteresis) {
+    setup_mesher_types();
+    const int half = 4;
+    /* The workers of a factory are never stopped, it is kept until
+     * the tests exit */
+    ChunkModelFactory &factory = *new ChunkModelFactory(mesher_types, half, 2 * half);
+    std::mt19937 random(30);
+    World world;
+    const Vector3i chunk(half, 0, 0);
+    for(int x = -1; x <= 1; x++) {
+        for(int y = -1; y <= 1; y++) {
+            for(int z = -1; z <= 1; z++) {
+                world.insert(random_chunk(chunk + Vector3i(x, y, z), random, 30, MESHER_TYPES, false));
+            }
+        }
+    }
+    const Vector3i block = chunk * CHUNK_SIZE + Vector3i(CHUNK_SIZE / 2, CHUNK_SIZE / 2, CHUNK_SIZE / 2);
+    auto change_block = [&]() {
+        BlockData changed = *world.get_block(block);
+        changed.type = changed.type == 1 ? 0 : 1;
+        world.insert(world.find(chunk)->second.set(block, changed));
+        factory.update_block(block, world);
+    };
+
+    factory.refresh_models({chunk}, world);
+    auto model = fetch_model(factory);
+    CHECK(model && model->lod == 0 && model->sections == ALL_SECTIONS);
+
+    /* Past the threshold, but within the hysteresis */
+    factory.update_player_chunk(Vector3i(-1, 0, 0));
+    change_block();
+    model = fetch_model(factory);
+    CHECK(model && model->lod == 0 && model->sections != ALL_SECTIONS);
+
+    /* Past the hysteresis the whole model is built at the next level */
+    factory.update_player_chunk(Vector3i(-(int)LOD_HYSTERESIS - 1, 0, 0));
+    change_block();
+    model = fetch_model(factory);
+    CHECK(model && model->lod == 1 && model->sections == ALL_SECTIONS);
+}
+
+/* The changes of a delta are queued as one model of all the sections
+ * they affect */
+TEST(factory, update_blocks_once) {
+    setup_mesher_types();
+    ChunkModelFactory &factory = *new ChunkModelFactory(mesher_types, 4, 8);
+    std::mt19937 random(31);
+    World world;
+    for(int x = -1; x <= 1; x++) {
+        for(int y = -1; y <= 1; y++) {
+            for(int z = -1; z <= 1; z++) {
+                world.insert(random_chunk(Vector3i(x, y, z), random, 30, MESHER_TYPES, false));
+            }
+        }
+    }
+    factory.refresh_models({Vector3i(0, 0, 0)}, world);
+    CHECK(fetch_model(factory) != nullptr);
+
+    /* Blocks inside of the chunk in the lowest and the highest section */
+    BlockChanges changes;
+    const int heights[2] = {4, CHUNK_SIZE - 4};
+    for(int y : heights) {
+        BlockData block = BlockData();
+        block.type = 1;
+        changes.push_back({16 + y * CHUNK_SIZE + 16 * CHUNK_SIZE * CHUNK_SIZE, block});
+    }
+    world.insert(world.find(Vector3i(0, 0, 0))->second.apply(2, changes));
+    const int processed = factory.total();
+    factory.update_blocks(Vector3i(0, 0, 0), changes, world);
+    auto model = fetch_model(factory);
+    CHECK(model && model->position == Vector3i(0, 0, 0));
+    CHECK(model && model->sections == (ALL_SECTIONS & ~(1 << 1)));
+    CHECK(factory.total() == processed + 1);
+    CHECK(factory.total_coalesced() == 0);
+}
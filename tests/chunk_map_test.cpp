@@ -0,0 +1,191 @@
+#include <random>
+#include <string>
+#include <unordered_map>
+#include <unordered_set>
+#include "chunk_map.h"
+#include "test.h"
+
+/* Tests of ChunkMap and ChunkSet against the standard containers they
+ * replace, and benchmarks of the operations the client does most. */
+
+using namespace konstructs;
+
+typedef std::unordered_map<Vector3i, std::string, matrix_hash<Vector3i>> ReferenceMap;
+
+#define CHUNK_MAP_OPERATIONS 200000
+#define CHUNK_MAP_RADIUS 20
+
+static Vector3i random_position(std::mt19937 &random, const int radius) {
+    return Vector3i(random() % (2 * radius) - radius,
+                    random() % (2 * radius) - radius,
+                    random() % 8 - 4);
+}
+
+static bool same_entries(const ChunkMap<std::string> &map, const ReferenceMap &reference) {
+    if(map.size() != reference.size()) {
+        return false;
+    }
+    size_t n = 0;
+    for(const auto &entry : map) {
+        auto it = reference.find(entry.first);
+        if(it == reference.end() || it->second != entry.second) {
+            return false;
+        }
+        n++;
+    }
+    return n == reference.size();
+}
+
+TEST(chunk_map, random_operations) {
+    std::mt19937 random(1);
+    ChunkMap<std::string> map;
+    ReferenceMap reference;
+    for(int i = 0; i < CHUNK_MAP_OPERATIONS; i++) {
+        Vector3i pos = random_position(random, CHUNK_MAP_RADIUS);
+        switch(random() % 5) {
+        case 0:
+        case 1: {
+            std::string value = std::to_string(i);
+            CHECK(map.insert({pos, value}).second == reference.insert({pos, value}).second);
+            break;
+        }
+        case 2:
+            CHECK(map.erase(pos) == reference.erase(pos));
+            break;
+        case 3: {
+            auto it = map.find(pos);
+            auto jt = reference.find(pos);
+            CHECK((it == map.end()) == (jt == reference.end()));
+            CHECK(it == map.end() || it->second == jt->second);
+            break;
+        }
+        default:
+            map[pos] += "x";
+            reference[pos] += "x";
+        }
+        /* Erase while iterating, as the world does when evicting */
+        if(i % 50000 == 0) {
+            for(auto it = map.begin(); it != map.end();) {
+                if(random() % 3 == 0) {
+                    reference.erase(it->first);
+                    it = map.erase(it);
+                } else {
+                    ++it;
+                }
+            }
+        }
+    }
+    CHECK(same_entries(map, reference));
+
+    ChunkMap<std::string> copy(map);
+    CHECK(same_entries(copy, reference));
+    ChunkMap<std::string> moved(std::move(copy));
+    CHECK(same_entries(moved, reference));
+    CHECK(copy.size() == 0);
+}
+
+TEST(chunk_map, copy_after_erase) {
+    std::mt19937 random(2);
+    for(int round = 0; round < 200; round++) {
+        ChunkMap<std::string> map;
+        ReferenceMap reference;
+        /* Few positions, so that entries are probed past erased slots */
+        for(int i = 0; i < 2000; i++) {
+            Vector3i pos(random() % 12, random() % 12, random() % 4);
+            if(random() % 3 == 0) {
+                map.erase(pos);
+                reference.erase(pos);
+            } else {
+                map[pos] = std::to_string(i);
+                reference[pos] = std::to_string(i);
+            }
+        }
+        ChunkMap<std::string> assigned;
+        assigned = map;
+        ChunkMap<std::string> constructed(map);
+        CHECK(same_entries(assigned, reference));
+        CHECK(same_entries(constructed, reference));
+        for(const auto &entry : reference) {
+            CHECK(assigned.count(entry.first) == 1);
+            CHECK(constructed.count(entry.first) == 1);
+        }
+    }
+}
+
+TEST(chunk_map, set_positions) {
+    /* Positions far from the origin and on both sides of it */
+    ChunkSet set;
+    std::unordered_set<Vector3i, matrix_hash<Vector3i>> reference;
+    const int far = (1 << 20) - 3;
+    for(int x = -2; x <= 2; x++) {
+        for(int y = -2; y <= 2; y++) {
+            Vector3i a(x, y, 0), b(x * far / 2, -far, y), c(far, x, -far + y);
+            set.insert(a); set.insert(b); set.insert(c);
+            reference.insert(a); reference.insert(b); reference.insert(c);
+        }
+    }
+    CHECK(set.size() == reference.size());
+    for(const auto &pos : reference) {
+        CHECK(set.count(pos) == 1);
+    }
+    CHECK(set.count(Vector3i(3, 3, 0)) == 0);
+}
+
+/* A cube of chunks around the player, looked up with a margin that
+ * is missing, as the mesher and the chunk requests do */
+BENCHMARK(chunk_map, operations) {
+    typedef std::unordered_map<Vector3i, int, matrix_hash<Vector3i>> UnorderedMap;
+    const int r = CHUNK_MAP_RADIUS;
+    const int chunks = 8 * r * r * r;
+    ChunkMap<int> map;
+    UnorderedMap unordered;
+    long sum = 0;
+
+    double map_insert = test::measure([&] {
+        map = ChunkMap<int>();
+        for(int x = -r; x < r; x++)
+            for(int y = -r; y < r; y++)
+                for(int z = -r; z < r; z++)
+                    map.insert({Vector3i(x, y, z), x});
+    });
+    double unordered_insert = test::measure([&] {
+        unordered = UnorderedMap();
+        for(int x = -r; x < r; x++)
+            for(int y = -r; y < r; y++)
+                for(int z = -r; z < r; z++)
+                    unordered.insert({Vector3i(x, y, z), x});
+    });
+
+    double map_find = test::measure([&] {
+        for(int x = -r - 2; x < r + 2; x++)
+            for(int y = -r - 2; y < r + 2; y++)
+                for(int z = -r - 2; z < r + 2; z++) {
+                    auto it = map.find(Vector3i(x, y, z));
+                    if(it != map.end()) sum += it->second;
+                }
+    });
+    double unordered_find = test::measure([&] {
+        for(int x = -r - 2; x < r + 2; x++)
+            for(int y = -r - 2; y < r + 2; y++)
+                for(int z = -r - 2; z < r + 2; z++) {
+                    auto it = unordered.find(Vector3i(x, y, z));
+                    if(it != unordered.end()) sum += it->second;
+                }
+    });
+
+    double map_iterate = test::measure([&] {
+        for(const auto &entry : map) sum += entry.second;
+    });
+    double unordered_iterate = test::measure([&] {
+        for(const auto &entry : unordered) sum += entry.second;
+    });
+
+    const int lookups = 8 * (r + 2) * (r + 2) * (r + 2);
+    printf("%d chunks (%ld)\n", chunks, sum % 2);
+    printf("insert  ChunkMap %6.1f ns, unordered_map %6.1f ns\n",
+           map_insert * 1e6 / chunks, unordered_insert * 1e6 / chunks);
+    printf("find    ChunkMap %6.1f ns, unordered_map %6.1f ns\n",
+           map_find * 1e6 / lookups, unordered_find * 1e6 / lookups);
+    printf("iterate ChunkMap %6.1f ns, unordered_map %6.1f ns\n",
+           map_iterate * 1e6 / chunks, unordered_iterate * 1e6 / chunks);
+}
@@ -0,0 +1,122 @@
+#include <cstdio>
+#include <cstring>
+#include <string>
+#include <vector>
+#include "chunk_store.h"
+#include "util.h"
+#include "test.h"
+
+/* Tests of the chunk store across sessions, and of chunks that can
+ * not be decoded completely */
+
+using namespace konstructs;
+
+#define STORE_HOST "store.test"
+
+static ChunkData stone_chunk(const Vector3i &position, const uint32_t revision) {
+    BlockData *blocks = allocate_chunk_blocks();
+    for(int i = 0; i < CHUNK_BLOCKS; i++) {
+        blocks[i] = BlockData();
+        blocks[i].type = 1 + i % 3;
+    }
+    return ChunkData(position, revision, blocks);
+}
+
+static std::string store_file() {
+    return data_directory() + "/" + safe_file_name(STORE_HOST) + ".chunks";
+}
+
+static long file_length(const std::string &path) {
+    FILE *f = fopen(path.c_str(), "rb");
+    if(!f) {
+        return -1;
+    }
+    fseek(f, 0, SEEK_END);
+    long length = ftell(f);
+    fclose(f);
+    return length;
+}
+
+/* The stored chunk decodes to the blocks of the chunk */
+static bool stored_as(ChunkStore &store, const ChunkData &chunk) {
+    std::vector<char> data;
+    int codec;
+    if(!store.get(chunk.position, data, codec)) {
+        return false;
+    }
+    std::unordered_map<uint16_t, std::shared_ptr<BlockData>> cached_data;
+    ChunkData stored(chunk.position, data.data(), data.size(), cached_data, codec);
+    return stored.complete && stored.revision == chunk.revision &&
+        memcmp(stored.types(), chunk.types(), CHUNK_BLOCKS * sizeof(uint16_t)) == 0;
+}
+
+TEST(store, drop_torn_record) {
+    test::use_temporary_home();
+    ChunkData a = stone_chunk(Vector3i(0, 0, 0), 3);
+    ChunkData b = stone_chunk(Vector3i(1, 0, 0), 4);
+    {
+        ChunkStore store;
+        CHECK(store.open(STORE_HOST));
+        store.put(a);
+        store.put(b);
+    }
+    long length = file_length(store_file());
+
+    /* A newer record of a that claims more data than was written,
+     * the complete record before it must be kept */
+    FILE *f = fopen(store_file().c_str(), "ab");
+    int32_t header[6] = {0, 0, 0, 5, CODEC_ZLIB, 1000};
+    fwrite(header, sizeof(int32_t), 6, f);
+    fwrite("torn....", 1, 8, f);
+    fclose(f);
+
+    ChunkStore store;
+    CHECK(store.open(STORE_HOST));
+    CHECK(stored_as(store, a));
+    CHECK(stored_as(store, b));
+    store.close();
+    /* The store was rewritten without the torn record */
+    CHECK(file_length(store_file()) == length);
+}
+
+TEST(store, discard_across_sessions) {
+    test::use_temporary_home();
+    ChunkData a = stone_chunk(Vector3i(0, 0, 0), 3);
+    ChunkData b = stone_chunk(Vector3i(0, 1, 0), 4);
+    {
+        ChunkStore store;
+        CHECK(store.open(STORE_HOST));
+        store.put(a);
+        store.put(b);
+    }
+    {
+        ChunkStore store;
+        CHECK(store.open(STORE_HOST));
+        store.discard(a.position);
+        CHECK(!store.contains(a.position));
+    }
+    ChunkStore store;
+    CHECK(store.open(STORE_HOST));
+    CHECK(!store.contains(a.position));
+    CHECK(stored_as(store, b));
+
+    /* A chunk stored again after it was discarded is kept */
+    store.put(a);
+    store.close();
+    CHECK(store.open(STORE_HOST));
+    CHECK(stored_as(store, a));
+}
+
+TEST(store, report_short_chunk) {
+    std::unordered_map<uint16_t, std::shared_ptr<BlockData>> cached_data;
+    ChunkData chunk = stone_chunk(Vector3i(0, 0, 0), 7);
+    std::vector<char> data = chunk.encode();
+    ChunkData whole(chunk.position, data.data(), data.size(), cached_data);
+    CHECK(whole.complete);
+
+    /* Cut off in the middle of the compressed blocks */
+    data.resize(BLOCKS_HEADER_SIZE + (data.size() - BLOCKS_HEADER_SIZE) / 2);
+    ChunkData cut(chunk.position, data.data(), data.size(), cached_data);
+    CHECK(!cut.complete);
+    CHECK(cut.revision == 7);
+}
@@ -0,0 +1,159 @@
+#include <cstring>
+#include <random>
+#include <vector>
+#include "chunk.h"
+#include "test.h"
+
+/* Tests and benchmarks of unpacking the blocks of a chunk. The SSSE3
+ * version must give the same blocks, types and flags as the scalar one
+ * for any input, where the CPU has SSSE3. */
+
+using namespace konstructs;
+
+#define UNPACK_TYPE 3
+#define UNPACK_ROUNDS 200
+
+struct Unpacked {
+    std::vector<BlockData> blocks;
+    std::vector<uint16_t> types;
+    bool uniform;
+    bool cached;
+};
+
+/* Packed blocks of the chunk type and full ambient light, where one
+ * in every odds bytes is random */
+static std::vector<uint8_t> packed_blocks(std::mt19937 &random, const int count, const int odds) {
+    std::vector<uint8_t> packed(count * BLOCK_SIZE);
+    BlockData block = BlockData();
+    block.type = UNPACK_TYPE;
+    block.health = 2047;
+    block.ambient = AMBIENT_LIGHT_FULL;
+    for(int i = 0; i < count; i++) {
+        write_block(block, packed.data() + i * BLOCK_SIZE);
+    }
+    for(auto &byte : packed) {
+        if(odds > 0 && random() % odds == 0) {
+            byte = random() % 256;
+        }
+    }
+    return packed;
+}
+
+static Unpacked unpack(const bool ssse3, const std::vector<uint8_t> &packed) {
+    Unpacked u;
+    int count = packed.size() / BLOCK_SIZE;
+    u.blocks.resize(count);
+    u.types.resize(count);
+    u.uniform = true;
+    u.cached = true;
+    if(ssse3) {
+        unpack_blocks_ssse3(packed.data(), count, u.blocks.data(), u.types.data(),
+                            UNPACK_TYPE, u.uniform, u.cached);
+    } else {
+        unpack_blocks_scalar(packed.data(), count, u.blocks.data(), u.types.data(),
+                             UNPACK_TYPE, u.uniform, u.cached);
+    }
+    return u;
+}
+
+static bool same_block(const BlockData &a, const BlockData &b) {
+    return a.type == b.type && a.health == b.health && a.direction == b.direction &&
+        a.rotation == b.rotation && a.ambient == b.ambient && a.r == b.r &&
+        a.g == b.g && a.b == b.b && a.light == b.light;
+}
+
+static bool same_unpacked(const Unpacked &a, const Unpacked &b) {
+    if(a.uniform != b.uniform || a.cached != b.cached || a.types != b.types) {
+        return false;
+    }
+    for(size_t i = 0; i < a.blocks.size(); i++) {
+        if(!same_block(a.blocks[i], b.blocks[i])) {
+            return false;
+        }
+    }
+    return true;
+}
+
+TEST(unpack, scalar_reads_blocks) {
+    std::mt19937 random(0);
+    std::vector<uint8_t> packed = packed_blocks(random, 64, 3);
+    Unpacked u = unpack(false, packed);
+    for(int i = 0; i < 64; i++) {
+        CHECK(same_block(u.blocks[i], read_block(packed.data() + i * BLOCK_SIZE)));
+        CHECK(u.types[i] == u.blocks[i].type);
+    }
+}
+
+TEST(unpack, ssse3_matches_scalar) {
+    if(!has_ssse3()) {
+        return;
+    }
+    std::mt19937 random(1);
+    /* Counts that do not fill the last four blocks, and chunks that are
+     * all random, mostly uniform, or uniform and cached */
+    const int odds[] = {1, 7, 500, 0};
+    for(int round = 0; round < UNPACK_ROUNDS; round++) {
+        int count = round < 16 ? round : 1 + random() % 256;
+        for(int o : odds) {
+            std::vector<uint8_t> packed = packed_blocks(random, count, o);
+            CHECK(same_unpacked(unpack(true, packed), unpack(false, packed)));
+        }
+    }
+    for(int o : odds) {
+        std::vector<uint8_t> packed = packed_blocks(random, CHUNK_BLOCKS, o);
+        CHECK(same_unpacked(unpack(true, packed), unpack(false, packed)));
+    }
+}
+
+TEST(unpack, ssse3_flags) {
+    if(!has_ssse3()) {
+        return;
+    }
+    std::mt19937 random(2);
+    std::vector<uint8_t> packed = packed_blocks(random, CHUNK_BLOCKS, 0);
+    Unpacked u = unpack(true, packed);
+    CHECK(u.uniform && u.cached);
+
+    /* One block of another type, in the vector part and in the tail */
+    const int changed[] = {0, 5, CHUNK_BLOCKS - 1};
+    for(int i : changed) {
+        std::vector<uint8_t> other = packed;
+        other[i * BLOCK_SIZE + 1] = 1;
+        u = unpack(true, other);
+        CHECK(!u.uniform && !u.cached);
+
+        /* A lit block is uniform but not cached */
+        other = packed;
+        other[i * BLOCK_SIZE + 6] = 1;
+        u = unpack(true, other);
+        CHECK(u.uniform && !u.cached);
+
+        other = packed;
+        other[i * BLOCK_SIZE + 4] = AMBIENT_LIGHT_FULL - 1;
+        u = unpack(true, other);
+        CHECK(u.uniform && !u.cached);
+    }
+}
+
+BENCHMARK(unpack, chunk) {
+    std::mt19937 random(3);
+    std::vector<uint8_t> packed = packed_blocks(random, CHUNK_BLOCKS, 7);
+    Unpacked u = unpack(false, packed);
+    for(int ssse3 = 0; ssse3 < 2; ssse3++) {
+        if(ssse3 && !has_ssse3()) {
+            continue;
+        }
+        double ms = test::measure([&] {
+            u.uniform = true;
+            u.cached = true;
+            if(ssse3) {
+                unpack_blocks_ssse3(packed.data(), CHUNK_BLOCKS, u.blocks.data(), u.types.data(),
+                                    UNPACK_TYPE, u.uniform, u.cached);
+            } else {
+                unpack_blocks_scalar(packed.data(), CHUNK_BLOCKS, u.blocks.data(), u.types.data(),
+                                     UNPACK_TYPE, u.uniform, u.cached);
+            }
+        });
+        printf("%-6s %.3f ms per chunk\n", ssse3 ? "ssse3" : "scalar", ms);
+    }
+}
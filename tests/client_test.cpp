@@ -0,0 +1,358 @@
+#if !defined(_WIN32)
+#include <arpa/inet.h>
+#include <netinet/in.h>
+#include <sys/socket.h>
+#include <unistd.h>
+#include <algorithm>
+#include <atomic>
+#include <chrono>
+#include <cstdio>
+#include <cstring>
+#include <mutex>
+#include <string>
+#include <thread>
+#include <vector>
+#include "client.h"
+#include "test.h"
+
+/* Tests of the client against a stand-in server on the loopback
+ * interface. The server answers chunk requests with generated chunks
+ * and keeps every request it got, so that tests can check what the
+ * client asked for. */
+
+using namespace konstructs;
+
+/* Longest time a test waits for the client */
+#define CLIENT_TIMEOUT_MS 5000
+
+class StandInServer {
+public:
+    StandInServer() : chunks_sent(0), not_modified_sent(0), connection(-1) {
+        listener = socket(AF_INET, SOCK_STREAM, 0);
+        struct sockaddr_in address;
+        memset(&address, 0, sizeof(address));
+        address.sin_family = AF_INET;
+        address.sin_addr.s_addr = htonl(INADDR_LOOPBACK);
+        address.sin_port = 0;
+        bind(listener, (struct sockaddr *)&address, sizeof(address));
+        listen(listener, 1);
+        socklen_t length = sizeof(address);
+        getsockname(listener, (struct sockaddr *)&address, &length);
+        port = ntohs(address.sin_port);
+        thread = new std::thread(&StandInServer::serve, this);
+    }
+
+    /* Revision of the chunk at a position, 1 unless changed */
+    uint32_t revision(const Vector3i &pos) {
+        std::lock_guard<std::mutex> lock(mutex);
+        auto it = revisions.find(pos);
+        return it != revisions.end() ? it->second : 1;
+    }
+
+    void set_revision(const Vector3i &pos, const uint32_t revision) {
+        std::lock_guard<std::mutex> lock(mutex);
+        revisions[pos] = revision;
+    }
+
+    void send_packet(const char type, const std::string &payload) {
+        std::lock_guard<std::mutex> lock(send_mutex);
+        uint32_t size = htonl(payload.size() + 1);
+        send_all((const char *)&size, sizeof(size));
+        send_all(&type, 1);
+        send_all(payload.data(), payload.size());
+    }
+
+    /* Send changes of a chunk based on a revision */
+    void send_delta(const Vector3i &pos, const uint32_t base, const uint32_t revision,
+                    const BlockChanges &changes) {
+        int32_t header[5] = {(int32_t)htonl(pos[0]), (int32_t)htonl(pos[1]), (int32_t)htonl(pos[2]),
+                             (int32_t)htonl(base), (int32_t)htonl(revision)};
+        std::string payload((const char *)header, sizeof(header));
+        for(const auto &change : changes) {
+            uint8_t data[2 + BLOCK_SIZE];
+            data[0] = change.first >> 8;
+            data[1] = change.first & 0xFF;
+            write_block(change.second, data + 2);
+            payload.append((const char *)data, sizeof(data));
+        }
+        send_packet('B', payload);
+    }
+
+    /* Tell the client that a chunk changed */
+    void chunk_updated(const Vector3i &pos) {
+        send_packet('c', position_string(pos));
+    }
+
+    std::vector<std::string> requests_of(const Vector3i &pos) {
+        std::lock_guard<std::mutex> lock(mutex);
+        std::vector<std::string> result;
+        std::string prefix = "C" + position_string(pos);
+        for(const std::string &request : requests) {
+            if(request == prefix || request.compare(0, prefix.size() + 1, prefix + ",") == 0) {
+                result.push_back(request);
+            }
+        }
+        return result;
+    }
+
+    bool chunk_sent(const Vector3i &pos) {
+        std::lock_guard<std::mutex> lock(mutex);
+        return sent.count(pos) == 1;
+    }
+
+    std::string last_request_of(const Vector3i &pos) {
+        std::vector<std::string> found = requests_of(pos);
+        return found.empty() ? "" : found.back();
+    }
+
+    std::vector<std::string> chunk_requests() {
+        std::lock_guard<std::mutex> lock(mutex);
+        std::vector<std::string> result;
+        for(const std::string &request : requests) {
+            if(request[0] == 'C') {
+                result.push_back(request);
+            }
+        }
+        return result;
+    }
+
+    int port;
+    std::atomic<int> chunks_sent;
+    std::atomic<int> not_modified_sent;
+private:
+    static std::string position_string(const Vector3i &pos) {
+        return "," + std::to_string(pos[0]) + "," + std::to_string(pos[1]) + "," +
+            std::to_string(pos[2]);
+    }
+
+    void send_all(const char *data, size_t size) {
+        while(size > 0) {
+            ssize_t n = send(connection, data, size, 0);
+            if(n <= 0) {
+                return;
+            }
+            data += n;
+            size -= n;
+        }
+    }
+
+    bool recv_all(char *data, size_t size) {
+        while(size > 0) {
+            ssize_t n = recv(connection, data, size, 0);
+            if(n <= 0) {
+                return false;
+            }
+            data += n;
+            size -= n;
+        }
+        return true;
+    }
+
+    void send_chunk(const Vector3i &pos, const uint32_t revision) {
+        BlockData *blocks = allocate_chunk_blocks();
+        for(int i = 0; i < CHUNK_BLOCKS; i++) {
+            blocks[i] = BlockData();
+            blocks[i].type = i % 3 == 0 ? 1 : 0;
+            blocks[i].ambient = AMBIENT_LIGHT_FULL;
+        }
+        std::vector<char> data = ChunkData(pos, revision, blocks).encode();
+        std::string payload(3 * sizeof(int32_t), '\0');
+        int32_t header[3] = {(int32_t)htonl(pos[0]), (int32_t)htonl(pos[1]), (int32_t)htonl(pos[2])};
+        memcpy(&payload[0], header, sizeof(header));
+        payload.append(data.begin(), data.end());
+        send_packet('C', payload);
+        std::lock_guard<std::mutex> lock(mutex);
+        sent.insert(pos);
+    }
+
+    void handle_chunk_request(const std::string &request) {
+        int p, q, k;
+        unsigned int held;
+        int fields = sscanf(request.c_str(), "C,%d,%d,%d,%u", &p, &q, &k, &held);
+        if(fields < 3) {
+            return;
+        }
+        Vector3i pos(p, q, k);
+        uint32_t current = revision(pos);
+        if(fields == 4 && held == current) {
+            send_packet('N', position_string(pos));
+            not_modified_sent++;
+        } else {
+            send_chunk(pos, current);
+            chunks_sent++;
+        }
+    }
+
+    void serve() {
+        connection = accept(listener, nullptr, nullptr);
+        while(true) {
+            uint32_t size;
+            if(!recv_all((char *)&size, sizeof(size))) {
+                return;
+            }
+            std::string request(ntohl(size), '\0');
+            if(!recv_all(&request[0], request.size())) {
+                return;
+            }
+            {
+                std::lock_guard<std::mutex> lock(mutex);
+                requests.push_back(request);
+            }
+            if(request[0] == 'C') {
+                handle_chunk_request(request);
+            }
+        }
+    }
+
+    int listener;
+    int connection;
+    std::thread *thread;
+    std::mutex mutex;
+    std::mutex send_mutex;
+    std::vector<std::string> requests;
+    ChunkMap<uint32_t> revisions;
+    ChunkSet sent;
+};
+
+/* Wait until the condition holds, or fail after a while */
+static bool wait_for(const std::function<bool()> &condition) {
+    auto start = std::chrono::steady_clock::now();
+    while(!condition()) {
+        if(std::chrono::steady_clock::now() - start > std::chrono::milliseconds(CLIENT_TIMEOUT_MS)) {
+            return false;
+        }
+        std::this_thread::sleep_for(std::chrono::milliseconds(10));
+    }
+    return true;
+}
+
+/* Neither the client nor the server are ever destroyed, the client
+ * has no way to stop its threads so both run until the tests end */
+static StandInServer &start_server() {
+    return *new StandInServer();
+}
+
+static Client *connect_client(const StandInServer &server) {
+    test::use_temporary_home();
+    Client *client = new Client(false);
+    client->open_connection("tester", "hash", "127.0.0.1", server.port);
+    client->set_connected(true);
+    client->set_logged_in(true);
+    client->set_player_chunk(Vector3i(0, 0, 0));
+    client->set_radius(1);
+    return client;
+}
+
+/* Collect the chunks received by the client */
+static void receive(Client *client, ChunkMap<uint32_t> &revisions) {
+    for(const ChunkData &chunk : client->receive_chunks(100)) {
+        revisions[chunk.position] = chunk.revision;
+    }
+}
+
+/* Wait until the client has received the chunks at both positions */
+static bool receive_both(Client *client, ChunkMap<uint32_t> &revisions,
+                         const Vector3i &a, const Vector3i &b) {
+    return wait_for([&] {
+        receive(client, revisions);
+        return revisions.count(a) == 1 && revisions.count(b) == 1;
+    });
+}
+
+TEST(server, revalidate_held_chunk) {
+    StandInServer &server = start_server();
+    Client *client = connect_client(server);
+    const Vector3i origin(0, 0, 0);
+    ChunkMap<uint32_t> received;
+    CHECK(receive_both(client, received, origin, Vector3i(-1, 0, 0)));
+
+    /* Chunks the client never held are requested without a revision */
+    for(const std::string &request : server.chunk_requests()) {
+        CHECK(std::count(request.begin(), request.end(), ',') == 3);
+    }
+
+    /* A changed chunk is asked for with the revision that is held,
+     * and the server answers that it is not modified */
+    int not_modified = server.not_modified_sent;
+    server.chunk_updated(origin);
+    CHECK(wait_for([&] { return server.requests_of(origin).size() == 2; }));
+    CHECK(server.last_request_of(origin) == "C,0,0,0,1");
+    CHECK(wait_for([&] { return server.not_modified_sent == not_modified + 1; }));
+
+    /* The held chunk is kept, not requested or received again */
+    std::this_thread::sleep_for(std::chrono::milliseconds(200));
+    received.clear();
+    receive(client, received);
+    CHECK(received.find(origin) == received.end());
+    CHECK(server.requests_of(origin).size() == 2);
+}
+
+TEST(server, refetch_changed_chunk) {
+    StandInServer &server = start_server();
+    Client *client = connect_client(server);
+    const Vector3i changed(-1, 0, 0);
+    ChunkMap<uint32_t> received;
+    CHECK(receive_both(client, received, Vector3i(0, 0, 0), changed));
+    CHECK(received.count(changed) == 1 && received[changed] == 1);
+
+    /* A newer revision on the server is sent in full */
+    server.set_revision(changed, 2);
+    server.chunk_updated(changed);
+    received.clear();
+    CHECK(wait_for([&] { receive(client, received); return received.find(changed) != received.end(); }));
+    CHECK(received.count(changed) == 1 && received[changed] == 2);
+    CHECK(server.last_request_of(changed) == "C,-1,0,0,1");
+
+    /* The next request carries the new revision */
+    server.chunk_updated(changed);
+    CHECK(wait_for([&] { return server.requests_of(changed).size() == 3; }));
+    CHECK(server.last_request_of(changed) == "C,-1,0,0,2");
+}
+
+TEST(delta, high_revision) {
+    /* Revisions with the high bit set in every byte of the header */
+    const uint32_t base = 0x80FF80FF;
+    const Vector3i changed(0, 0, 0);
+    StandInServer &server = start_server();
+    server.set_revision(changed, base);
+    Client *client = connect_client(server);
+    CHECK(wait_for([&] { return server.chunk_sent(changed); }));
+
+    /* The chunk is still queued in the client, so the delta is applied
+     * to it there instead of refetching the chunk */
+    BlockData block = BlockData();
+    block.type = 7;
+    block.health = 1000;
+    block.ambient = AMBIENT_LIGHT_FULL;
+    server.set_revision(changed, base + 1);
+    server.send_delta(changed, base, base + 1, {{5, block}});
+
+    /* The update is handled after the delta, the client then holds the
+     * revision of the delta */
+    server.chunk_updated(changed);
+    CHECK(wait_for([&] { return server.requests_of(changed).size() == 2; }));
+    CHECK(server.last_request_of(changed) == "C,0,0,0," + std::to_string(base + 1));
+
+    optional<ChunkData> chunk;
+    for(const ChunkData &c : client->receive_chunks(100)) {
+        if(c.position == changed) {
+            CHECK(!chunk);
+            chunk = c;
+        }
+    }
+    CHECK(chunk && chunk->revision == base + 1);
+    CHECK(chunk && chunk->blocks.get()[5].type == 7 && chunk->blocks.get()[5].health == 1000);
+    CHECK(client->receive_deltas().empty());
+}
+
+TEST(delta, decode_high_revision) {
+    BlockData *blocks = allocate_chunk_blocks();
+    for(int i = 0; i < CHUNK_BLOCKS; i++) {
+        blocks[i] = BlockData();
+    }
+    std::vector<char> data = ChunkData(Vector3i(1, 2, 3), 0xFEDCBA98, blocks).encode();
+    std::unordered_map<uint16_t, std::shared_ptr<BlockData>> cached;
+    ChunkData chunk(Vector3i(1, 2, 3), data.data(), data.size(), cached);
+    CHECK(chunk.revision == 0xFEDCBA98);
+}
+#endif
@@ -0,0 +1,125 @@
+#include <cstring>
+#include <random>
+#include <vector>
+#if defined(KONSTRUCTS_LZ4)
+#include <lz4.h>
+#endif
+#if defined(KONSTRUCTS_ZSTD)
+#include <zstd.h>
+#endif
+#include "chunk.h"
+#include "compress.h"
+#include "test.h"
+
+/* Tests and benchmarks of the chunk payload codecs. The payloads are
+ * the blocks of generated terrain, layers of stone, dirt and grass
+ * below air, with caves, ore and light the way the server sends them. */
+
+using namespace konstructs;
+
+#define CODEC_CHUNKS 16
+
+static std::vector<char> terrain_blocks(const int seed) {
+    std::mt19937 random(seed);
+    std::vector<char> packed(BLOCK_BUFFER_SIZE);
+    /* Chunks from below the ground up to the sky */
+    int ground = (seed % 4) * CHUNK_SIZE / 2 - CHUNK_SIZE / 2;
+    for(int i = 0; i < CHUNK_BLOCKS; i++) {
+        /* Same order as CHUNK_FOR_EACH, y is the height */
+        int y = (i / CHUNK_SIZE) % CHUNK_SIZE;
+        int height = ground + (int)(random() % 3);
+        BlockData block = BlockData();
+        if(y > height) {
+            block.type = 0;
+            block.ambient = AMBIENT_LIGHT_FULL;
+        } else if(y == height) {
+            block.type = 3;
+            block.ambient = AMBIENT_LIGHT_FULL;
+        } else if(y > height - 4) {
+            block.type = 2;
+        } else if(random() % 50 == 0) {
+            /* Caves are lit by torches */
+            block.type = 0;
+            block.light = random() % 16;
+            block.r = block.light;
+            block.g = block.light / 2;
+        } else {
+            block.type = random() % 40 == 0 ? 5 + random() % 4 : 1;
+        }
+        block.health = 2047;
+        write_block(block, (uint8_t *)packed.data() + i * BLOCK_SIZE);
+    }
+    return packed;
+}
+
+static std::vector<char> compress(const int codec, const std::vector<char> &raw) {
+    std::vector<char> out;
+    switch(codec) {
+#if defined(KONSTRUCTS_LZ4)
+    case CODEC_LZ4: {
+        out.resize(LZ4_compressBound(raw.size()));
+        out.resize(LZ4_compress_default(raw.data(), out.data(), raw.size(), out.size()));
+        break;
+    }
+#endif
+#if defined(KONSTRUCTS_ZSTD)
+    case CODEC_ZSTD: {
+        out.resize(ZSTD_compressBound(raw.size()));
+        out.resize(ZSTD_compress(out.data(), out.size(), raw.data(), raw.size(), 3));
+        break;
+    }
+#endif
+    default:
+        deflate_data(raw.data(), raw.size(), out);
+    }
+    return out;
+}
+
+TEST(codec, round_trip) {
+    for(int codec : supported_codecs()) {
+        for(int seed = 0; seed < 4; seed++) {
+            std::vector<char> raw = terrain_blocks(seed);
+            std::vector<char> compressed = compress(codec, raw);
+
+            std::vector<char> streamed;
+            int total = decompress_stream(codec, compressed.data(), compressed.size(),
+                                          [&](const char *data, int size) {
+                                              streamed.insert(streamed.end(), data, data + size);
+                                          });
+            CHECK(total == BLOCK_BUFFER_SIZE);
+            CHECK(streamed == raw);
+
+            std::vector<char> whole(BLOCK_BUFFER_SIZE);
+            CHECK(decompress_data(codec, compressed.data(), compressed.size(),
+                                  whole.data(), whole.size()) == BLOCK_BUFFER_SIZE);
+            CHECK(whole == raw);
+        }
+    }
+}
+
+BENCHMARK(codec, decompress) {
+    for(int codec : supported_codecs()) {
+        std::vector<std::vector<char>> payloads;
+        size_t compressed_size = 0;
+        for(int seed = 0; seed < CODEC_CHUNKS; seed++) {
+            payloads.push_back(compress(codec, terrain_blocks(seed)));
+            compressed_size += payloads.back().size();
+        }
+        /* Copied out of the window, as the chunk decoder does */
+        static std::vector<char> out(BLOCK_BUFFER_SIZE);
+        double ms = test::measure([&] {
+            for(auto &payload : payloads) {
+                int offset = 0;
+                decompress_stream(codec, payload.data(), payload.size(),
+                                  [&](const char *data, int size) {
+                                      memcpy(out.data() + offset, data, size);
+                                      offset += size;
+                                  });
+            }
+        });
+        double raw_size = (double)CODEC_CHUNKS * BLOCK_BUFFER_SIZE;
+        printf("%-5s ratio %5.1f, %.3f ms per chunk, %.0f MB/s\n", codec_name(codec),
+               raw_size / compressed_size, ms / CODEC_CHUNKS,
+               raw_size / (ms / 1000.0) / (1024 * 1024));
+    }
+}
@@ -0,0 +1,112 @@
+#include <cstdlib>
+#include <cstring>
+#include <string>
+#if defined(_WIN32)
+#include <direct.h>
+#include <io.h>
+#endif
+#include <vector>
+#include "test.h"
+
+/* Runs the tests of the groups given on the command line, or of all
+ * groups. With --benchmark the benchmarks of the groups are run
+ * instead. Returns non-zero if any check failed. */
+
+namespace konstructs {
+    namespace test {
+        struct Test {
+            const char *group;
+            const char *name;
+            TestFunction function;
+            bool benchmark;
+        };
+
+        /* Filled in by static initializers, so it must be created on first use */
+        static std::vector<Test> &tests() {
+            static std::vector<Test> registered;
+            return registered;
+        }
+
+        static int failures = 0;
+
+        int add(const char *group, const char *name, const TestFunction &f,
+                const bool benchmark) {
+            tests().push_back({group, name, f, benchmark});
+            return (int)tests().size();
+        }
+
+        void fail(const char *file, const int line, const char *expression) {
+            failures++;
+            /* Checks in loops could otherwise flood the output */
+            if(failures <= 20) {
+                printf("%s:%d: check failed: %s\n", file, line, expression);
+            }
+        }
+
+        double measure(const std::function<void()> &f) {
+            auto start = std::chrono::steady_clock::now();
+            int runs = 0;
+            double elapsed = 0.0;
+            do {
+                f();
+                runs++;
+                elapsed = std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+            } while(elapsed < 1.0);
+            return elapsed * 1000.0 / runs;
+        }
+
+        void use_temporary_home() {
+#if defined(_WIN32)
+            char dir[] = "konstructs-test-XXXXXX";
+            _mktemp_s(dir, sizeof(dir));
+            _mkdir(dir);
+            _putenv_s("APPDATA", dir);
+#else
+            char dir[] = "/tmp/konstructs-test-XXXXXX";
+            if(mkdtemp(dir)) {
+                setenv("HOME", dir, 1);
+            }
+#endif
+        }
+    };
+};
+
+using namespace konstructs::test;
+
+int main(int argc, char **argv) {
+    bool benchmark = false;
+    std::vector<std::string> groups;
+    for(int i = 1; i < argc; i++) {
+        if(strcmp(argv[i], "--benchmark") == 0) {
+            benchmark = true;
+        } else {
+            groups.push_back(argv[i]);
+        }
+    }
+
+    int run = 0;
+    for(const Test &t : tests()) {
+        if(t.benchmark != benchmark) {
+            continue;
+        }
+        bool selected = groups.empty();
+        for(const std::string &group : groups) {
+            if(group == t.group) {
+                selected = true;
+            }
+        }
+        if(!selected) {
+            continue;
+        }
+        int before = failures;
+        t.function();
+        printf("%s %s.%s\n", failures == before ? "ok  " : "FAIL", t.group, t.name);
+        run++;
+    }
+
+    if(run == 0) {
+        printf("No tests selected\n");
+        return 1;
+    }
+    return failures > 0 ? 1 : 0;
+}
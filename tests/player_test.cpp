@@ -0,0 +1,108 @@
+#include <algorithm>
+#include <cmath>
+#include "player.h"
+#include "test.h"
+
+/* Tests of the player physics in a world built by hand, without a
+ * window or a server. The ground is every block up to y = 10 and a
+ * wall stands at x = 20, the top of the ground is at y = 10.5. */
+
+using namespace konstructs;
+
+#define GROUND_HEIGHT 10
+#define WALL_X 20
+#define NEAR_DISTANCE 0.125f
+/* Standing on the ground, the box is 1.5 - 2 * NEAR_DISTANCE below the position */
+#define STANDING_Y 11.75f
+/* Stopped by the wall, the box is 0.5 - 2 * NEAR_DISTANCE in front of the position */
+#define WALL_STOP_X 19.25f
+
+static BlockTypeInfo physics_types;
+
+static World &physics_world() {
+    static World world;
+    static bool built = false;
+    if(!built) {
+        physics_types.types[0].flags = block_flags(false, false, true, false, STATE_GAS);
+        physics_types.types[1].flags = block_flags(false, true, false, false, STATE_SOLID);
+        for(int x = -1; x <= 1; x++) {
+            for(int y = -1; y <= 1; y++) {
+                for(int z = -1; z <= 1; z++) {
+                    Vector3i chunk(x, y, z);
+                    BlockData *blocks = allocate_chunk_blocks();
+                    for(int i = 0; i < CHUNK_BLOCKS; i++) {
+                        Vector3i pos = block_position(chunk, i);
+                        blocks[i] = BlockData();
+                        blocks[i].type = pos[1] <= GROUND_HEIGHT || pos[0] == WALL_X ? 1 : 0;
+                        blocks[i].ambient = AMBIENT_LIGHT_FULL;
+                    }
+                    world.insert(ChunkData(chunk, 1, blocks));
+                }
+            }
+        }
+        built = true;
+    }
+    return world;
+}
+
+/* Run the physics for a time in frames of dt seconds */
+static void run(Player &player, const float time, const float dt, const int sx,
+                const bool jump = false) {
+    const World &world = physics_world();
+    int frames = (int)roundf(time / dt);
+    for(int i = 0; i < frames; i++) {
+        player.update_position(0, sx, dt, world, physics_types, NEAR_DISTANCE, jump, false);
+    }
+}
+
+TEST(physics, land_on_ground) {
+    Player player(0, Vector3f(5, 20, 5), 0, 0);
+    run(player, 3.0f, 1.0f / 60.0f, 0);
+    CHECK(fabsf(player.position[1] - STANDING_Y) < 0.01f);
+    CHECK(player.position[0] == 5 && player.position[2] == 5);
+}
+
+TEST(physics, stop_at_wall) {
+    /* Slow frames move the player further per update than the wall is thick */
+    const float frames[] = {1.0f / 60.0f, 0.25f};
+    for(float dt : frames) {
+        Player player(0, Vector3f(5, STANDING_Y, 5), 0, 0);
+        run(player, 5.0f, dt, 1);
+        CHECK(fabsf(player.position[0] - WALL_STOP_X) < 0.01f);
+        CHECK(fabsf(player.position[1] - STANDING_Y) < 0.01f);
+    }
+}
+
+TEST(physics, walk_independent_of_frame_rate) {
+    const float frames[] = {1.0f / 30.0f, 1.0f / 60.0f, 1.0f / 144.0f};
+    float walked[3];
+    for(int i = 0; i < 3; i++) {
+        Player player(0, Vector3f(5, STANDING_Y, 5), 0, 0);
+        run(player, 2.0f, frames[i], 1);
+        walked[i] = player.position[0] - 5;
+    }
+    /* Five blocks per second, within a physics tick */
+    for(int i = 0; i < 3; i++) {
+        CHECK(fabsf(walked[i] - 10.0f) < 0.05f);
+        CHECK(fabsf(walked[i] - walked[0]) < 0.05f);
+    }
+}
+
+TEST(physics, jump) {
+    Player player(0, Vector3f(5, STANDING_Y, 5), 0, 0);
+    const World &world = physics_world();
+    float highest = player.position[1];
+    for(int i = 0; i < 120; i++) {
+        player.update_position(0, 0, 1.0f / 60.0f, world, physics_types, NEAR_DISTANCE, i < 2, false);
+        highest = std::max(highest, player.position[1]);
+    }
+    /* Jumps start at 8 blocks per second against a gravity of 25 */
+    CHECK(highest - STANDING_Y > 1.1f && highest - STANDING_Y < 1.4f);
+    CHECK(fabsf(player.position[1] - STANDING_Y) < 0.01f);
+}
+
+TEST(physics, stay_outside_loaded_chunks) {
+    Player player(0, Vector3f(5, 200, 5), 0, 0);
+    run(player, 1.0f, 1.0f / 60.0f, 1);
+    CHECK(player.position == Vector3f(5, 200, 5));
+}
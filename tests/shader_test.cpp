@@ -0,0 +1,173 @@
+#if defined(KONSTRUCTS_EGL)
+#include <cstdio>
+#include <string>
+#include <EGL/egl.h>
+#include <EGL/eglext.h>
+#include "shader.h"
+#include "util.h"
+#include "test.h"
+
+/* Tests of the cache of linked shader programs. They need a GL context,
+ * which is created without a window through EGL. Where EGL has no
+ * display or the driver offers no program binaries, they do nothing. */
+
+using namespace konstructs;
+
+#define SHADER_TEST_NAME "shader_test"
+/* Magic, key, format and length that start a cached program */
+#define PROGRAM_HEADER_SIZE 20
+
+class TestProgram : public ShaderProgram {
+public:
+    TestProgram() :
+        ShaderProgram(SHADER_TEST_NAME,
+                      "#version 330\n"
+                      "in vec3 position;\n"
+                      "uniform mat4 matrix;\n"
+                      "void main() {\n"
+                      "    gl_Position = matrix * vec4(position, 1.0);\n"
+                      "}\n",
+                      "#version 330\n"
+                      "uniform vec4 color;\n"
+                      "out vec4 frag_color;\n"
+                      "void main() {\n"
+                      "    frag_color = color;\n"
+                      "}\n"),
+        position(attributeId("position")),
+        matrix(uniformId("matrix")),
+        color(uniformId("color")) {}
+    bool cached() const {
+        return loaded_from_cache();
+    }
+    const GLuint position;
+    const GLuint matrix;
+    const GLuint color;
+};
+
+/* The default display, or one without any window system where there
+ * is none, as when the tests run on a build server */
+static EGLDisplay initialize_display() {
+    EGLint major, minor;
+    EGLDisplay display = eglGetDisplay(EGL_DEFAULT_DISPLAY);
+    if(display != EGL_NO_DISPLAY && eglInitialize(display, &major, &minor)) {
+        return display;
+    }
+#if defined(EGL_PLATFORM_SURFACELESS_MESA)
+    PFNEGLGETPLATFORMDISPLAYEXTPROC get_platform_display =
+        (PFNEGLGETPLATFORMDISPLAYEXTPROC)eglGetProcAddress("eglGetPlatformDisplayEXT");
+    if(get_platform_display) {
+        display = get_platform_display(EGL_PLATFORM_SURFACELESS_MESA, EGL_DEFAULT_DISPLAY, nullptr);
+        if(display != EGL_NO_DISPLAY && eglInitialize(display, &major, &minor)) {
+            return display;
+        }
+    }
+#endif
+    return EGL_NO_DISPLAY;
+}
+
+/* Make a GL 3.3 core context current, returns false if there is none */
+static bool make_context() {
+    static int made = -1;
+    if(made >= 0) {
+        return made == 1;
+    }
+    made = 0;
+    EGLDisplay display = initialize_display();
+    if(display == EGL_NO_DISPLAY || !eglBindAPI(EGL_OPENGL_API)) {
+        return false;
+    }
+    const EGLint config_attributes[] = {
+        EGL_RENDERABLE_TYPE, EGL_OPENGL_BIT,
+        EGL_NONE
+    };
+    EGLConfig config;
+    EGLint configs = 0;
+    eglChooseConfig(display, config_attributes, &config, 1, &configs);
+    const EGLint context_attributes[] = {
+        EGL_CONTEXT_MAJOR_VERSION, 3,
+        EGL_CONTEXT_MINOR_VERSION, 3,
+        EGL_CONTEXT_OPENGL_PROFILE_MASK, EGL_CONTEXT_OPENGL_CORE_PROFILE_BIT,
+        EGL_NONE
+    };
+    EGLContext context = eglCreateContext(display, configs > 0 ? config : nullptr,
+                                          EGL_NO_CONTEXT, context_attributes);
+    if(context == EGL_NO_CONTEXT ||
+       !eglMakeCurrent(display, EGL_NO_SURFACE, EGL_NO_SURFACE, context)) {
+        return false;
+    }
+    made = 1;
+    return true;
+}
+
+static bool binaries_supported() {
+    GLint formats = 0;
+    glGetIntegerv(GL_NUM_PROGRAM_BINARY_FORMATS, &formats);
+    return formats > 0;
+}
+
+static std::string program_file() {
+    return data_directory() + "/" + SHADER_TEST_NAME + ".program";
+}
+
+static long file_size(const std::string &path) {
+    FILE *file = fopen(path.c_str(), "rb");
+    if(!file) {
+        return -1;
+    }
+    fseek(file, 0, SEEK_END);
+    long size = ftell(file);
+    fclose(file);
+    return size;
+}
+
+TEST(shader, load_cached_program) {
+    if(!make_context() || !binaries_supported()) {
+        printf("no GL context with program binaries, skipped\n");
+        return;
+    }
+    test::use_temporary_home();
+    {
+        TestProgram first;
+        CHECK(!first.cached());
+    }
+    CHECK(file_size(program_file()) > 0);
+    {
+        TestProgram second;
+        CHECK(second.cached());
+        CHECK(glGetError() == GL_NO_ERROR);
+    }
+}
+
+TEST(shader, recompile_damaged_program) {
+    if(!make_context() || !binaries_supported()) {
+        printf("no GL context with program binaries, skipped\n");
+        return;
+    }
+    test::use_temporary_home();
+    {
+        TestProgram first;
+    }
+    long size = file_size(program_file());
+    CHECK(size > 0);
+
+    /* Overwrite the binary after the header, the key still matches */
+    FILE *file = fopen(program_file().c_str(), "r+b");
+    CHECK(file != nullptr);
+    if(file) {
+        fseek(file, PROGRAM_HEADER_SIZE, SEEK_SET);
+        std::string garbage(size - PROGRAM_HEADER_SIZE, 'x');
+        fwrite(garbage.data(), 1, garbage.size(), file);
+        fclose(file);
+    }
+    {
+        TestProgram damaged;
+        CHECK(!damaged.cached());
+    }
+    /* The rewritten binary is used by the next program */
+    {
+        TestProgram rewritten;
+        CHECK(rewritten.cached());
+    }
+}
+
+#endif
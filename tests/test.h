@@ -0,0 +1,50 @@
+#ifndef __TEST_H__
+#define __TEST_H__
+
+#include <chrono>
+#include <cstdio>
+#include <functional>
+
+/** A small test runner for the library. Tests and benchmarks are
+ *  registered in groups, one ctest test runs every test of a group.
+ *  Benchmarks only run when asked for, see main.cpp.
+ */
+namespace konstructs {
+    namespace test {
+        typedef std::function<void()> TestFunction;
+        int add(const char *group, const char *name, const TestFunction &f,
+                const bool benchmark);
+        void fail(const char *file, const int line, const char *expression);
+
+        /* Milliseconds per run of f, run as often as fits in about a second */
+        double measure(const std::function<void()> &f);
+
+        /* Point the user directory at a new empty directory, so that
+         * the caches and stores of the client start out empty */
+        void use_temporary_home();
+    };
+};
+
+#define TEST_FUNCTION_NAME(group, name) test_##group##_##name
+
+#define TEST(group, name) \
+    static void TEST_FUNCTION_NAME(group, name)(); \
+    static const int test_##group##_##name##_id = \
+        konstructs::test::add(#group, #name, TEST_FUNCTION_NAME(group, name), false); \
+    static void TEST_FUNCTION_NAME(group, name)()
+
+#define BENCHMARK(group, name) \
+    static void TEST_FUNCTION_NAME(group, name)(); \
+    static const int test_##group##_##name##_id = \
+        konstructs::test::add(#group, #name, TEST_FUNCTION_NAME(group, name), true); \
+    static void TEST_FUNCTION_NAME(group, name)()
+
+/* A failed check is reported and the test goes on */
+#define CHECK(expression) \
+    do { \
+        if(!(expression)) { \
+            konstructs::test::fail(__FILE__, __LINE__, #expression); \
+        } \
+    } while(0)
+
+#endif
@@ -0,0 +1,90 @@
+#include <algorithm>
+#include <unordered_map>
+#include "world.h"
+#include "test.h"
+
+/* Tests of the memory budget of the world */
+
+using namespace konstructs;
+
+#define CHUNK_BLOCK_BYTES (CHUNK_BLOCKS * (sizeof(BlockData) + sizeof(uint16_t)))
+
+/* A chunk of stone, every block has its own light */
+static ChunkData lit_chunk(const Vector3i &position) {
+    BlockData *blocks = allocate_chunk_blocks();
+    for(int i = 0; i < CHUNK_BLOCKS; i++) {
+        blocks[i] = BlockData();
+        blocks[i].type = 1;
+        blocks[i].light = i % 16;
+    }
+    return ChunkData(position, 1, blocks);
+}
+
+TEST(world, count_unshared_blocks) {
+    World world;
+    /* Uniform, but the blocks belong to the chunk */
+    ChunkData chunk = lit_chunk(Vector3i(0, 0, 0));
+    CHECK(chunk.uniform && !chunk.shared);
+    world.insert(chunk);
+    CHECK(world.bytes() >= CHUNK_BLOCK_BYTES);
+
+    /* Chunks of sky fully lit by ambient light share the cached blocks */
+    std::unordered_map<uint16_t, std::shared_ptr<BlockData>> cached_data;
+    char packed[BLOCKS_HEADER_SIZE + BLOCK_SIZE] = {0};
+    BlockData sky = BlockData();
+    sky.ambient = AMBIENT_LIGHT_FULL;
+    write_block(sky, (uint8_t *)packed + BLOCKS_HEADER_SIZE);
+    for(int i = 1; i <= 2; i++) {
+        ChunkData shared(Vector3i(i, 0, 0), packed, sizeof(packed), cached_data);
+        CHECK(shared.shared);
+        world.insert(shared);
+    }
+    CHECK(world.bytes() == CHUNK_BLOCK_BYTES + 3 * sizeof(ChunkData));
+}
+
+TEST(world, evict_farthest_for_budget) {
+    const int chunks = 12;
+    const int kept = 5;
+    World world(kept * (CHUNK_BLOCK_BYTES + sizeof(ChunkData)));
+    /* Inserted from near to far, the least recently inserted chunks
+     * are those next to the player */
+    for(int i = 0; i < chunks; i++) {
+        world.insert(lit_chunk(Vector3i(i, 0, 0)));
+    }
+    std::vector<Vector3i> evicted;
+    int closest = -1;
+    for(int i = 0; i < chunks && world.bytes() > world.budget_bytes(); i++) {
+        int budget_distance;
+        auto e = world.evict(Vector3i(0, 0, 0), chunks, 1, budget_distance);
+        CHECK(e.size() == 1);
+        CHECK(budget_distance >= 0);
+        evicted.insert(evicted.end(), e.begin(), e.end());
+        closest = budget_distance;
+    }
+    CHECK(world.bytes() <= world.budget_bytes());
+    CHECK(world.size() == kept);
+    for(int i = 0; i < (int)evicted.size(); i++) {
+        CHECK(evicted[i] == Vector3i(chunks - 1 - i, 0, 0));
+    }
+    CHECK(closest == kept);
+
+    /* Within the budget nothing more is evicted */
+    int budget_distance;
+    CHECK(world.evict(Vector3i(0, 0, 0), chunks, 4, budget_distance).empty());
+    CHECK(budget_distance == -1);
+}
+
+TEST(world, keep_close_chunks) {
+    /* Far too little memory for the chunks around the player */
+    World world(CHUNK_BLOCK_BYTES);
+    for(int x = -EVICTION_MIN_DISTANCE; x <= EVICTION_MIN_DISTANCE; x++) {
+        world.insert(lit_chunk(Vector3i(x, 0, 0)));
+    }
+    world.insert(lit_chunk(Vector3i(0, 0, EVICTION_MIN_DISTANCE + 1)));
+    int budget_distance;
+    auto evicted = world.evict(Vector3i(0, 0, 0), 100, 100, budget_distance);
+    CHECK(evicted.size() == 1);
+    CHECK(evicted.size() == 1 && evicted[0] == Vector3i(0, 0, EVICTION_MIN_DISTANCE + 1));
+    CHECK(budget_distance == EVICTION_MIN_DISTANCE + 1);
+    CHECK(world.size() == 2 * EVICTION_MIN_DISTANCE + 1);
+}